@@ -0,0 +1,244 @@
+// Register allocation
+//
+// The compiler takes a fresh register for every value it computes, so
+// register indices only ever grow, and so does the register file of the VM.
+// Most of those registers hold a value for a few instructions only. Liveness
+// is computed over the control flow of each procedure, every register gets
+// the interval between the first and the last instruction where it's alive,
+// and a linear scan over the intervals gives registers whose intervals don't
+// overlap the same index.
+//
+// The VM keeps the registers of the main program global and gives every call
+// of a function a window for the registers used only inside it. Registers are
+// therefore never shared between procedures: each one is numbered on its own,
+// after the registers used by more than one procedure, which keep their
+// values everywhere and get an index of their own.
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "cfg.hpp"
+#include "lir.hpp"
+#include "passes.hpp"
+
+namespace passes {
+
+using lir::Opcode;
+using lir::Operand;
+
+static constexpr auto none = std::numeric_limits<size_t>::max();
+static constexpr auto shared = none - 1;
+
+static std::array<size_t, 2> successors(
+	const lir::Chunk& chunk, const std::vector<size_t>& labels, size_t pc
+);
+static std::vector<size_t> find_procedures(
+	const lir::Chunk& chunk, const std::vector<size_t>& labels
+);
+
+// instructions control may continue at, or none. calls return to the
+// following instruction, as the callee belongs to another procedure
+std::array<size_t, 2> successors(
+	const lir::Chunk& chunk, const std::vector<size_t>& labels, size_t pc
+) {
+	const auto& inst = chunk.m_vec[pc];
+	auto target = [&](size_t i) {
+		auto id = inst.operands[i].as_label().id;
+		return id < labels.size() and labels[id] != lir::unresolved_label
+		       ? labels[id]
+		       : none;
+	};
+	if (inst.opcode == Opcode::RET) return {none, none};
+	auto jump = cfg::jump_operand(inst.opcode);
+	if (jump == cfg::none) return {pc + 1, none};
+	if (inst.opcode == Opcode::JMP) return {target(jump), none};
+	return {target(jump), pc + 1};
+}
+
+// procedure each instruction belongs to, by following control flow from the
+// start and from every call target. instructions that can't be reached are
+// none, and the ones reached from two procedures are shared
+std::vector<size_t> find_procedures(
+	const lir::Chunk& chunk, const std::vector<size_t>& labels
+) {
+	const auto& vec = chunk.m_vec;
+	std::vector<size_t> entries {0};
+	for (const auto& inst : vec)
+		if (inst.opcode == Opcode::CALL
+		    and inst.operands[0].type == Operand::Type::LABEL) {
+			auto id = inst.operands[0].as_label().id;
+			if (id < labels.size() and labels[id] != lir::unresolved_label)
+				entries.push_back(labels[id]);
+		}
+	std::sort(entries.begin(), entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+	std::vector<size_t> owner(vec.size(), none);
+	for (size_t proc = 0; proc < entries.size(); proc++) {
+		std::vector<size_t> work {entries[proc]};
+		while (not work.empty()) {
+			auto pc = work.back();
+			work.pop_back();
+			if (pc >= vec.size() or owner[pc] == proc or owner[pc] == shared)
+				continue;
+			owner[pc] = owner[pc] == none ? proc : shared;
+			for (auto next : successors(chunk, labels, pc))
+				if (next != none) work.push_back(next);
+		}
+	}
+	return owner;
+}
+
+AllocationReport allocate_registers(lir::Chunk& chunk) {
+	auto& vec = chunk.m_vec;
+	const auto labels = lir::resolve_labels(chunk);
+	const auto owner = find_procedures(chunk, labels);
+
+	size_t register_count = 0;
+	auto count = [&](const Operand& opnd) {
+		if (opnd.type == Operand::Type::REGISTER)
+			register_count = std::max(register_count, opnd.as_register().index + 1);
+	};
+	for (const auto& inst : vec)
+		for (const auto& opnd : inst.operands) count(opnd);
+	if (chunk.result_opnd.has_value()) count(chunk.result_opnd.value());
+
+	// procedure using each register. registers of more than one procedure,
+	// of unreachable code or holding the result are left out of the scan
+	std::vector<size_t> user(register_count, none);
+	auto use = [&](const Operand& opnd, size_t proc) {
+		if (opnd.type != Operand::Type::REGISTER) return;
+		auto& u = user[opnd.as_register().index];
+		if (proc == none or (u != none and u != proc))
+			u = shared;
+		else
+			u = proc;
+	};
+	for (size_t pc = 0; pc < vec.size(); pc++)
+		for (const auto& opnd : vec[pc].operands) use(opnd, owner[pc]);
+	if (chunk.result_opnd.has_value()) use(chunk.result_opnd.value(), none);
+
+	// dense numbering of the scanned registers, for the liveness bitsets
+	std::vector<size_t> dense(register_count, none);
+	std::vector<size_t> scanned {};
+	for (size_t reg = 0; reg < register_count; reg++)
+		if (user[reg] != none and user[reg] != shared) {
+			dense[reg] = scanned.size();
+			scanned.push_back(reg);
+		}
+
+	// registers alive on entry of each instruction, as rows of bits
+	const size_t words = (scanned.size() + 63) / 64;
+	std::vector<std::uint64_t> live(vec.size() * words, 0);
+	std::vector<std::uint64_t> row(words);
+	auto bit = [&](const Operand& opnd) -> size_t {
+		if (opnd.type != Operand::Type::REGISTER) return none;
+		return dense[opnd.as_register().index];
+	};
+
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (size_t pc = vec.size(); pc-- > 0;) {
+			if (owner[pc] == none or owner[pc] == shared) continue;
+			std::fill(row.begin(), row.end(), 0);
+			for (auto next : successors(chunk, labels, pc))
+				if (next != none and next < vec.size())
+					for (size_t w = 0; w < words; w++) row[w] |= live[next * words + w];
+
+			const auto& inst = vec[pc];
+			size_t first = 0;
+			if (defines(inst.opcode)) {
+				if (auto b = bit(inst.operands[0]); b != none)
+					row[b / 64] &= ~((std::uint64_t)1 << (b % 64));
+				first = 1;
+			}
+			for (size_t i = first; i < lir::Instruction::max_operands; i++)
+				if (auto b = bit(inst.operands[i]); b != none)
+					row[b / 64] |= (std::uint64_t)1 << (b % 64);
+
+			auto* in = &live[pc * words];
+			if (not std::equal(row.begin(), row.end(), in)) {
+				std::copy(row.begin(), row.end(), in);
+				changed = true;
+			}
+		}
+	}
+
+	// first and last instruction where each register is alive or written
+	std::vector<size_t> start(scanned.size(), none);
+	std::vector<size_t> end(scanned.size(), 0);
+	auto extend = [&](size_t b, size_t pc) {
+		start[b] = std::min(start[b], pc);
+		end[b] = std::max(end[b], pc);
+	};
+	for (size_t pc = 0; pc < vec.size(); pc++) {
+		for (size_t w = 0; w < words; w++)
+			for (auto bits = live[pc * words + w]; bits != 0; bits &= bits - 1)
+				extend(w * 64 + (size_t)std::countr_zero(bits), pc);
+		for (const auto& opnd : vec[pc].operands)
+			if (auto b = bit(opnd); b != none) extend(b, pc);
+	}
+
+	// shared registers come first, then the ones of every procedure in order
+	std::vector<size_t> index(register_count, none);
+	size_t next_index = 0;
+	for (size_t reg = 0; reg < register_count; reg++)
+		if (user[reg] == shared) index[reg] = next_index++;
+
+	std::vector<size_t> order(scanned.size());
+	for (size_t b = 0; b < order.size(); b++) order[b] = b;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		auto pa = user[scanned[a]];
+		auto pb = user[scanned[b]];
+		if (pa != pb) return pa < pb;
+		return start[a] != start[b] ? start[a] < start[b] : end[a] < end[b];
+	});
+
+	using Active = std::pair<size_t, size_t>; // end of interval, index
+	std::priority_queue<Active, std::vector<Active>, std::greater<Active>>
+		active {};
+	std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>>
+		released {};
+	size_t proc = none;
+	for (auto b : order) {
+		if (user[scanned[b]] != proc) {
+			proc = user[scanned[b]];
+			active = {};
+			released = {};
+		}
+		// an index is only reused after the last instruction of its interval,
+		// so no instruction reads and writes different registers through it
+		while (not active.empty() and active.top().first < start[b]) {
+			released.push(active.top().second);
+			active.pop();
+		}
+		if (released.empty()) {
+			index[scanned[b]] = next_index++;
+		} else {
+			index[scanned[b]] = released.top();
+			released.pop();
+		}
+		active.push({end[b], index[scanned[b]]});
+	}
+
+	auto rename = [&](Operand& opnd) {
+		if (opnd.type != Operand::Type::REGISTER) return;
+		auto& reg = opnd.as_register();
+		reg.index = index[reg.index];
+	};
+	for (auto& inst : vec)
+		for (auto& opnd : inst.operands) rename(opnd);
+	if (chunk.result_opnd.has_value()) rename(chunk.result_opnd.value());
+
+	return {register_count, next_index};
+}
+
+} // namespace passes
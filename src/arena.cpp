@@ -0,0 +1,188 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <utility>
+
+#include "vm.hpp"
+
+namespace lir {
+
+Arena::Arena(size_t chunk_size) : m_chunk_size(chunk_size) {}
+
+Arena::~Arena() {
+	reset();
+	for (const auto& chunk : m_spare) delete[] chunk.data;
+}
+
+Value* Arena::allocate(size_t count) {
+	if (m_chunks.empty() or m_chunks.back().size - m_chunks.back().used < count) {
+		if (count > m_chunk_size) {
+			m_chunks.push_back({new Value[count], count, 0, {}});
+		} else if (not m_spare.empty()) {
+			m_chunks.push_back(std::move(m_spare.back()));
+			m_spare.pop_back();
+		} else {
+			m_chunks.push_back({new Value[m_chunk_size], m_chunk_size, 0, {}});
+		}
+	}
+
+	auto& chunk = m_chunks.back();
+	auto* values = chunk.data + chunk.used;
+	chunk.objects.push_back(chunk.used);
+	chunk.used += count;
+	std::fill(values, values + count, Value());
+
+	m_current += count * sizeof(Value);
+	m_peak = std::max(m_peak, m_current);
+	return values;
+}
+
+Arena::Mark Arena::mark() const {
+	if (m_chunks.empty()) return {0, 0};
+	return {m_chunks.size() - 1, m_chunks.back().used};
+}
+
+void Arena::release(Mark mark) {
+	while (m_chunks.size() > mark.chunk + 1) {
+		free_chunk(std::move(m_chunks.back()));
+		m_chunks.pop_back();
+	}
+	if (m_chunks.size() == mark.chunk + 1) {
+		auto& chunk = m_chunks.back();
+		m_current -= (chunk.used - mark.used) * sizeof(Value);
+		chunk.used = mark.used;
+		while (not chunk.objects.empty() and chunk.objects.back() >= mark.used)
+			chunk.objects.pop_back();
+	}
+}
+
+void Arena::reset() {
+	for (auto& chunk : m_chunks) free_chunk(std::move(chunk));
+	m_chunks.clear();
+	m_threshold = min_threshold;
+}
+
+bool Arena::allocated_since(Mark mark, const Value* pointer) const {
+	std::less<const Value*> less {};
+	for (size_t i = mark.chunk; i < m_chunks.size(); i++) {
+		const auto& chunk = m_chunks[i];
+		const auto* begin = chunk.data + (i == mark.chunk ? mark.used : 0);
+		const auto* end = chunk.data + chunk.used;
+		if (not less(pointer, begin) and less(pointer, end)) return true;
+	}
+	return false;
+}
+
+void Arena::collect(const std::vector<Value*>& roots) {
+	auto start = std::chrono::steady_clock::now();
+
+	auto from = std::move(m_chunks);
+	m_chunks.clear();
+	auto before = m_current;
+	m_current = 0;
+
+	// chunks sorted by address, so that the array a pointer points into can
+	// be found by binary search even for pointers to the middle of an array
+	std::less<const Value*> less {};
+	std::vector<size_t> order(from.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return less(from[a].data, from[b].data);
+	});
+
+	// where each array of the old chunks was copied to
+	std::vector<std::vector<Value*>> forward(from.size());
+	for (size_t i = 0; i < from.size(); i++)
+		forward[i].assign(from[i].objects.size(), nullptr);
+
+	// copied arrays whose values weren't relocated yet
+	std::vector<std::pair<Value*, size_t>> pending {};
+
+	auto relocate = [&](Value& value) {
+		if (not value.is_pointer()) return;
+		auto pointer = value.as_pointer();
+		auto* address = (Value*)pointer.address();
+
+		auto it = std::upper_bound(
+			order.begin(),
+			order.end(),
+			address,
+			[&](const Value* p, size_t i) { return less(p, from[i].data); }
+		);
+		if (it == order.begin()) return;
+		auto& chunk = from[*(it - 1)];
+		auto offset = (size_t)(address - chunk.data);
+		if (offset >= chunk.used) return;
+
+		auto object = std::upper_bound(
+			              chunk.objects.begin(), chunk.objects.end(), offset
+			            )
+		            - 1;
+		auto index = (size_t)(object - chunk.objects.begin());
+		auto begin = *object;
+		auto end = index + 1 < chunk.objects.size() ? chunk.objects[index + 1]
+		                                            : chunk.used;
+
+		auto& copy = forward[*(it - 1)][index];
+		if (copy == nullptr) {
+			copy = allocate(end - begin);
+			std::copy(chunk.data + begin, chunk.data + end, copy);
+			pending.push_back({copy, end - begin});
+		}
+		value = Value(copy + (offset - begin), pointer.size());
+	};
+
+	for (auto* root : roots) relocate(*root);
+	while (not pending.empty()) {
+		auto [values, count] = pending.back();
+		pending.pop_back();
+		for (size_t i = 0; i < count; i++) relocate(values[i]);
+	}
+
+	for (auto& chunk : from) drop_chunk(std::move(chunk));
+
+	m_threshold = std::max(
+		min_threshold, (size_t)((double)m_current * std::max(growth, 1.0))
+	);
+
+	auto pause = std::chrono::steady_clock::now() - start;
+	m_collections++;
+	m_collected += before - m_current;
+	m_pause += pause;
+	m_longest_pause = std::max<std::chrono::nanoseconds>(m_longest_pause, pause);
+}
+
+Arena::Stats Arena::stats() const {
+	size_t reserved = 0;
+	for (const auto& chunk : m_chunks) reserved += chunk.size;
+	for (const auto& chunk : m_spare) reserved += chunk.size;
+	return {
+		m_current,
+		m_peak,
+		reserved * sizeof(Value),
+		m_collections,
+		m_collected,
+		m_pause,
+		m_longest_pause
+	};
+}
+
+void Arena::free_chunk(Chunk chunk) {
+	m_current -= chunk.used * sizeof(Value);
+	drop_chunk(std::move(chunk));
+}
+
+// like free_chunk, but without accounting for its values
+void Arena::drop_chunk(Chunk chunk) {
+	if (chunk.size == m_chunk_size) {
+		chunk.used = 0;
+		chunk.objects.clear();
+		m_spare.push_back(std::move(chunk));
+	} else {
+		delete[] chunk.data;
+	}
+}
+
+} // namespace lir
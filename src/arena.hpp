@@ -0,0 +1,100 @@
+// Region allocator and garbage collector for the values of the virtual
+// machine
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace lir {
+
+class Value;
+
+// hands out arrays of values by bumping a pointer through big chunks.
+// arrays are never freed one by one. instead, everything allocated after a
+// mark is released at once, or the arrays still reachable are copied out by
+// the collector and everything else is dropped
+class Arena {
+ public:
+	// position of the bump pointer
+	struct Mark {
+		size_t chunk;
+		size_t used;
+	};
+
+	struct Stats {
+		size_t current;  // bytes handed out and not yet released
+		size_t peak;     // highest current ever reached
+		size_t reserved; // bytes of all chunks, including spare ones
+
+		size_t collections;
+		size_t collected;               // bytes freed by the collector
+		std::chrono::nanoseconds pause; // total time spent collecting
+		std::chrono::nanoseconds longest_pause;
+	};
+
+	// a collection starts once the bytes in use reach the threshold. after
+	// it, the threshold becomes growth times the bytes that survived, but
+	// never less than min_threshold
+	double growth {2.0};
+	size_t min_threshold {1 << 20};
+
+	// chunk_size is in values. bigger requests get a chunk of their own
+	explicit Arena(size_t chunk_size = 4096);
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	// array of count undefined values
+	Value* allocate(size_t count);
+
+	Mark mark() const;
+	void release(Mark mark);
+
+	// release everything
+	void reset();
+
+	// whether pointer was allocated after mark and is still alive
+	bool allocated_since(Mark mark, const Value* pointer) const;
+
+	bool should_collect() const { return m_current >= m_threshold; }
+
+	// copy the arrays reachable from roots into new chunks and release the
+	// old ones. roots are updated to point to the copies. pointers that were
+	// not allocated here are left alone. every earlier mark is invalidated
+	void collect(const std::vector<Value*>& roots);
+
+	Stats stats() const;
+
+ private:
+	struct Chunk {
+		Value* data;
+		size_t size;
+		size_t used;
+		// offset where each array starts, in allocation order
+		std::vector<size_t> objects;
+	};
+
+	void free_chunk(Chunk chunk);
+	void drop_chunk(Chunk chunk);
+
+	size_t m_chunk_size;
+	std::vector<Chunk> m_chunks {};
+	// released chunks of the default size, kept around for reuse
+	std::vector<Chunk> m_spare {};
+	size_t m_current {0};
+	size_t m_peak {0};
+	size_t m_threshold {min_threshold};
+
+	size_t m_collections {0};
+	size_t m_collected {0};
+	std::chrono::nanoseconds m_pause {0};
+	std::chrono::nanoseconds m_longest_pause {0};
+};
+
+} // namespace lir
+
+#endif
@@ -0,0 +1,520 @@
+// Bounds check elimination
+//
+// Every access to an array checks that its base is a pointer, its offset an
+// integer, and that the offset is within the array. The range of integers
+// each register may hold is followed through the control flow graph, along
+// with the least amount of cells left in the arrays registers point to.
+// Arrays come from ALLOCA, whose size is known when its operand's range is,
+// and branches narrow the ranges of the registers they compare on each of
+// their edges, so that the counter of `for i = 0 to n` is known to be below
+// n inside the loop.
+//
+// Ranges grow on every iteration of a loop, so at loop headers the ranges of
+// registers written in the loop are widened to the next constant found in
+// the chunk, and past it to unbounded. Loop bounds are constants in the
+// chunk, so counters usually stop at them.
+//
+// Once nothing changes anymore, accesses whose offset is always within the
+// array become unchecked. Only arrays made by ALLOCA are tracked, which are
+// never string constants, so stores skip that check as well.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "cfg.hpp"
+#include "lir.hpp"
+#include "passes.hpp"
+
+namespace passes {
+
+using lir::Opcode;
+using lir::Operand;
+
+// integers past it are as good as unbounded. sums and differences of
+// bounded values can't overflow
+constexpr int64_t unbounded = int64_t(1) << 62;
+
+// times the ranges are tightened after widening
+constexpr size_t max_narrowings = 4;
+
+// what's known about the value of a register at some point
+struct Fact {
+	// bounds of the integer it holds
+	int64_t lo {-unbounded};
+	int64_t hi {unbounded};
+
+	// least amount of cells in the array it points to, starting at the
+	// pointer. 0 when it's not known to point to an array made by ALLOCA
+	int64_t cells {0};
+
+	bool is_empty() const { return lo > hi; }
+	bool operator==(const Fact&) const = default;
+};
+
+static Fact join(Fact a, Fact b);
+static Fact widen(Fact old, Fact joined, const std::vector<int64_t>& steps);
+static int64_t add(int64_t a, int64_t b);
+static Fact arith(Opcode op, Fact a, Fact b);
+static Opcode negate(Opcode compare);
+static Opcode swap(Opcode compare);
+static bool is_compare(Opcode op);
+static std::optional<Opcode> branch_compare(Opcode op);
+static std::optional<Opcode> unchecked(Opcode op);
+
+Fact join(Fact a, Fact b) {
+	return {
+		std::min(a.lo, b.lo), std::max(a.hi, b.hi), std::min(a.cells, b.cells)
+	};
+}
+
+// bounds that grew move to the next step past them. arrays that shrank are
+// only known to have a cell left
+Fact widen(Fact old, Fact joined, const std::vector<int64_t>& steps) {
+	Fact res = joined;
+	if (joined.lo < old.lo) {
+		auto it = std::upper_bound(steps.begin(), steps.end(), joined.lo);
+		res.lo = it == steps.begin() ? -unbounded : *std::prev(it);
+	}
+	if (joined.hi > old.hi) {
+		auto it = std::lower_bound(steps.begin(), steps.end(), joined.hi);
+		res.hi = it == steps.end() ? unbounded : *it;
+	}
+	if (joined.cells < old.cells) res.cells = std::min<int64_t>(joined.cells, 1);
+	return res;
+}
+
+int64_t add(int64_t a, int64_t b) {
+	if (a <= -unbounded or b <= -unbounded) return -unbounded;
+	if (a >= unbounded or b >= unbounded) return unbounded;
+	return std::clamp(a + b, -unbounded, unbounded);
+}
+
+// range of an arithmetic result. results the VM computes are integers even
+// when nothing is known about the operands
+Fact arith(Opcode op, Fact a, Fact b) {
+	constexpr int64_t small = int64_t(1) << 31;
+	const bool bounded = a.lo > -unbounded and a.hi < unbounded
+	                 and b.lo > -unbounded and b.hi < unbounded;
+	switch (op) {
+		case Opcode::ADD: return {add(a.lo, b.lo), add(a.hi, b.hi)};
+		case Opcode::SUB: return {add(a.lo, -b.hi), add(a.hi, -b.lo)};
+		case Opcode::MUL: {
+			if (not bounded or std::max({-a.lo, a.hi, -b.lo, b.hi}) > small)
+				return {};
+			auto products = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+			return {std::min(products), std::max(products)};
+		}
+		case Opcode::DIV:
+			// division truncates, which keeps the order for positive divisors
+			if (not bounded or b.lo != b.hi or b.lo <= 0) return {};
+			return {a.lo / b.lo, a.hi / b.lo};
+		case Opcode::MOD:
+			// the remainder takes the sign of the dividend
+			if (b.lo <= 0 or b.hi >= unbounded) return {};
+			if (a.lo >= 0) return {0, std::min(a.hi, b.hi - 1)};
+			if (a.hi <= 0) return {std::max(a.lo, 1 - b.hi), 0};
+			return {1 - b.hi, b.hi - 1};
+		default: return {0, 1};
+	}
+}
+
+// the comparison holding when the given one doesn't
+Opcode negate(Opcode compare) {
+	switch (compare) {
+		case Opcode::EQ: return Opcode::DIFF;
+		case Opcode::DIFF: return Opcode::EQ;
+		case Opcode::LESS: return Opcode::GREATER_EQ;
+		case Opcode::LESS_EQ: return Opcode::GREATER;
+		case Opcode::GREATER: return Opcode::LESS_EQ;
+		default: return Opcode::LESS;
+	}
+}
+
+// the comparison holding with the operands swapped
+Opcode swap(Opcode compare) {
+	switch (compare) {
+		case Opcode::LESS: return Opcode::GREATER;
+		case Opcode::LESS_EQ: return Opcode::GREATER_EQ;
+		case Opcode::GREATER: return Opcode::LESS;
+		case Opcode::GREATER_EQ: return Opcode::LESS_EQ;
+		default: return compare;
+	}
+}
+
+bool is_compare(Opcode op) {
+	switch (op) {
+		case Opcode::EQ:
+		case Opcode::DIFF:
+		case Opcode::LESS:
+		case Opcode::LESS_EQ:
+		case Opcode::GREATER:
+		case Opcode::GREATER_EQ: return true;
+		default: return false;
+	}
+}
+
+// comparison made by a compare and jump superinstruction
+std::optional<Opcode> branch_compare(Opcode op) {
+	switch (op) {
+		case Opcode::JMP_EQ: return Opcode::EQ;
+		case Opcode::JMP_DIFF: return Opcode::DIFF;
+		case Opcode::JMP_LESS: return Opcode::LESS;
+		case Opcode::JMP_LESS_EQ: return Opcode::LESS_EQ;
+		case Opcode::JMP_GREATER: return Opcode::GREATER;
+		case Opcode::JMP_GREATER_EQ: return Opcode::GREATER_EQ;
+		default: return {};
+	}
+}
+
+std::optional<Opcode> unchecked(Opcode op) {
+	switch (op) {
+		case Opcode::LOADA: return Opcode::LOADA_U;
+		case Opcode::STOREA: return Opcode::STOREA_U;
+		case Opcode::SHIFTA: return Opcode::SHIFTA_U;
+		default: return {};
+	}
+}
+
+BoundsReport eliminate_bounds_checks(lir::Chunk& chunk) {
+	BoundsReport report {};
+
+	size_t register_count = 0;
+	std::vector<int64_t> steps {};
+	for (const auto& inst : chunk.m_vec)
+		for (const auto& opnd : inst.operands) {
+			if (opnd.type == Operand::Type::REGISTER)
+				register_count =
+					std::max(register_count, opnd.as_register().index + 1);
+			if (opnd.type != Operand::Type::IMMEDIATE) continue;
+			// a bound of `i < n` or `i <= n` is either side of the constant
+			int64_t number = opnd.as_immediate().number;
+			steps.insert(steps.end(), {number - 1, number, number + 1});
+		}
+	std::sort(steps.begin(), steps.end());
+	steps.erase(std::unique(steps.begin(), steps.end()), steps.end());
+
+	cfg::Graph graph {std::move(chunk)};
+	auto& blocks = graph.blocks;
+	const auto shared = cfg::shared_registers(graph, register_count);
+
+	// blocks reached by a back edge, where ranges are widened. only registers
+	// written in the loop are, as the others would stay as wide as they got
+	// on entry, which may be more than what they hold by the end
+	const auto order = cfg::reverse_postorder(graph);
+	std::vector<size_t> position(blocks.size(), cfg::none);
+	for (size_t i = 0; i < order.size(); i++) position[order[i]] = i;
+	std::vector<std::vector<bool>> widened(blocks.size());
+	for (auto b : order)
+		for (auto succ : blocks[b].successors)
+			if (position[succ] <= position[b])
+				widened[succ].assign(register_count, true);
+	const cfg::Loops loops {graph, cfg::Dominators {graph}};
+	for (const auto& loop : loops.loops) {
+		auto& regs = widened[loop.header];
+		regs.assign(register_count, false);
+		for (auto b : loop.blocks)
+			for (const auto& inst : blocks[b].code) {
+				if (inst.opcode == Opcode::CALL)
+					for (size_t reg = 0; reg < register_count; reg++)
+						regs[reg] = regs[reg] or shared[reg];
+				if (defines(inst.opcode)
+				    and inst.operands[0].type == Operand::Type::REGISTER)
+					regs[inst.operands[0].as_register().index] = true;
+			}
+	}
+
+	using State = std::vector<Fact>;
+	auto fact = [](const State& state, const Operand& opnd) -> Fact {
+		switch (opnd.type) {
+			case Operand::Type::IMMEDIATE: {
+				int64_t number = opnd.as_immediate().number;
+				return {number, number};
+			}
+			case Operand::Type::REGISTER: return state[opnd.as_register().index];
+			default: return {};
+		}
+	};
+
+	// whether the access goes to a cell within the array
+	auto in_bounds = [&](const State& state, const lir::Instruction& inst) {
+		auto offset = fact(state, inst.operands[1]);
+		auto base = fact(state, inst.operands[2]);
+		return inst.operands[2].type == Operand::Type::REGISTER
+		   and offset.lo >= 0 and offset.hi < base.cells;
+	};
+
+	// effect of a single instruction on the registers
+	auto step = [&](State& state, const lir::Instruction& inst) {
+		const auto& opnds = inst.operands;
+		if (inst.opcode == Opcode::CALL) {
+			for (size_t reg = 0; reg < register_count; reg++)
+				if (shared[reg]) state[reg] = {};
+			return;
+		}
+		if (not defines(inst.opcode)) return;
+		if (opnds[0].type != Operand::Type::REGISTER) return;
+
+		Fact result {};
+		switch (inst.opcode) {
+			case Opcode::MOV: result = fact(state, opnds[1]); break;
+			case Opcode::ADD:
+			case Opcode::SUB:
+			case Opcode::MUL:
+			case Opcode::DIV:
+			case Opcode::MOD:
+			case Opcode::NOT:
+			case Opcode::OR:
+			case Opcode::AND:
+			case Opcode::EQ:
+			case Opcode::DIFF:
+			case Opcode::LESS:
+			case Opcode::LESS_EQ:
+			case Opcode::GREATER:
+			case Opcode::GREATER_EQ:
+				result =
+					arith(inst.opcode, fact(state, opnds[1]), fact(state, opnds[2]));
+				break;
+			case Opcode::ALLOCA: {
+				auto size = fact(state, opnds[1]);
+				if (size.lo >= 1) result.cells = size.lo;
+				break;
+			}
+			case Opcode::CLONEA: result.cells = fact(state, opnds[1]).cells; break;
+			case Opcode::SHIFTA:
+			case Opcode::SHIFTA_U: {
+				// the shift fails unless a cell is left
+				auto base = fact(state, opnds[2]);
+				auto offset = fact(state, opnds[1]);
+				if (base.cells > 0)
+					result.cells =
+						std::max<int64_t>(1, base.cells - std::max<int64_t>(offset.hi, 0));
+				break;
+			}
+			default: break;
+		}
+		state[opnds[0].as_register().index] = result;
+	};
+
+	// narrow the registers of a block ending in a branch as if the condition
+	// held or not. false if it can't
+	auto narrow = [&](size_t b, State& state, bool holds) {
+		const auto& code = blocks[b].code;
+		// registers written after the instruction
+		auto written_after = [&](size_t i, const Operand& opnd) {
+			if (opnd.type != Operand::Type::REGISTER) return false;
+			for (size_t j = i + 1; j < code.size(); j++)
+				if (defines(code[j].opcode)
+				    and same_operand(code[j].operands[0], opnd))
+					return true;
+			return false;
+		};
+		// registers holding the same value as the operand at the end of the
+		// block: itself, and the source of a move to it
+		auto copies = [&](size_t i, const Operand& opnd) {
+			std::vector<size_t> regs {};
+			if (opnd.type != Operand::Type::REGISTER or written_after(i, opnd))
+				return regs;
+			regs.push_back(opnd.as_register().index);
+			for (size_t j = i; j-- > 0;) {
+				if (not defines(code[j].opcode)
+				    or not same_operand(code[j].operands[0], opnd))
+					continue;
+				if (code[j].opcode == Opcode::MOV
+				    and code[j].operands[1].type == Operand::Type::REGISTER
+				    and not written_after(j, code[j].operands[1]))
+					regs.push_back(code[j].operands[1].as_register().index);
+				break;
+			}
+			return regs;
+		};
+		auto restrict = [&](size_t i, const Operand& opnd, Fact bounds) {
+			for (auto reg : copies(i, opnd)) {
+				auto& known = state[reg];
+				known.lo = std::max(known.lo, bounds.lo);
+				known.hi = std::min(known.hi, bounds.hi);
+				if (known.is_empty()) return false;
+			}
+			return true;
+		};
+		auto compare = [&](size_t i, Opcode op, Operand x, Operand y) {
+			if (op == Opcode::GREATER or op == Opcode::GREATER_EQ) {
+				std::swap(x, y);
+				op = swap(op);
+			}
+			auto a = written_after(i, x) ? Fact {} : fact(state, x);
+			auto b = written_after(i, y) ? Fact {} : fact(state, y);
+			switch (op) {
+				case Opcode::EQ: return restrict(i, x, b) and restrict(i, y, a);
+				case Opcode::DIFF:
+					// only a constant at either end of the range can be cut off
+					if (b.lo == b.hi and (a.lo == b.lo or a.hi == b.lo))
+						return restrict(
+							i, x, {a.lo + (a.lo == b.lo), a.hi - (a.hi == b.lo)}
+						);
+					if (a.lo == a.hi and (b.lo == a.lo or b.hi == a.lo))
+						return restrict(
+							i, y, {b.lo + (b.lo == a.lo), b.hi - (b.hi == a.lo)}
+						);
+					return true;
+				case Opcode::LESS:
+					return restrict(i, x, {-unbounded, add(b.hi, -1)})
+					   and restrict(i, y, {add(a.lo, 1), unbounded});
+				default:
+					return restrict(i, x, {-unbounded, b.hi})
+					   and restrict(i, y, {a.lo, unbounded});
+			}
+		};
+		// conditions computed in the block. conjunctions hold when both sides
+		// do, and negations when their operand doesn't
+		auto condition =
+			[&](auto& self, size_t i, const Operand& cond, bool holds) -> bool {
+			if (cond.type != Operand::Type::REGISTER or written_after(i, cond))
+				return true;
+			size_t j = i;
+			while (j-- > 0)
+				if (defines(code[j].opcode)
+				    and same_operand(code[j].operands[0], cond))
+					break;
+			if (j == (size_t)-1) return true;
+			const auto& def = code[j];
+			const auto& opnds = def.operands;
+			if (same_operand(opnds[0], opnds[1]) or same_operand(opnds[0], opnds[2]))
+				return true;
+			if (is_compare(def.opcode))
+				return compare(
+					j, holds ? def.opcode : negate(def.opcode), opnds[1], opnds[2]
+				);
+			if (def.opcode == Opcode::NOT) return self(self, j, opnds[1], not holds);
+			if (def.opcode == Opcode::AND and holds)
+				return self(self, j, opnds[1], true)
+				   and self(self, j, opnds[2], true);
+			if (def.opcode == Opcode::OR and not holds)
+				return self(self, j, opnds[1], false)
+				   and self(self, j, opnds[2], false);
+			return true;
+		};
+
+		const auto& last = code.back();
+		auto end = code.size() - 1;
+		if (auto op = branch_compare(last.opcode); op.has_value())
+			return compare(
+				end, holds ? op.value() : negate(op.value()),
+				last.operands[0],
+				last.operands[1]
+			);
+		return condition(condition, end, last.operands[0], holds);
+	};
+
+	// registers at the start of each successor the block reaches
+	auto reached = [&](size_t b, const State& state) {
+		std::vector<std::pair<size_t, State>> res {};
+		const auto& block = blocks[b];
+		auto targets = graph.jump_targets(b);
+		const bool branches = not block.code.empty() and not targets.empty()
+		                  and block.code.back().opcode != Opcode::JMP
+		                  and block.fallthrough != targets.front();
+		if (not branches) {
+			for (auto succ : block.successors) res.push_back({succ, state});
+			return res;
+		}
+		auto taken = state;
+		bool jumps = block.code.back().opcode != Opcode::JMP_FALSE;
+		if (narrow(b, taken, jumps)) res.push_back({targets.front(), taken});
+		auto not_taken = state;
+		if (block.fallthrough != cfg::none and narrow(b, not_taken, not jumps))
+			res.push_back({block.fallthrough, not_taken});
+		return res;
+	};
+
+	std::vector<State> in(blocks.size());
+	std::vector<bool> executable(blocks.size(), false);
+	std::vector<size_t> work {};
+	for (auto entry : graph.entries) {
+		in[entry].assign(register_count, {});
+		executable[entry] = true;
+		work.push_back(entry);
+	}
+	while (not work.empty()) {
+		auto b = work.back();
+		work.pop_back();
+		auto state = in[b];
+		for (const auto& inst : blocks[b].code) step(state, inst);
+
+		for (auto& [succ, out] : reached(b, state)) {
+			if (not executable[succ]) {
+				executable[succ] = true;
+				in[succ] = std::move(out);
+				work.push_back(succ);
+				continue;
+			}
+			bool changed = false;
+			for (size_t reg = 0; reg < register_count; reg++) {
+				auto& old = in[succ][reg];
+				auto joined = join(old, out[reg]);
+				if (not widened[succ].empty() and widened[succ][reg])
+					joined = widen(old, joined, steps);
+				if (joined == old) continue;
+				old = joined;
+				changed = true;
+			}
+			if (changed) work.push_back(succ);
+		}
+	}
+
+	// widening overshoots bounds that aren't constants of the chunk, like the
+	// `i - 1` of a counter below n. going over the blocks again without it
+	// only tightens them, as registers started out with wider ranges
+	std::vector<bool> is_entry(blocks.size(), false);
+	for (auto entry : graph.entries) is_entry[entry] = true;
+	for (size_t round = 0; round < max_narrowings; round++) {
+		bool changed = false;
+		for (auto b : order) {
+			if (is_entry[b]) continue;
+			std::optional<State> narrowed {};
+			for (auto pred : blocks[b].predecessors) {
+				if (not executable[pred]) continue;
+				auto state = in[pred];
+				for (const auto& inst : blocks[pred].code) step(state, inst);
+				for (auto& [succ, out] : reached(pred, state)) {
+					if (succ != b) continue;
+					if (not narrowed.has_value()) {
+						narrowed = std::move(out);
+						continue;
+					}
+					for (size_t reg = 0; reg < register_count; reg++)
+						(*narrowed)[reg] = join((*narrowed)[reg], out[reg]);
+				}
+			}
+			if (not narrowed.has_value() or narrowed.value() == in[b]) continue;
+			in[b] = std::move(narrowed.value());
+			changed = true;
+		}
+		if (not changed) break;
+	}
+
+	for (size_t b = 0; b < blocks.size(); b++) {
+		if (not executable[b]) continue;
+		auto state = in[b];
+		for (auto& inst : blocks[b].code) {
+			auto op = unchecked(inst.opcode);
+			if (op.has_value()) {
+				report.accesses++;
+				if (in_bounds(state, inst)) {
+					inst.opcode = op.value();
+					report.unchecked++;
+				}
+			}
+			step(state, inst);
+		}
+	}
+
+	chunk = cfg::linearize(std::move(graph));
+	return report;
+}
+
+} // namespace passes
@@ -0,0 +1,566 @@
+#include "bytecode.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "lir.hpp"
+
+namespace bytecode {
+
+constexpr auto none = std::numeric_limits<std::size_t>::max();
+
+// procedure 0 is the main program, the others are called functions
+struct Procedures {
+	std::vector<std::size_t> entries;
+	// procedure each instruction belongs to, or none if it can't run
+	std::vector<std::size_t> owner;
+};
+
+// what an operand slot of an instruction holds
+enum class Role {
+	NONE,     // unused
+	REGISTER, // written, or holding the array of an array instruction
+	VALUE,    // read, an unused slot reads as 0
+	TARGET,   // jumped or called to
+	WINDOW,   // size of the register window of a function
+};
+
+static Opcode lower_opcode(lir::Opcode op);
+static std::int32_t narrow(std::size_t value, const char* what);
+static void successors(
+	const Code& code, std::size_t pc, std::vector<std::size_t>& out
+);
+static Procedures find_procedures(const Chunk& chunk);
+static void assign_windows(Chunk& chunk);
+static lir::Opcode lift_opcode(Opcode op);
+static std::size_t operand_count(Opcode op);
+static Role role(Opcode op, std::size_t i);
+static bool accepts(Role role, Kind kind);
+static void check_stack(const Chunk& chunk, const Procedures& procs);
+static std::optional<std::pair<Opcode, Opcode>> quick_forms(Opcode op);
+static std::optional<Opcode> mirror(Opcode op);
+
+lir::Opcode lift_opcode(Opcode op) {
+	switch (op) {
+#define BYTECODE_LIFT(NAME) \
+	case Opcode::NAME: return lir::Opcode::NAME;
+		BYTECODE_LIR_OPCODES(BYTECODE_LIFT)
+#undef BYTECODE_LIFT
+		default: break;
+	}
+	assert(false);
+}
+
+Opcode lower_opcode(lir::Opcode op) {
+	switch (op) {
+#define BYTECODE_LOWER(NAME) \
+	case lir::Opcode::NAME: return Opcode::NAME;
+		BYTECODE_LIR_OPCODES(BYTECODE_LOWER)
+#undef BYTECODE_LOWER
+	}
+	assert(false);
+}
+
+std::int32_t narrow(std::size_t value, const char* what) {
+	if (value > (std::size_t)std::numeric_limits<std::int32_t>::max())
+		throw std::runtime_error(std::format("{} {} does not fit", what, value));
+	return (std::int32_t)value;
+}
+
+Chunk lower(lir::Chunk chunk) {
+	Chunk res {};
+	res.codes.reserve(chunk.m_vec.size() + 1);
+	res.locations.reserve(chunk.m_vec.size() + 1);
+
+	lir::link(chunk);
+
+	auto lower_operand =
+		[&](const lir::Operand& opnd) -> std::pair<Kind, std::int32_t> {
+		switch (opnd.type) {
+			case lir::Operand::Type::NOTHING: return {Kind::NOTHING, 0};
+			case lir::Operand::Type::REGISTER: {
+				auto index = opnd.as_register().index;
+				if (index >= res.register_count) res.register_count = index + 1;
+				return {Kind::REGISTER, narrow(index, "register")};
+			}
+			case lir::Operand::Type::LABEL:
+				return {Kind::OFFSET, narrow(opnd.as_label().id, "offset")};
+			case lir::Operand::Type::IMMEDIATE:
+				return {Kind::IMMEDIATE, opnd.as_immediate().number};
+			case lir::Operand::Type::STRING: {
+				auto id = opnd.as_string().id;
+				if (id >= chunk.strings.size())
+					throw std::runtime_error(std::format("unknown string S{:03}", id));
+				return {Kind::STRING, narrow(id, "string")};
+			}
+			case lir::Operand::Type::FUN: break;
+		}
+		throw std::runtime_error("operand can't be lowered to bytecode");
+	};
+
+	for (const auto& inst : chunk.m_vec) {
+		Code code {lower_opcode(inst.opcode), 0, {0, 0, 0}};
+		for (size_t i = 0; i < Code::max_operands; i++) {
+			auto [kind, value] = lower_operand(inst.operands[i]);
+			code.set_kind(i, kind);
+			code.operands[i] = value;
+		}
+		res.codes.push_back(code);
+		res.locations.push_back(inst.location);
+	}
+	res.codes.push_back(Code {Opcode::HALT, 0, {0, 0, 0}});
+	res.locations.emplace_back();
+
+	if (chunk.result_opnd.has_value())
+		res.result = lower_operand(chunk.result_opnd.value());
+
+	res.strings = std::move(chunk.strings);
+
+	assign_windows(res);
+
+	return res;
+}
+
+// instructions that may run after the one at pc. a call continues after
+// it returns, and nothing runs after a return or the end of the program
+void successors(
+	const Code& code, std::size_t pc, std::vector<std::size_t>& out
+) {
+	switch (code.opcode) {
+		case Opcode::JMP: out.push_back((std::size_t)code.operands[0]); break;
+		case Opcode::JMP_FALSE:
+		case Opcode::JMP_TRUE:
+			out.push_back((std::size_t)code.operands[1]);
+			out.push_back(pc + 1);
+			break;
+		case Opcode::JMP_EQ:
+		case Opcode::JMP_DIFF:
+		case Opcode::JMP_LESS:
+		case Opcode::JMP_LESS_EQ:
+		case Opcode::JMP_GREATER:
+		case Opcode::JMP_GREATER_EQ:
+		case Opcode::JMP_EQ_I:
+		case Opcode::JMP_DIFF_I:
+		case Opcode::JMP_LESS_I:
+		case Opcode::JMP_LESS_EQ_I:
+		case Opcode::JMP_GREATER_I:
+		case Opcode::JMP_GREATER_EQ_I:
+			out.push_back((std::size_t)code.operands[2]);
+			out.push_back(pc + 1);
+			break;
+		case Opcode::RET:
+		case Opcode::HALT: break;
+		default: out.push_back(pc + 1); break;
+	}
+}
+
+Procedures find_procedures(const Chunk& chunk) {
+	const auto& codes = chunk.codes;
+	Procedures res {};
+
+	res.entries.push_back(0);
+	for (const auto& code : codes)
+		if (code.opcode == Opcode::CALL)
+			res.entries.push_back((std::size_t)code.operands[0]);
+	std::sort(res.entries.begin(), res.entries.end());
+	res.entries.erase(
+		std::unique(res.entries.begin(), res.entries.end()), res.entries.end()
+	);
+
+	res.owner.assign(codes.size(), none);
+	std::vector<std::size_t> work {};
+	for (std::size_t proc = 0; proc < res.entries.size(); proc++) {
+		if (proc > 0 and codes[res.entries[proc]].opcode != Opcode::FUNC)
+			throw std::runtime_error(
+				std::format("call target {} is not a function", res.entries[proc])
+			);
+		work.push_back(res.entries[proc]);
+		while (not work.empty()) {
+			auto pc = work.back();
+			work.pop_back();
+			if (pc >= codes.size() or res.owner[pc] == proc) continue;
+			if (res.owner[pc] != none)
+				throw std::runtime_error(
+					std::format("instruction {} belongs to two procedures", pc)
+				);
+			res.owner[pc] = proc;
+			successors(codes[pc], pc, work);
+		}
+	}
+	return res;
+}
+
+// registers referenced by a single function are moved into the register
+// window of its calls, so that recursive calls don't clobber each other.
+// everything else, including the registers of the main program, stays global
+void assign_windows(Chunk& chunk) {
+	constexpr auto shared = none - 1;
+	auto& codes = chunk.codes;
+	const auto [entries, owner] = find_procedures(chunk);
+
+	// procedure using each register, or shared if more than one does. the
+	// result is read after the program ends, so it must be global
+	std::vector<std::size_t> user(chunk.register_count, none);
+	auto use = [&](std::size_t reg, std::size_t proc) {
+		if (user[reg] == none)
+			user[reg] = proc;
+		else if (user[reg] != proc)
+			user[reg] = shared;
+	};
+	for (std::size_t pc = 0; pc < codes.size(); pc++)
+		for (std::size_t i = 0; i < Code::max_operands; i++)
+			if (codes[pc].kind(i) == Kind::REGISTER)
+				use((std::size_t)codes[pc].operands[i], owner[pc]);
+	if (chunk.result.has_value() and chunk.result->first == Kind::REGISTER)
+		use((std::size_t)chunk.result->second, shared);
+
+	std::vector<std::int32_t> slot(chunk.register_count, -1);
+	std::vector<std::size_t> window(entries.size(), 0);
+	std::size_t global_count = 0;
+	for (auto& code : codes)
+		for (std::size_t i = 0; i < Code::max_operands; i++) {
+			if (code.kind(i) != Kind::REGISTER) continue;
+			auto reg = (std::size_t)code.operands[i];
+			auto proc = user[reg];
+			if (proc == none or proc == shared or proc == 0) {
+				global_count = std::max(global_count, reg + 1);
+				continue;
+			}
+			if (slot[reg] < 0) slot[reg] = narrow(window[proc]++, "window");
+			code.operands[i] = slot[reg];
+			code.set_kind(i, Kind::LOCAL);
+		}
+	if (chunk.result.has_value() and chunk.result->first == Kind::REGISTER)
+		global_count =
+			std::max(global_count, (std::size_t)chunk.result->second + 1);
+	chunk.register_count = global_count;
+
+	for (std::size_t proc = 1; proc < entries.size(); proc++) {
+		auto& func = codes[entries[proc]];
+		func.operands[0] = narrow(window[proc], "window");
+		func.set_kind(0, Kind::IMMEDIATE);
+	}
+}
+
+// lowering adds the size of the window to FUNC
+std::size_t operand_count(Opcode op) {
+	switch (op) {
+		case Opcode::FUNC: return 1;
+		case Opcode::HALT: return 0;
+		default: return lir::opcode_opnd_count(lift_opcode(op));
+	}
+}
+
+Role role(Opcode op, std::size_t i) {
+	if (i >= operand_count(op)) return Role::NONE;
+	switch (op) {
+		case Opcode::JMP:
+		case Opcode::CALL: return Role::TARGET;
+		case Opcode::JMP_FALSE:
+		case Opcode::JMP_TRUE: return i == 1 ? Role::TARGET : Role::VALUE;
+		case Opcode::JMP_EQ:
+		case Opcode::JMP_DIFF:
+		case Opcode::JMP_LESS:
+		case Opcode::JMP_LESS_EQ:
+		case Opcode::JMP_GREATER:
+		case Opcode::JMP_GREATER_EQ:
+		case Opcode::JMP_EQ_I:
+		case Opcode::JMP_DIFF_I:
+		case Opcode::JMP_LESS_I:
+		case Opcode::JMP_LESS_EQ_I:
+		case Opcode::JMP_GREATER_I:
+		case Opcode::JMP_GREATER_EQ_I: return i == 2 ? Role::TARGET : Role::VALUE;
+		case Opcode::FUNC: return Role::WINDOW;
+		case Opcode::PRINTF:
+		case Opcode::PRINTV:
+		case Opcode::PRINTC:
+		case Opcode::PUSH: return Role::VALUE;
+		case Opcode::STOREA:
+		case Opcode::STOREA_U:
+		case Opcode::ADDA:
+		case Opcode::SUBA: return i == 2 ? Role::REGISTER : Role::VALUE;
+		case Opcode::LOADA:
+		case Opcode::LOADA_U:
+		case Opcode::SHIFTA:
+		case Opcode::SHIFTA_U: return i == 1 ? Role::VALUE : Role::REGISTER;
+		// the rest write their first operand
+		default: return i == 0 ? Role::REGISTER : Role::VALUE;
+	}
+}
+
+bool accepts(Role role, Kind kind) {
+	switch (role) {
+		case Role::NONE: return kind == Kind::NOTHING;
+		case Role::REGISTER: return is_register(kind);
+		case Role::VALUE: return kind != Kind::OFFSET and kind <= Kind::STRING;
+		case Role::TARGET: return kind == Kind::OFFSET;
+		case Role::WINDOW: return kind == Kind::IMMEDIATE;
+	}
+	assert(false);
+}
+
+// stack depth of every procedure relative to its entry, which must be the
+// same on every path. a call moves it by the depth its function returns at,
+// and may go as deep below it as the function does. the main program must
+// never go below its entry, or a POP would find the stack empty. a function
+// reaches the depth it returns at only after the calls it makes do, so
+// nothing follows a call until its function was seen returning
+void check_stack(const Chunk& chunk, const Procedures& procs) {
+	const auto& codes = chunk.codes;
+	const auto count = procs.entries.size();
+
+	std::vector<std::size_t> callee(codes.size(), none);
+	for (std::size_t proc = 0; proc < count; proc++)
+		callee[procs.entries[proc]] = proc;
+
+	std::vector<std::optional<std::ptrdiff_t>> returns(count);
+	std::vector<std::ptrdiff_t> lowest(count, 0);
+	std::vector<std::optional<std::ptrdiff_t>> depth(codes.size());
+	std::vector<std::size_t> work {};
+	std::vector<std::size_t> next {};
+
+	// every round follows a function further up the calls to it, so more
+	// rounds than twice the functions only happen when it never stops
+	for (std::size_t round = 0;; round++) {
+		bool changed = false;
+		for (std::size_t proc = 0; proc < count; proc++) {
+			auto low = lowest[proc];
+			std::vector<std::size_t> seen {procs.entries[proc]};
+			depth[procs.entries[proc]] = 0;
+			work.push_back(procs.entries[proc]);
+			while (not work.empty()) {
+				auto pc = work.back();
+				work.pop_back();
+				const auto& code = codes[pc];
+				auto now = depth[pc].value();
+				if (code.opcode == Opcode::PUSH) {
+					now++;
+				} else if (code.opcode == Opcode::POP) {
+					now--;
+				} else if (code.opcode == Opcode::CALL) {
+					auto f = callee[(std::size_t)code.operands[0]];
+					if (not returns[f].has_value()) continue;
+					low = std::min(low, now + lowest[f]);
+					now += returns[f].value();
+				} else if (code.opcode == Opcode::RET) {
+					if (not returns[proc].has_value()) {
+						returns[proc] = now;
+						changed = true;
+					} else if (returns[proc].value() != now) {
+						throw std::runtime_error(
+							std::format(
+								"function {} returns at two stack depths", procs.entries[proc]
+							)
+						);
+					}
+				}
+				low = std::min(low, now);
+
+				next.clear();
+				successors(code, pc, next);
+				for (auto succ : next) {
+					if (not depth[succ].has_value()) {
+						depth[succ] = now;
+						seen.push_back(succ);
+						work.push_back(succ);
+					} else if (depth[succ].value() != now) {
+						throw std::runtime_error(
+							std::format("stack depth at {} depends on the path", succ)
+						);
+					}
+				}
+			}
+			for (auto pc : seen) depth[pc].reset();
+
+			if (low < lowest[proc]) {
+				lowest[proc] = low;
+				changed = true;
+			}
+		}
+		if (lowest[0] < 0)
+			throw std::runtime_error("the program pops more values than it pushes");
+		if (not changed) break;
+		if (round > 2 * count)
+			throw std::runtime_error("a function pops values without bound");
+	}
+}
+
+void verify(const Chunk& chunk) {
+	const auto& codes = chunk.codes;
+	if (codes.empty() or codes.back().opcode != Opcode::HALT)
+		throw std::runtime_error("chunk does not end in HALT");
+
+	auto within = [](std::int32_t value, std::size_t bound) {
+		return value >= 0 and (std::size_t)value < bound;
+	};
+	auto fail = [](std::size_t pc, const char* what) {
+		throw std::runtime_error(std::format("instruction {}: {}", pc, what));
+	};
+
+	for (std::size_t pc = 0; pc < codes.size(); pc++) {
+		const auto& code = codes[pc];
+		if ((std::size_t)code.opcode > (std::size_t)Opcode::HALT)
+			fail(pc, "unknown or quickened opcode");
+		for (std::size_t i = 0; i < Code::max_operands; i++) {
+			auto kind = code.kind(i);
+			auto value = code.operands[i];
+			if (not accepts(role(code.opcode, i), kind))
+				fail(pc, "operand of the wrong kind");
+			if (kind == Kind::REGISTER and not within(value, chunk.register_count))
+				fail(pc, "register out of bounds");
+			if (kind == Kind::OFFSET and not within(value, codes.size()))
+				fail(pc, "offset out of bounds");
+			if (kind == Kind::STRING and not within(value, chunk.strings.size()))
+				fail(pc, "unknown string");
+			if (role(code.opcode, i) == Role::WINDOW and value < 0)
+				fail(pc, "negative window");
+		}
+	}
+
+	if (chunk.result.has_value()) {
+		auto [kind, value] = chunk.result.value();
+		if ((kind == Kind::REGISTER and not within(value, chunk.register_count))
+		    or (kind == Kind::STRING and not within(value, chunk.strings.size()))
+		    or kind == Kind::LOCAL or kind == Kind::OFFSET)
+			throw std::runtime_error("result operand out of bounds");
+	}
+
+	const auto procs = find_procedures(chunk);
+	for (std::size_t pc = 0; pc < codes.size(); pc++) {
+		auto proc = procs.owner[pc];
+		if (proc == none) continue;
+		const auto& code = codes[pc];
+		if (code.opcode == Opcode::FUNC and pc != procs.entries[proc])
+			fail(pc, "function entered without a call");
+		if (code.opcode == Opcode::RET and proc == 0)
+			fail(pc, "return outside of a function");
+		for (std::size_t i = 0; i < Code::max_operands; i++) {
+			if (code.kind(i) != Kind::LOCAL) continue;
+			if (proc == 0) fail(pc, "local register outside of a function");
+			auto window = codes[procs.entries[proc]].operands[0];
+			if (not within(code.operands[i], (std::size_t)window))
+				fail(pc, "local register out of the window");
+		}
+	}
+
+	check_stack(chunk, procs);
+}
+
+// register and immediate forms of the integer operations
+std::optional<std::pair<Opcode, Opcode>> quick_forms(Opcode op) {
+	switch (op) {
+#define BYTECODE_QUICK_FORMS(NAME) \
+	case Opcode::NAME: return std::pair {Opcode::NAME##_RR, Opcode::NAME##_RI};
+		BYTECODE_QUICK_FORMS(ADD_I)
+		BYTECODE_QUICK_FORMS(SUB_I)
+		BYTECODE_QUICK_FORMS(MUL_I)
+		BYTECODE_QUICK_FORMS(EQ_I)
+		BYTECODE_QUICK_FORMS(DIFF_I)
+		BYTECODE_QUICK_FORMS(LESS_I)
+		BYTECODE_QUICK_FORMS(LESS_EQ_I)
+		BYTECODE_QUICK_FORMS(GREATER_I)
+		BYTECODE_QUICK_FORMS(GREATER_EQ_I)
+		BYTECODE_QUICK_FORMS(JMP_EQ_I)
+		BYTECODE_QUICK_FORMS(JMP_DIFF_I)
+		BYTECODE_QUICK_FORMS(JMP_LESS_I)
+		BYTECODE_QUICK_FORMS(JMP_LESS_EQ_I)
+		BYTECODE_QUICK_FORMS(JMP_GREATER_I)
+		BYTECODE_QUICK_FORMS(JMP_GREATER_EQ_I)
+#undef BYTECODE_QUICK_FORMS
+		default: return {};
+	}
+}
+
+// the operation giving the same result with its operands swapped
+std::optional<Opcode> mirror(Opcode op) {
+	switch (op) {
+		case Opcode::ADD_I:
+		case Opcode::MUL_I:
+		case Opcode::EQ_I:
+		case Opcode::DIFF_I:
+		case Opcode::JMP_EQ_I:
+		case Opcode::JMP_DIFF_I: return op;
+		case Opcode::LESS_I: return Opcode::GREATER_I;
+		case Opcode::LESS_EQ_I: return Opcode::GREATER_EQ_I;
+		case Opcode::GREATER_I: return Opcode::LESS_I;
+		case Opcode::GREATER_EQ_I: return Opcode::LESS_EQ_I;
+		case Opcode::JMP_LESS_I: return Opcode::JMP_GREATER_I;
+		case Opcode::JMP_LESS_EQ_I: return Opcode::JMP_GREATER_EQ_I;
+		case Opcode::JMP_GREATER_I: return Opcode::JMP_LESS_I;
+		case Opcode::JMP_GREATER_EQ_I: return Opcode::JMP_LESS_EQ_I;
+		default: return {};
+	}
+}
+
+std::vector<Code> quicken(const Chunk& chunk) {
+	auto codes = chunk.codes;
+	const auto procs = find_procedures(chunk);
+
+	for (std::size_t pc = 0; pc < codes.size(); pc++) {
+		auto& code = codes[pc];
+		auto windowed = [&](std::size_t i) {
+			return code.kind(i) == Kind::LOCAL
+			    or (code.kind(i) == Kind::REGISTER and procs.owner[pc] == 0);
+		};
+		auto immediate = [&](std::size_t i) {
+			return code.kind(i) == Kind::IMMEDIATE;
+		};
+
+		switch (code.opcode) {
+			case Opcode::MOV:
+				if (windowed(0) and windowed(1)) code.opcode = Opcode::MOV_R;
+				if (windowed(0) and immediate(1)) code.opcode = Opcode::MOV_I;
+				continue;
+			case Opcode::JMP_FALSE:
+				if (windowed(0)) code.opcode = Opcode::JMP_FALSE_R;
+				continue;
+			case Opcode::JMP_TRUE:
+				if (windowed(0)) code.opcode = Opcode::JMP_TRUE_R;
+				continue;
+			case Opcode::LOADA_U:
+				if (not windowed(0) or not windowed(2)) continue;
+				if (windowed(1)) code.opcode = Opcode::LOADA_U_RR;
+				if (immediate(1)) code.opcode = Opcode::LOADA_U_IR;
+				continue;
+			default: break;
+		}
+
+		if (not quick_forms(code.opcode).has_value()) continue;
+		// jumps read their first two operands, the rest write the first
+		std::size_t a = code.kind(2) == Kind::OFFSET ? 0 : 1;
+		std::size_t b = a + 1;
+		if (a == 1 and not windowed(0)) continue;
+		auto mirrored = mirror(code.opcode);
+		if (immediate(a) and windowed(b) and mirrored.has_value()) {
+			code.opcode = mirrored.value();
+			std::swap(code.operands[a], code.operands[b]);
+			auto kind = code.kind(a);
+			code.set_kind(a, code.kind(b));
+			code.set_kind(b, kind);
+		}
+		auto [rr, ri] = quick_forms(code.opcode).value();
+		if (windowed(a) and windowed(b)) code.opcode = rr;
+		if (windowed(a) and immediate(b)) code.opcode = ri;
+	}
+	return codes;
+}
+
+const char* opcode_name(Opcode op) {
+	switch (op) {
+#define BYTECODE_NAME(NAME) \
+	case Opcode::NAME: return #NAME;
+		BYTECODE_OPCODES(BYTECODE_NAME)
+#undef BYTECODE_NAME
+	}
+	assert(false);
+}
+
+} // namespace bytecode
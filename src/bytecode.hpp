@@ -1,14 +1,212 @@
+// Dense bytecode executed by the virtual machine
+
 #ifndef BYTECODE_HPP
 #define BYTECODE_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "lir.hpp"
+
 namespace bytecode {
-struct Code {};
+
+// opcodes that map one to one to LIR opcodes
+#define BYTECODE_LIR_OPCODES(X) \
+	X(PRINTF)                     \
+	X(PRINTV)                     \
+	X(PRINTC)                     \
+	X(READV)                      \
+	X(READC)                      \
+	X(MOV)                        \
+	X(ADD)                        \
+	X(SUB)                        \
+	X(MUL)                        \
+	X(DIV)                        \
+	X(MOD)                        \
+	X(NOT)                        \
+	X(OR)                         \
+	X(AND)                        \
+	X(EQ)                         \
+	X(DIFF)                       \
+	X(LESS)                       \
+	X(LESS_EQ)                    \
+	X(GREATER)                    \
+	X(GREATER_EQ)                 \
+	X(JMP)                        \
+	X(JMP_FALSE)                  \
+	X(JMP_TRUE)                   \
+	X(PUSH)                       \
+	X(POP)                        \
+	X(CALL)                       \
+	X(RET)                        \
+	X(FUNC)                       \
+	X(NOP)                        \
+	X(ALLOCA)                     \
+	X(LOADA)                      \
+	X(STOREA)                     \
+	X(SHIFTA)                     \
+	X(CLONEA)                     \
+	X(JMP_EQ)                     \
+	X(JMP_DIFF)                   \
+	X(JMP_LESS)                   \
+	X(JMP_LESS_EQ)                \
+	X(JMP_GREATER)                \
+	X(JMP_GREATER_EQ)             \
+	X(ADDA)                       \
+	X(SUBA)                       \
+	X(LOADA_U)                    \
+	X(STOREA_U)                   \
+	X(SHIFTA_U)                   \
+	X(ADD_I)                      \
+	X(SUB_I)                      \
+	X(MUL_I)                      \
+	X(EQ_I)                       \
+	X(DIFF_I)                     \
+	X(LESS_I)                     \
+	X(LESS_EQ_I)                  \
+	X(GREATER_I)                  \
+	X(GREATER_EQ_I)               \
+	X(JMP_EQ_I)                   \
+	X(JMP_DIFF_I)                 \
+	X(JMP_LESS_I)                 \
+	X(JMP_LESS_EQ_I)              \
+	X(JMP_GREATER_I)              \
+	X(JMP_GREATER_EQ_I)
+
+// opcodes that only exist in bytecode. HALT ends the program and is always
+// the last instruction of a chunk
+#define BYTECODE_VM_OPCODES(X) X(HALT)
+
+// variants the VM quickens instructions into when it loads a chunk, for the
+// kinds of the operands they read: R for a register of the current window
+// and I for an immediate. they come after HALT, and chunks holding them
+// don't verify
+#define BYTECODE_QUICK_OPCODES(X) \
+	X(MOV_R)                        \
+	X(MOV_I)                        \
+	X(ADD_I_RR)                     \
+	X(ADD_I_RI)                     \
+	X(SUB_I_RR)                     \
+	X(SUB_I_RI)                     \
+	X(MUL_I_RR)                     \
+	X(MUL_I_RI)                     \
+	X(EQ_I_RR)                      \
+	X(EQ_I_RI)                      \
+	X(DIFF_I_RR)                    \
+	X(DIFF_I_RI)                    \
+	X(LESS_I_RR)                    \
+	X(LESS_I_RI)                    \
+	X(LESS_EQ_I_RR)                 \
+	X(LESS_EQ_I_RI)                 \
+	X(GREATER_I_RR)                 \
+	X(GREATER_I_RI)                 \
+	X(GREATER_EQ_I_RR)              \
+	X(GREATER_EQ_I_RI)              \
+	X(JMP_EQ_I_RR)                  \
+	X(JMP_EQ_I_RI)                  \
+	X(JMP_DIFF_I_RR)                \
+	X(JMP_DIFF_I_RI)                \
+	X(JMP_LESS_I_RR)                \
+	X(JMP_LESS_I_RI)                \
+	X(JMP_LESS_EQ_I_RR)             \
+	X(JMP_LESS_EQ_I_RI)             \
+	X(JMP_GREATER_I_RR)             \
+	X(JMP_GREATER_I_RI)             \
+	X(JMP_GREATER_EQ_I_RR)          \
+	X(JMP_GREATER_EQ_I_RI)          \
+	X(JMP_FALSE_R)                  \
+	X(JMP_TRUE_R)                   \
+	X(LOADA_U_RR)                   \
+	X(LOADA_U_IR)
+
+// list of every bytecode opcode. kept as a macro so that tables indexed by
+// opcode (names, dispatch) are always generated in the same order
+#define BYTECODE_OPCODES(X) \
+	BYTECODE_LIR_OPCODES(X) BYTECODE_VM_OPCODES(X) BYTECODE_QUICK_OPCODES(X)
+
+enum class Opcode : std::uint8_t {
+#define BYTECODE_ENUM(NAME) NAME,
+	BYTECODE_OPCODES(BYTECODE_ENUM)
+#undef BYTECODE_ENUM
+};
+
+// what an operand slot holds
+enum class Kind : std::uint8_t {
+	NOTHING,   // unused slot, reads as 0
+	REGISTER,  // index into the global registers
+	LOCAL,     // index into the register window of the current call
+	IMMEDIATE, // signed integer constant
+	OFFSET,    // absolute instruction offset, resolved from a label
+	STRING,    // index into the string segment, reads as a read-only pointer
+};
+
+inline bool is_register(Kind kind) {
+	return kind == Kind::REGISTER or kind == Kind::LOCAL;
+}
+
+// a single fixed-width instruction. operand kinds are packed three bits each
+struct Code {
+	static constexpr auto max_operands = lir::Instruction::max_operands;
+
+	Opcode opcode;
+	std::uint16_t kinds;
+	std::int32_t operands[max_operands];
+
+	Kind kind(std::size_t i) const {
+		return static_cast<Kind>((kinds >> (3 * i)) & 0b111);
+	}
+
+	void set_kind(std::size_t i, Kind kind) {
+		kinds &= (std::uint16_t)~(0b111 << (3 * i));
+		kinds |= (std::uint16_t)((std::uint16_t)kind << (3 * i));
+	}
+};
+
+static_assert(sizeof(Code) == 16);
 
 struct Chunk {
 	std::vector<Code> codes;
+
+	// amount of global registers referenced by the code. registers only used
+	// inside a single function live in the register window of its calls
+	// instead, and the window size is the operand of the function's FUNC
+	std::size_t register_count {0};
+
+	// operand holding the value of the whole program, if any
+	std::optional<std::pair<Kind, std::int32_t>> result;
+
+	// contents of the string constants, laid out by the VM before it runs
+	std::vector<std::string> strings;
+
+	// source location of each code, from the instruction it was lowered from
+	std::vector<std::optional<Location>> locations;
 };
+
+// translate a chunk into bytecode. the chunk is linked first, so labels
+// become absolute offsets. a HALT is appended, so that jumping past the last
+// instruction stops the program. procedures are found by following control
+// flow from the start and from every CALL target, which must be a FUNC
+Chunk lower(lir::Chunk chunk);
+
+// check that a chunk can run without the VM checking its instructions:
+// operands are of the kinds their opcode takes, and registers, offsets and
+// strings are within bounds. functions are only entered through calls and
+// only return from them, and no POP finds the stack empty. throws a
+// runtime_error describing the first problem found
+void verify(const Chunk& chunk);
+
+// instructions of a verified chunk, with the ones reading registers of the
+// current window and immediates replaced by their quickened variants. the
+// main program never opens a window, so its global registers count as being
+// in the current one
+std::vector<Code> quicken(const Chunk& chunk);
+
+const char* opcode_name(Opcode op);
+
 } // namespace bytecode
 
 #endif
@@ -0,0 +1,340 @@
+#include "cfg.hpp"
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "lir.hpp"
+
+namespace cfg {
+
+using lir::Opcode;
+using lir::Operand;
+
+static bool falls_through(Opcode op);
+
+size_t jump_operand(Opcode op) {
+	switch (op) {
+		case Opcode::JMP: return 0;
+		case Opcode::JMP_FALSE:
+		case Opcode::JMP_TRUE: return 1;
+		case Opcode::JMP_EQ:
+		case Opcode::JMP_DIFF:
+		case Opcode::JMP_LESS:
+		case Opcode::JMP_LESS_EQ:
+		case Opcode::JMP_GREATER:
+		case Opcode::JMP_GREATER_EQ:
+		case Opcode::JMP_EQ_I:
+		case Opcode::JMP_DIFF_I:
+		case Opcode::JMP_LESS_I:
+		case Opcode::JMP_LESS_EQ_I:
+		case Opcode::JMP_GREATER_I:
+		case Opcode::JMP_GREATER_EQ_I: return 2;
+		default: return none;
+	}
+}
+
+bool ends_block(Opcode op) {
+	return jump_operand(op) != none or op == Opcode::RET;
+}
+
+bool falls_through(Opcode op) {
+	return op != Opcode::JMP and op != Opcode::RET;
+}
+
+Graph::Graph(lir::Chunk chunk)
+: result_opnd {std::move(chunk.result_opnd)},
+  strings {std::move(chunk.strings)} {
+	auto& vec = chunk.m_vec;
+
+	// instructions starting a block
+	std::vector<bool> leader(vec.size() + 1, false);
+	leader[0] = true;
+	for (const auto& [id, index] : chunk.label_indexes) leader[index] = true;
+	for (size_t i = 0; i < vec.size(); i++)
+		if (ends_block(vec[i].opcode)) leader[i + 1] = true;
+
+	// labels at the end of the chunk get an empty block of their own
+	std::vector<size_t> block_at(vec.size() + 1, none);
+	for (size_t i = 0; i <= vec.size(); i++) {
+		if (not leader[i]) continue;
+		if (i == vec.size() and not blocks.empty()) {
+			bool labeled = false;
+			for (const auto& [id, index] : chunk.label_indexes)
+				labeled = labeled or index == i;
+			if (not labeled) break;
+		}
+		block_at[i] = blocks.size();
+		blocks.push_back({});
+	}
+
+	size_t current = none;
+	for (size_t i = 0; i < vec.size(); i++) {
+		if (block_at[i] != none) current = block_at[i];
+		blocks[current].code.push_back(std::move(vec[i]));
+	}
+	for (const auto& [id, index] : chunk.label_indexes) {
+		label_blocks[id] = block_at[index];
+		blocks[block_at[index]].labels.push_back(id);
+	}
+
+	for (size_t b = 0; b < blocks.size(); b++) {
+		layout.push_back(b);
+		auto& block = blocks[b];
+		if (b + 1 < blocks.size()
+		    and (block.code.empty() or falls_through(block.code.back().opcode)))
+			block.fallthrough = b + 1;
+	}
+
+	entries.push_back(0);
+	for (const auto& block : blocks)
+		for (const auto& inst : block.code)
+			if (inst.opcode == Opcode::CALL
+			    and inst.operands[0].type == Operand::Type::LABEL) {
+				auto it = label_blocks.find(inst.operands[0].as_label().id);
+				if (it != label_blocks.end()) entries.push_back(it->second);
+			}
+	std::sort(entries.begin() + 1, entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+	connect();
+}
+
+std::vector<size_t> Graph::jump_targets(size_t block) const {
+	std::vector<size_t> targets {};
+	const auto& code = blocks[block].code;
+	if (code.empty()) return targets;
+	auto i = jump_operand(code.back().opcode);
+	if (i == none) return targets;
+	auto id = code.back().operands[i].as_label().id;
+	auto it = label_blocks.find(id);
+	if (it == label_blocks.end())
+		throw std::runtime_error(std::format("undefined label L{:03}", id));
+	targets.push_back(it->second);
+	return targets;
+}
+
+void Graph::connect() {
+	for (auto& block : blocks) {
+		block.successors.clear();
+		block.predecessors.clear();
+	}
+	for (size_t b = 0; b < blocks.size(); b++) {
+		auto& succs = blocks[b].successors;
+		succs = jump_targets(b);
+		if (blocks[b].fallthrough != none) succs.push_back(blocks[b].fallthrough);
+		std::sort(succs.begin(), succs.end());
+		succs.erase(std::unique(succs.begin(), succs.end()), succs.end());
+		for (auto s : succs) blocks[s].predecessors.push_back(b);
+	}
+}
+
+size_t Graph::label_of(size_t block) {
+	auto& labels = blocks[block].labels;
+	if (not labels.empty()) return labels.front();
+	size_t id = label_blocks.empty() ? 0 : label_blocks.rbegin()->first + 1;
+	for (const auto& b : blocks)
+		for (const auto& inst : b.code)
+			for (const auto& opnd : inst.operands)
+				if (opnd.type == Operand::Type::LABEL)
+					id = std::max(id, opnd.as_label().id + 1);
+	labels.push_back(id);
+	label_blocks[id] = block;
+	return id;
+}
+
+size_t Graph::add_block() {
+	blocks.push_back({});
+	return blocks.size() - 1;
+}
+
+lir::Chunk linearize(Graph graph) {
+	const auto& layout = graph.layout;
+
+	// labels for the jumps replacing fallthroughs are made first, as their
+	// block may come earlier in the layout
+	std::vector<size_t> jump_to(layout.size(), none);
+	for (size_t i = 0; i < layout.size(); i++) {
+		auto next = graph.blocks[layout[i]].fallthrough;
+		if (next == none or (i + 1 < layout.size() and layout[i + 1] == next))
+			continue;
+		jump_to[i] = graph.label_of(next);
+	}
+
+	lir::Chunk res {};
+	for (size_t i = 0; i < layout.size(); i++) {
+		auto& block = graph.blocks[layout[i]];
+		for (auto id : block.labels) res.label_indexes[id] = res.m_vec.size();
+		for (auto& inst : block.code) res.m_vec.push_back(std::move(inst));
+		if (jump_to[i] != none) res.emit_jmp(Operand(lir::Label {jump_to[i]}));
+	}
+	res.result_opnd = std::move(graph.result_opnd);
+	res.strings = std::move(graph.strings);
+	return res;
+}
+
+std::vector<size_t> reverse_postorder(const Graph& graph) {
+	std::vector<bool> visited(graph.blocks.size(), false);
+	std::vector<size_t> order {};
+	for (auto entry : graph.entries) {
+		if (visited[entry]) continue;
+		std::vector<size_t> postorder {};
+		// block and index of the next successor to visit
+		std::vector<std::pair<size_t, size_t>> stack {{entry, 0}};
+		visited[entry] = true;
+		while (not stack.empty()) {
+			auto& [block, next] = stack.back();
+			const auto& succs = graph.blocks[block].successors;
+			if (next < succs.size()) {
+				auto succ = succs[next++];
+				if (not visited[succ]) {
+					visited[succ] = true;
+					stack.push_back({succ, 0});
+				}
+			} else {
+				postorder.push_back(block);
+				stack.pop_back();
+			}
+		}
+		order.insert(order.end(), postorder.rbegin(), postorder.rend());
+	}
+	return order;
+}
+
+std::vector<bool> shared_registers(const Graph& graph, size_t register_count) {
+	std::vector<size_t> owner(graph.blocks.size(), none);
+	for (auto entry : graph.entries) {
+		std::vector<size_t> work {entry};
+		while (not work.empty()) {
+			auto block = work.back();
+			work.pop_back();
+			if (owner[block] != none) continue;
+			owner[block] = entry;
+			for (auto succ : graph.blocks[block].successors) work.push_back(succ);
+		}
+	}
+
+	std::vector<size_t> user(register_count, none);
+	std::vector<bool> shared(register_count, false);
+	for (size_t b = 0; b < graph.blocks.size(); b++)
+		for (const auto& inst : graph.blocks[b].code)
+			for (const auto& opnd : inst.operands) {
+				if (opnd.type != Operand::Type::REGISTER) continue;
+				auto reg = opnd.as_register().index;
+				if (user[reg] == none) user[reg] = owner[b];
+				if (user[reg] != owner[b]) shared[reg] = true;
+			}
+	return shared;
+}
+
+// iterative algorithm by Cooper, Harvey and Kennedy. procedures are only
+// connected through calls, which aren't edges, so each gets a tree of its own
+Dominators::Dominators(const Graph& graph)
+: idom(graph.blocks.size(), none), children(graph.blocks.size()) {
+	const auto order = reverse_postorder(graph);
+	std::vector<size_t> position(graph.blocks.size(), none);
+	for (size_t i = 0; i < order.size(); i++) position[order[i]] = i;
+	for (auto entry : graph.entries) idom[entry] = entry;
+
+	// none when both blocks are in different trees, which only happens when
+	// code is shared by two procedures
+	auto intersect = [&](size_t a, size_t b) {
+		while (a != b) {
+			while (position[a] > position[b]) {
+				if (idom[a] == a) return none;
+				a = idom[a];
+			}
+			while (position[b] > position[a]) {
+				if (idom[b] == b) return none;
+				b = idom[b];
+			}
+		}
+		return a;
+	};
+
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (auto block : order) {
+			if (idom[block] == block) continue;
+			size_t dom = none;
+			for (auto pred : graph.blocks[block].predecessors) {
+				if (idom[pred] == none) continue;
+				dom = dom == none ? pred : intersect(pred, dom);
+				// such a block is made the root of a tree of its own
+				if (dom == none) {
+					dom = block;
+					break;
+				}
+			}
+			if (dom != idom[block]) {
+				idom[block] = dom;
+				changed = true;
+			}
+		}
+	}
+
+	for (size_t b = 0; b < idom.size(); b++)
+		if (idom[b] != none and idom[b] != b) children[idom[b]].push_back(b);
+}
+
+bool Dominators::dominates(size_t a, size_t b) const {
+	if (idom[a] == none or idom[b] == none) return false;
+	while (b != a and idom[b] != b) b = idom[b];
+	return b == a;
+}
+
+bool Loop::contains(size_t block) const {
+	return std::binary_search(blocks.begin(), blocks.end(), block);
+}
+
+Loops::Loops(const Graph& graph, const Dominators& dominators)
+: innermost(graph.blocks.size(), none) {
+	// a back edge goes to a block dominating its source. the loop is every
+	// block that reaches the source without going through the header
+	std::map<size_t, size_t> by_header {};
+	for (size_t b = 0; b < graph.blocks.size(); b++)
+		for (auto header : graph.blocks[b].successors) {
+			if (not dominators.dominates(header, b)) continue;
+			auto [it, added] = by_header.insert({header, loops.size()});
+			if (added) loops.push_back({header, {header}, {}});
+			auto& loop = loops[it->second];
+			loop.latches.push_back(b);
+
+			std::vector<size_t> work {b};
+			while (not work.empty()) {
+				auto block = work.back();
+				work.pop_back();
+				if (std::find(loop.blocks.begin(), loop.blocks.end(), block)
+				    != loop.blocks.end())
+					continue;
+				loop.blocks.push_back(block);
+				for (auto pred : graph.blocks[block].predecessors)
+					if (dominators.is_reachable(pred)) work.push_back(pred);
+			}
+		}
+	for (auto& loop : loops) std::sort(loop.blocks.begin(), loop.blocks.end());
+
+	// loops are either nested or disjoint, so sorting by size puts inner
+	// loops first, and the parent of a loop is the next one with its header
+	std::sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) {
+		if (a.blocks.size() != b.blocks.size())
+			return a.blocks.size() < b.blocks.size();
+		return a.header < b.header;
+	});
+	for (size_t i = 0; i < loops.size(); i++)
+		for (size_t j = i + 1; j < loops.size(); j++)
+			if (loops[j].contains(loops[i].header)) {
+				loops[i].parent = j;
+				break;
+			}
+	for (size_t i = loops.size(); i-- > 0;)
+		if (loops[i].parent != none)
+			loops[i].depth = loops[loops[i].parent].depth + 1;
+
+	for (size_t i = loops.size(); i-- > 0;)
+		for (auto block : loops[i].blocks) innermost[block] = i;
+}
+
+} // namespace cfg
@@ -0,0 +1,127 @@
+// Control flow graph of LIR chunks, with dominators and loops
+
+#ifndef CFG_HPP
+#define CFG_HPP
+
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "lir.hpp"
+
+namespace cfg {
+
+// marks a missing block, like the fallthrough of a block ending in a jump
+constexpr size_t none = std::numeric_limits<size_t>::max();
+
+// operand holding the label a jump goes to, or none
+size_t jump_operand(lir::Opcode op);
+
+// jumps and returns, after which a new block starts
+bool ends_block(lir::Opcode op);
+
+// straight-line code, only entered at its start and only left at its end.
+// calls don't end a block, as they return to the following instruction
+struct Block {
+	// ids of the labels marking the start of the block
+	std::vector<size_t> labels {};
+	std::vector<lir::Instruction> code {};
+
+	// block control continues at when the last instruction doesn't jump
+	// away. it's kept apart from the layout, so that linearizing adds a jump
+	// when the block doesn't end up right before it
+	size_t fallthrough {none};
+
+	std::vector<size_t> successors {};
+	std::vector<size_t> predecessors {};
+};
+
+// blocks are never removed or reordered in the vector, so their indices can
+// be kept around. the order they are emitted in is the layout instead
+struct Graph {
+	// split a complete chunk into blocks. labels that are referenced but
+	// missing from the chunk are an error
+	explicit Graph(lir::Chunk chunk);
+
+	std::vector<Block> blocks {};
+	std::vector<size_t> layout {};
+
+	// first block of every procedure: the main program and each call target
+	std::vector<size_t> entries {};
+
+	// block marked by each label
+	std::map<size_t, size_t> label_blocks {};
+
+	std::optional<lir::Operand> result_opnd {};
+	std::vector<std::string> strings {};
+
+	// recompute successors and predecessors from the jumps and fallthroughs.
+	// must be called after changing them
+	void connect();
+
+	// a label marking the block, added if there's none yet
+	size_t label_of(size_t block);
+
+	// empty block, not in the layout yet
+	size_t add_block();
+
+	// block each jump of the block goes to, in operand order
+	std::vector<size_t> jump_targets(size_t block) const;
+};
+
+// chunk with the blocks in layout order. blocks left out of the layout are
+// dropped, and jumps are added where a fallthrough doesn't follow its block
+lir::Chunk linearize(Graph graph);
+
+// blocks reachable from each entry, in reverse postorder, one procedure after
+// the other
+std::vector<size_t> reverse_postorder(const Graph& graph);
+
+// registers referenced by blocks of more than one procedure, which calls may
+// write to
+std::vector<bool> shared_registers(const Graph& graph, size_t register_count);
+
+struct Dominators {
+	explicit Dominators(const Graph& graph);
+
+	// whether every path from the entry of its procedure to b goes through
+	// a. blocks dominate themselves, and unreachable ones dominate nothing
+	bool dominates(size_t a, size_t b) const;
+
+	bool is_reachable(size_t block) const { return idom[block] != none; }
+
+	// immediate dominator of every block. entries are their own, and
+	// unreachable blocks have none
+	std::vector<size_t> idom {};
+	std::vector<std::vector<size_t>> children {};
+};
+
+// natural loop, with every back edge to the same header merged into it
+struct Loop {
+	size_t header;
+	std::vector<size_t> blocks; // sorted, including the header
+	std::vector<size_t> latches;
+
+	// innermost loop containing this one, or none
+	size_t parent {none};
+	size_t depth {1};
+
+	bool contains(size_t block) const;
+};
+
+struct Loops {
+	Loops(const Graph& graph, const Dominators& dominators);
+
+	// inner loops come before the loops containing them
+	std::vector<Loop> loops {};
+
+	// innermost loop of every block, or none
+	std::vector<size_t> innermost {};
+};
+
+} // namespace cfg
+
+#endif
@@ -8,6 +8,8 @@
 
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <utility>
 #include <vector>
 
 #include "ast.hpp"
@@ -23,12 +25,31 @@ using lir::Register;
 using std::vector;
 
 static void err(const char* msg);
+static std::optional<Operand> fold(
+	Opcode op, const Operand& left, const Operand& right = {}
+);
 
 void err(const char* msg) {
 	std::cout << "COMPILER_ERR: " << msg << std::endl;
 	exit(1);
 }
 
+// result of the operation when every operand is an immediate and it can be
+// computed at compile time
+std::optional<Operand> fold(
+	Opcode op, const Operand& left, const Operand& right
+) {
+	if (left.type != Operand::Type::IMMEDIATE) return {};
+	int right_number = 0;
+	if (right.type == Operand::Type::IMMEDIATE)
+		right_number = right.as_immediate().number;
+	else if (right.type != Operand::Type::NOTHING)
+		return {};
+	auto value = lir::fold(op, left.as_immediate().number, right_number);
+	if (not value.has_value()) return {};
+	return Operand::make_immediate_integer(value.value());
+}
+
 namespace builtin {
 static Result read_int(Compiler& comp, vector<Operand> args);
 static Result read_char(Compiler& comp, vector<Operand> args);
@@ -58,7 +79,7 @@ Result write_int(Compiler& comp, vector<Operand> args) {
 	auto t1 = comp.make_register();
 	chunk.emit_loada(t1, Operand::make_immediate_integer(0), args[0]);
 	chunk.emit(Opcode::PRINTV, t1);
-	return {chunk, {}};
+	return {std::move(chunk), {}};
 }
 
 Result write_char(Compiler& comp, vector<Operand> args) {
@@ -69,7 +90,7 @@ Result write_char(Compiler& comp, vector<Operand> args) {
 	auto t1 = comp.make_register();
 	chunk.emit_loada(t1, Operand::make_immediate_integer(0), op);
 	chunk.emit(Opcode::PRINTC, t1);
-	return {chunk, {}};
+	return {std::move(chunk), {}};
 }
 
 Result write_str(Compiler&, vector<Operand> args) {
@@ -78,21 +99,21 @@ Result write_str(Compiler&, vector<Operand> args) {
 	Chunk chunk {};
 	auto& op = args[0];
 	chunk.emit(Opcode::PRINTF, op);
-	return {chunk, {}};
+	return {std::move(chunk), {}};
 }
 
 Result read_int(Compiler& comp, vector<Operand>) {
 	Chunk chunk {};
 	Operand tmp = comp.make_register();
 	chunk.emit(Opcode::READV, tmp);
-	return {chunk, tmp};
+	return {std::move(chunk), tmp};
 }
 
 Result read_char(Compiler& comp, vector<Operand>) {
 	Chunk chunk {};
 	Operand tmp = comp.make_register();
 	chunk.emit(Opcode::READC, tmp);
-	return {chunk, tmp};
+	return {std::move(chunk), tmp};
 }
 
 Result make_array(Compiler& comp, vector<Operand> args) {
@@ -107,7 +128,7 @@ Result make_array(Compiler& comp, vector<Operand> args) {
 	auto t1 = comp.make_register();
 	chunk.emit_loada(t1, Operand::make_immediate_integer(0), args[0]);
 	chunk.emit_alloca(addr, t1).with_comment("allocating array");
-	return {chunk, addr};
+	return {std::move(chunk), addr};
 }
 
 } // namespace builtin
@@ -129,7 +150,7 @@ Chunk Compiler::compile() {
 	auto scope_id = env.root_scope_id;
 
 	auto res_ = compile(ast.root_index, handlers, scope_id);
-	chunk = chunk + res_.code;
+	chunk.append(std::move(res_.code));
 
 	auto start = Operand::make_immediate_integer(dyn_alloc_start);
 	preamble.m_vec[0].operands[1] =
@@ -137,12 +158,13 @@ Chunk Compiler::compile() {
 
 	preamble.emit(Opcode::JMP, main);
 
-	Chunk all_functions {};
-	for (const auto& f : functions) {
-		all_functions = all_functions + f;
-	}
+	inlined = inline_calls(chunk);
 
-	Chunk res = preamble + all_functions + chunk;
+	Chunk res = std::move(preamble);
+	for (auto& f : functions) res.append(std::move(f));
+	functions.clear();
+	res.append(std::move(chunk));
+	res.strings = strings;
 
 	return res;
 }
@@ -155,6 +177,17 @@ Operand Compiler::make_label() {
 	return lir::Operand(lir::Label(label_count++));
 }
 
+bool Compiler::is_integer(NodeIndex node_idx) const {
+	auto it = tpc.node_to_type.find(node_idx);
+	if (it == tpc.node_to_type.end()) return false;
+	auto datatype = it->second->datatype;
+	while (auto var = std::dynamic_pointer_cast<TypeVariable>(datatype)) {
+		if (not var->is_bound) return false;
+		datatype = var->bound_type;
+	}
+	return std::dynamic_pointer_cast<Integer>(datatype) != nullptr;
+}
+
 Result Compiler::compile_or_allocate_lvalue(
 	NodeIndex node_idx, SignalHandlers handlers, Env<Operand>::ScopeID scope_id
 ) {
@@ -173,12 +206,12 @@ Result Compiler::compile_or_allocate_lvalue(
 		} else {
 			Chunk chunk {};
 			auto res = compile(node_idx, handlers, scope_id);
-			chunk = chunk + res.code;
+			chunk.append(std::move(res.code));
 			auto res_opnd = res.opnd;
 			auto t1 = make_register();
 			chunk.emit_alloca(t1, Operand::make_immediate_integer(1));
 			chunk.emit_storea(res_opnd, Operand::make_immediate_integer(0), t1);
-			return {chunk, t1};
+			return {std::move(chunk), t1};
 		}
 	}
 }
@@ -194,21 +227,30 @@ Result Compiler::compile_app(
 
 	vector<Operand> args {};
 
+	const char* func_name = pool.find(func_node.str_id);
+	bool is_builtin = false;
+	for (const auto& builtin : builtin::builtins)
+		if (strcmp(func_name, builtin.name) == 0) is_builtin = true;
+
 	for (size_t i = 0; i < args_node.branch.children_count; i++) {
 		auto arg_idx = args_node[i];
+		// builtins only read their arguments, so a literal isn't copied
+		if (is_builtin and ast.at(arg_idx).type == NodeType::STR) {
+			args.push_back(string_constant(arg_idx));
+			continue;
+		}
 		auto res = compile_or_allocate_lvalue(arg_idx, handlers, scope_id);
-		chunk = chunk + res.code;
+		chunk.append(std::move(res.code));
 		args.push_back(res.opnd);
 	}
 
-	const char* func_name = pool.find(func_node.str_id);
-
 	// try to match function name with any builtin. otherwise, call it as a
 	// user-defined function
 	for (const auto& builtin : builtin::builtins)
 		if (strcmp(func_name, builtin.name) == 0) {
 			auto result = builtin.ptr(*this, args);
-			return {chunk + result.code, result.opnd};
+			chunk.append(std::move(result.code));
+			return {std::move(chunk), result.opnd};
 		};
 
 	Operand* func_opnd = env.find(scope_id, func_node.str_id);
@@ -222,10 +264,10 @@ Result Compiler::compile_app(
 
 	chunk.emit(Opcode::CALL, *func_opnd);
 	Operand res = make_register();
-	chunk.emit(Opcode::POP, res);
+	chunk.emit(Opcode::POP, res).with_integer(is_integer(node_idx));
 	chunk.result_opnd = res;
 
-	return {chunk, res};
+	return {std::move(chunk), res};
 }
 
 Result Compiler::compile_if(
@@ -243,13 +285,13 @@ Result Compiler::compile_if(
 	Operand res = make_register();
 
 	auto cond_res = compile(cond_idx, handlers, scope_id);
-	chunk = chunk + cond_res.code;
+	chunk.append(std::move(cond_res.code));
 	Operand cond_opnd = cond_res.opnd;
 
 	chunk.emit(Opcode::JMP_FALSE, cond_opnd, l1).with_comment("if branch");
 
 	auto yes_res = compile(then_idx, handlers, scope_id);
-	chunk = chunk + yes_res.code;
+	chunk.append(std::move(yes_res.code));
 	Operand yes_opnd = yes_res.opnd;
 
 	chunk.emit(Opcode::MOV, res, yes_opnd);
@@ -257,13 +299,13 @@ Result Compiler::compile_if(
 	chunk.add_label(l1);
 
 	auto no_res = compile(else_idx, handlers, scope_id);
-	chunk = chunk + no_res.code;
+	chunk.append(std::move(no_res.code));
 	Operand no_opnd = no_res.opnd;
 
 	chunk.emit(Opcode::MOV, res, no_opnd);
 	chunk.add_label(l2);
 
-	return {chunk, res};
+	return {std::move(chunk), res};
 }
 
 Result Compiler::compile_for(
@@ -298,7 +340,7 @@ Result Compiler::compile_for(
 	Operand step = [&]() {
 		if (step_node.type != NodeType::EMPTY) {
 			auto step_res = compile(step_idx, handlers, scope_id);
-			chunk = chunk + step_res.code;
+			chunk.append(std::move(step_res.code));
 			return step_res.opnd;
 		} else {
 			return Operand::make_immediate_integer(1);
@@ -308,23 +350,23 @@ Result Compiler::compile_for(
 	auto new_scope_id = env.create_child_scope(scope_id);
 
 	auto var_res = compile(decl_idx, handlers, new_scope_id);
-	chunk = chunk + var_res.code;
+	chunk.append(std::move(var_res.code));
 	Operand var = var_res.opnd;
 
 	auto to_res = compile(to_idx, handlers, new_scope_id);
-	chunk = chunk + to_res.code;
+	chunk.append(std::move(to_res.code));
 	Operand to = to_res.opnd;
 
 	const auto t1 = make_register();
 	const auto t2 = make_register();
 
 	chunk.add_label(beg);
-	chunk.emit_loada(t1, Operand::make_immediate_integer(0), var);
+	chunk.emit_loada(t1, Operand::make_immediate_integer(0), var).with_integer();
 	chunk.emit(Opcode::EQ, cmp, t1, to);
 	chunk.emit(Opcode::JMP_TRUE, cmp, end);
 
 	auto exp_res = compile(then_idx, new_handlers, new_scope_id);
-	chunk = chunk + exp_res.code;
+	chunk.append(std::move(exp_res.code));
 	Operand exp = exp_res.opnd;
 
 	chunk.emit(Opcode::MOV, result_register, exp);
@@ -335,7 +377,7 @@ Result Compiler::compile_for(
 	chunk.emit(Opcode::JMP, beg);
 	chunk.add_label(end);
 
-	return {chunk, result_register};
+	return {std::move(chunk), result_register};
 }
 
 Result Compiler::compile_when(
@@ -351,20 +393,20 @@ Result Compiler::compile_when(
 	Operand res = make_register();
 
 	auto cond_res = compile(cond_idx, handlers, scope_id);
-	chunk = chunk + cond_res.code;
+	chunk.append(std::move(cond_res.code));
 	Operand cond_opnd = cond_res.opnd;
 
 	chunk.emit(Opcode::MOV, res, {}).with_comment("when conditional");
 	chunk.emit(Opcode::JMP_FALSE, cond_opnd, l1);
 
 	auto yes_res = compile(then_idx, handlers, scope_id);
-	chunk = chunk + yes_res.code;
+	chunk.append(std::move(yes_res.code));
 	Operand yes_opnd = yes_res.opnd;
 
 	chunk.emit(Opcode::MOV, res, yes_opnd);
 	chunk.add_label(l1);
 
-	return {chunk, res};
+	return {std::move(chunk), res};
 }
 
 Result Compiler::compile_while(
@@ -390,13 +432,13 @@ Result Compiler::compile_while(
 	chunk.add_label(beg);
 
 	auto cond_res = compile(node[0], handlers, scope_id);
-	chunk = chunk + cond_res.code;
+	chunk.append(std::move(cond_res.code));
 	Operand cond = cond_res.opnd;
 
 	chunk.emit(Opcode::JMP_FALSE, cond, end);
 
 	auto exp_res = compile(node[1], new_handlers, scope_id);
-	chunk = chunk + exp_res.code;
+	chunk.append(std::move(exp_res.code));
 	Operand exp = exp_res.opnd;
 
 	chunk.emit(Opcode::MOV, result_register, exp);
@@ -404,7 +446,7 @@ Result Compiler::compile_while(
 	chunk.emit(Opcode::JMP, beg);
 	chunk.add_label(end);
 
-	return {chunk, result_register};
+	return {std::move(chunk), result_register};
 }
 
 Result Compiler::compile_lvalue(
@@ -434,17 +476,17 @@ Result Compiler::compile_lvalue(
 			Chunk chunk {};
 			const auto& node = ast.at(node_idx);
 			auto base_res = compile_lvalue(node[0], handlers, scope_id);
-			chunk = chunk + base_res.code;
+			chunk.append(std::move(base_res.code));
 			auto base = base_res.opnd;
 			auto off_res = compile(node[1], handlers, scope_id);
-			chunk = chunk + off_res.code;
+			chunk.append(std::move(off_res.code));
 			auto off = off_res.opnd;
 
 			auto tmp = make_register();
 			auto t1 = make_register();
 			chunk.emit_shifta(tmp, off, base)
 				.with_comment("accessing allocated array");
-			return {chunk, tmp};
+			return {std::move(chunk), tmp};
 		}
 		case NodeType::ADD: assert(false);
 		case NodeType::SUB: assert(false);
@@ -460,7 +502,7 @@ Result Compiler::compile_lvalue(
 				err("Variable not found");
 			}
 			chunk.result_opnd = *opnd;
-			return {chunk, *opnd};
+			return {std::move(chunk), *opnd};
 		}
 		case NodeType::STR: assert(false);
 		case NodeType::VAR_DECL: assert(false);
@@ -507,15 +549,15 @@ Result Compiler::compile_var_decl(
 
 	if (exp_node.type == NodeType::PATH) {
 		auto initial_res = compile_lvalue(exp_idx, handlers, scope_id);
-		chunk = chunk + initial_res.code;
+		chunk.append(std::move(initial_res.code));
 		auto initial = initial_res.opnd;
 		// FIXME: properly set register type
 		auto* var = env.insert(scope_id, id_node.str_id, make_register());
 		chunk.emit_clonea(*var, initial).with_comment(comment);
-		return {chunk, *var};
+		return {std::move(chunk), *var};
 	} else {
 		auto initial_res = compile(exp_idx, handlers, scope_id);
-		chunk = chunk + initial_res.code;
+		chunk.append(std::move(initial_res.code));
 		auto initial = initial_res.opnd;
 		// FIXME: properly set register type
 		auto* var = env.insert(scope_id, id_node.str_id, make_register());
@@ -526,7 +568,7 @@ Result Compiler::compile_var_decl(
 				.with_comment(comment);
 			chunk.emit_storea(initial, Operand::make_immediate_integer(0), *var);
 		}
-		return {chunk, *var};
+		return {std::move(chunk), *var};
 	}
 }
 
@@ -546,12 +588,15 @@ Result Compiler::compile_fun_decl(
 
 	(void)opt_type_idx;
 
-	Operand* opnd = env.insert(scope_id, id_node.str_id, make_register());
-
+	// inserted before compiling the body, so that it can call itself
 	auto func_name = make_label();
-	*opnd = func_name;
+	env.insert(scope_id, id_node.str_id, func_name);
 	auto new_scope_id = env.create_child_scope(scope_id);
 
+	// calling convention: the caller pushes the arguments in reverse and CALLs,
+	// which saves its frame. FUNC opens a fresh register window, so registers
+	// used only here are private to each call. the result is pushed before
+	// RET restores the caller's frame, which then pops it
 	Chunk func {};
 
 	func.add_label(func_name);
@@ -564,16 +609,21 @@ Result Compiler::compile_fun_decl(
 		env.insert(new_scope_id, param_node.str_id, arg);
 	}
 
-	auto op_res = compile(body_idx, handlers, new_scope_id);
-	func = func + op_res.code;
+	// loops of the caller can't be broken out of from another frame
+	(void)handlers;
+	auto op_res = compile(body_idx, SignalHandlers {}, new_scope_id);
+	func.append(std::move(op_res.code));
 	auto op = op_res.opnd;
 
 	func.emit(Opcode::PUSH, op);
 	func.emit(Opcode::RET);
 
-	functions.push_back(func);
+	// recursion in tail position loops in the same frame
+	tail_calls += eliminate_tail_calls(func);
 
-	return {chunk, func_name};
+	functions.push_back(std::move(func));
+
+	return {std::move(chunk), func_name};
 }
 
 Result Compiler::compile_ass(
@@ -583,17 +633,17 @@ Result Compiler::compile_ass(
 	const auto& node = ast.at(node_idx);
 
 	auto cell_res = compile_lvalue(node[0], handlers, scope_id);
-	chunk = chunk + cell_res.code;
+	chunk.append(std::move(cell_res.code));
 	Operand cell = cell_res.opnd;
 
 	auto exp_res = compile(node[1], handlers, scope_id);
-	chunk = chunk + exp_res.code;
+	chunk.append(std::move(exp_res.code));
 	Operand exp = exp_res.opnd;
 
 	chunk.emit_storea(exp, Operand::make_immediate_integer(0), cell)
 		.with_comment("assigning to array variable");
 
-	return {chunk, exp};
+	return {std::move(chunk), exp};
 }
 
 Result Compiler::compile_let(
@@ -611,40 +661,36 @@ Result Compiler::compile_let(
 		auto new_scope_id = env.create_child_scope(scope_id);
 		for (size_t i = 0; i < decls_node.branch.children_count; i++) {
 			auto res = compile(decls_node[i], handlers, new_scope_id);
-			chunk = chunk + res.code;
+			chunk.append(std::move(res.code));
 		}
 		auto res_res = compile(exp_idx, handlers, new_scope_id);
-		chunk = chunk + res_res.code;
+		chunk.append(std::move(res_res.code));
 		Operand res = res_res.opnd;
-		return {chunk, res};
+		return {std::move(chunk), res};
 	}
 }
 
+Operand Compiler::string_constant(NodeIndex node_idx) {
+	// strings live in the read-only segment of the chunk, so a literal is
+	// just a pointer to its characters. equal literals share their storage
+	std::string str = pool.find(ast.at(node_idx).str_id);
+	auto [it, inserted] = string_ids.try_emplace(str, strings.size());
+	if (inserted) strings.push_back(str);
+	return Operand(lir::String {it->second});
+}
+
 Result Compiler::compile_str(
 	NodeIndex node_idx, SignalHandlers, Env<Operand>::ScopeID
 ) {
 	Chunk chunk {};
-	const auto& node = ast.at(node_idx);
 
-	// allocates a static buffer for the string characters, ending in a
-	// sentinel null character and returns a pointer to the start
-
-	const char* str = pool.find(node.str_id);
-	auto str_len = strlen(str);
-	dyn_alloc_start -= (Number)str_len + 1;
-
-	auto t1 = make_register();
-	chunk.emit_alloca(t1, Operand::make_immediate_integer((int)str_len));
-	for (size_t i = 0; i < str_len; i++) {
-		chunk.emit_storea(
-			Operand::make_immediate_integer(str[i]),
-			Operand::make_immediate_integer((int)i),
-			t1
-		);
-	}
-
-	chunk.result_opnd = t1;
-	return {chunk, t1};
+	// every evaluation of a literal is a new array that may be written to, as
+	// it may reach a variable or a function through any expression
+	auto copy = make_register();
+	chunk.emit_clonea(copy, string_constant(node_idx))
+		.with_comment("copying string");
+	chunk.result_opnd = copy;
+	return {std::move(chunk), copy};
 }
 
 Result Compiler::compile_at(
@@ -656,10 +702,10 @@ Result Compiler::compile_at(
 	// evaluates to a temporary register containing the address of the lvalue
 
 	auto base_res = compile(node[0], handlers, scope_id);
-	chunk = chunk + base_res.code;
+	chunk.append(std::move(base_res.code));
 	Operand base = base_res.opnd;
 	auto off_res = compile(node[1], handlers, scope_id);
-	chunk = chunk + off_res.code;
+	chunk.append(std::move(off_res.code));
 	Operand off = off_res.opnd;
 
 	auto is_array = false;
@@ -675,7 +721,7 @@ Result Compiler::compile_at(
 	chunk.emit(Opcode::ADD, tmp, base, off)
 		.with_comment("accessing allocated array");
 
-	return {chunk, Operand(tmp)};
+	return {std::move(chunk), Operand(tmp)};
 }
 
 // FIXME: Temporary workaround
@@ -683,6 +729,16 @@ Result Compiler::compile_at(
 
 Result Compiler::compile(
 	NodeIndex node_idx, SignalHandlers handlers, Env<Operand>::ScopeID scope_id
+) {
+	auto result = compile_node(node_idx, handlers, scope_id);
+	const auto& loc = ast.at(node_idx).loc;
+	for (auto& inst : result.code.m_vec)
+		if (not inst.location.has_value()) inst.location = loc;
+	return result;
+}
+
+Result Compiler::compile_node(
+	NodeIndex node_idx, SignalHandlers handlers, Env<Operand>::ScopeID scope_id
 ) {
 	const auto& node = ast.at(node_idx);
 	switch (node.type) {
@@ -691,7 +747,7 @@ Result Compiler::compile(
 			Chunk chunk {};
 			auto opnd = Operand::make_immediate_integer(node.num);
 			chunk.result_opnd = opnd;
-			return {chunk, opnd};
+			return {std::move(chunk), opnd};
 		}
 		case NodeType::BLK: {
 			Chunk chunk {};
@@ -699,11 +755,11 @@ Result Compiler::compile(
 			Operand opnd;
 			for (size_t i = 0; i < node.branch.children_count; i++) {
 				auto opnd_res = compile(node[i], handlers, new_scope_id);
-				chunk = chunk + opnd_res.code;
+				chunk.append(std::move(opnd_res.code));
 				opnd = opnd_res.opnd;
 			}
 
-			return {chunk, opnd};
+			return {std::move(chunk), opnd};
 		}
 		case NodeType::IF: COMPILE_WITH_HANDLER(compile_if)
 		case NodeType::WHEN: COMPILE_WITH_HANDLER(compile_when)
@@ -716,7 +772,7 @@ Result Compiler::compile(
 				err("`break' requires a expression to evaluate the loop to");
 
 			auto res_res = compile(node[0], handlers, scope_id);
-			chunk = chunk + res_res.code;
+			chunk.append(std::move(res_res.code));
 			Operand res = res_res.opnd;
 			chunk.emit(Opcode::MOV, handlers.break_handler.result_register, res);
 			chunk
@@ -724,7 +780,7 @@ Result Compiler::compile(
 					Opcode::JMP, lir::Operand(handlers.break_handler.destination_label)
 				)
 				.with_comment("break out of loop");
-			return {chunk, {}};
+			return {std::move(chunk), {}};
 		}
 		case NodeType::CONTINUE: {
 			Chunk chunk {};
@@ -734,7 +790,7 @@ Result Compiler::compile(
 				err("continue requires a expression to evaluate the loop to");
 
 			auto res_res = compile(node[0], handlers, scope_id);
-			chunk = chunk + res_res.code;
+			chunk.append(std::move(res_res.code));
 			Operand res = res_res.opnd;
 			chunk.emit(Opcode::MOV, handlers.continue_handler.result_register, res);
 			chunk
@@ -742,7 +798,7 @@ Result Compiler::compile(
 					Opcode::JMP, lir::Operand(handlers.continue_handler.destination_label)
 				)
 				.with_comment("continue to next iteration of loop");
-			return {chunk, {}};
+			return {std::move(chunk), {}};
 		}
 		case NodeType::ASS: COMPILE_WITH_HANDLER(compile_ass)
 
@@ -753,16 +809,20 @@ Result Compiler::compile(
 		auto right_node = node[1];                                \
                                                               \
 		auto left_res = compile(left_node, handlers, scope_id);   \
-		chunk = chunk + left_res.code;                            \
+		chunk.append(std::move(left_res.code));                   \
 		auto right_res = compile(right_node, handlers, scope_id); \
-		chunk = chunk + right_res.code;                           \
+		chunk.append(std::move(right_res.code));                  \
 		Operand left = left_res.opnd;                             \
 		Operand right = right_res.opnd;                           \
+		if (auto folded = fold(OPCODE, left, right)) {            \
+			chunk.result_opnd = folded.value();                     \
+			return {std::move(chunk), folded.value()};              \
+		}                                                         \
 		Operand res = make_register();                            \
                                                               \
 		chunk.emit(OPCODE, res, left, right);                     \
 		chunk.result_opnd = res;                                  \
-		return {chunk, res};                                      \
+		return {std::move(chunk), res};                           \
 	}
 
 		case NodeType::OR: BINARY_ARITH(Opcode::OR);
@@ -779,30 +839,36 @@ Result Compiler::compile(
 		case NodeType::MOD: BINARY_ARITH(Opcode::MOD);
 		case NodeType::NOT: {
 			Chunk chunk {};
-			Operand res = make_register();
 			auto inverse_res = compile(node[0], handlers, scope_id);
-			chunk = chunk + inverse_res.code;
+			chunk.append(std::move(inverse_res.code));
 			Operand inverse = inverse_res.opnd;
+			if (auto folded = fold(Opcode::NOT, inverse)) {
+				chunk.result_opnd = folded.value();
+				return {std::move(chunk), folded.value()};
+			}
+			Operand res = make_register();
 			chunk.emit(Opcode::NOT, res, inverse);
-			return {chunk, res};
+			return {std::move(chunk), res};
 		}
 		case NodeType::AT: {
 			Chunk chunk {};
 			auto res = compile_lvalue(node_idx, handlers, scope_id);
-			chunk = chunk + res.code;
+			chunk.append(std::move(res.code));
 			auto res_opnd = res.opnd;
 			auto tmp = make_register();
-			chunk.emit_loada(tmp, Operand::make_immediate_integer(0), res_opnd);
-			return {chunk, tmp};
+			chunk.emit_loada(tmp, Operand::make_immediate_integer(0), res_opnd)
+				.with_integer(is_integer(node_idx));
+			return {std::move(chunk), tmp};
 		}
 		case NodeType::ID: {
 			Chunk chunk {};
 			auto res = compile_lvalue(node_idx, handlers, scope_id);
-			chunk = chunk + res.code;
+			chunk.append(std::move(res.code));
 			auto res_opnd = res.opnd;
 			auto tmp = make_register();
-			chunk.emit_loada(tmp, Operand::make_immediate_integer(0), res_opnd);
-			return {chunk, tmp};
+			chunk.emit_loada(tmp, Operand::make_immediate_integer(0), res_opnd)
+				.with_integer(is_integer(node_idx));
+			return {std::move(chunk), tmp};
 		}
 		case NodeType::STR: COMPILE_WITH_HANDLER(compile_str)
 		case NodeType::VAR_DECL: COMPILE_WITH_HANDLER(compile_var_decl)
@@ -816,17 +882,18 @@ Result Compiler::compile(
 			Chunk chunk {};
 			auto opnd = lir::Operand::make_immediate_integer(node.character);
 			chunk.result_opnd = opnd;
-			return {chunk, opnd};
+			return {std::move(chunk), opnd};
 		}
 		case NodeType::PATH: {
 			Chunk chunk {};
 			auto res = compile_lvalue(node_idx, handlers, scope_id);
-			chunk = chunk + res.code;
+			chunk.append(std::move(res.code));
 			auto res_opnd = res.opnd;
 			auto tmp = make_register();
-			chunk.emit_loada(tmp, Operand::make_immediate_integer(0), res_opnd);
+			chunk.emit_loada(tmp, Operand::make_immediate_integer(0), res_opnd)
+				.with_integer(is_integer(node_idx));
 			chunk.result_opnd = tmp;
-			return {chunk, tmp};
+			return {std::move(chunk), tmp};
 		}
 		case NodeType::INSTANCE:
 			assert(false && "used only in typechecking. should not be evaluated");
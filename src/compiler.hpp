@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <stdio.h>
 
+#include <map>
 #include <stack>
 #include <string>
 #include <vector>
@@ -58,8 +59,13 @@ struct Compiler {
 
 	Chunk compile();
 
+	// compiles a node, attaching its location to the instructions that none
+	// of its children were compiled into
 	Result compile(
-		NodeIndex node_idxz, SignalHandlers handlers, Env<Operand>::ScopeID scope_id
+		NodeIndex node_idx, SignalHandlers handlers, Env<Operand>::ScopeID scope_id
+	);
+	Result compile_node(
+		NodeIndex node_idx, SignalHandlers handlers, Env<Operand>::ScopeID scope_id
 	);
 	Result compile_lvalue(
 		NodeIndex node_idx, SignalHandlers handlers, Env<Operand>::ScopeID scope_id
@@ -79,13 +85,34 @@ struct Compiler {
 	Operand make_register();
 	Operand make_label();
 
+	// whether the typechecker found the expression to be an integer, which
+	// booleans and characters are as well
+	bool is_integer(NodeIndex node_idx) const;
+
 	// used to backpatch the location of the dynamic allocation region start
 	Number dyn_alloc_start {2047};
 
+	// string constants, each stored once however many times it appears
+	vector<string> strings;
+	std::map<string, size_t> string_ids;
+	// the read-only constant of a string literal, for what only reads it
+	Operand string_constant(NodeIndex node_idx);
+
 	Env<Operand> env;
 
 	vector<Chunk> functions;
 
+	// replace calls to small functions, and to functions called only once,
+	// with their body, in the main chunk and in every function. returns the
+	// amount of calls replaced
+	size_t inline_calls(Chunk& main);
+	size_t inlined {0};
+
+	// replace the calls a function makes to itself in tail position with a
+	// jump back to its body. returns the amount of calls replaced
+	size_t eliminate_tail_calls(Chunk& func);
+	size_t tail_calls {0};
+
 #define DECLARE_NODE_HANDLER(NAME) \
 	Result compile_##NAME(           \
 		NodeIndex node_idx,            \
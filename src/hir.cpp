@@ -1,8 +1,10 @@
 #include "hir.hpp"
 
 #include <cassert>
+#include <iterator>
 #include <ranges>
 #include <stdexcept>
+#include <utility>
 #include <variant>
 
 #include "str_pool.h"
@@ -17,13 +19,23 @@ static void print_instruction(
 	FILE* fd, const Instruction& inst, const StringPool& pool, int spaces
 );
 
-Code operator+(Code pre, Code post) {
-	Code res {};
-
-	for (auto inst : pre.instructions) res.instructions.push_back(inst);
-	for (auto inst : post.instructions) res.instructions.push_back(inst);
+Code& Code::append(Code&& other) {
+	if (instructions.empty()) {
+		instructions = std::move(other.instructions);
+	} else {
+		instructions.insert(
+			instructions.end(),
+			std::make_move_iterator(other.instructions.begin()),
+			std::make_move_iterator(other.instructions.end())
+		);
+	}
+	other.instructions.clear();
+	return *this;
+}
 
-	return res;
+Code operator+(Code pre, Code post) {
+	pre.append(std::move(post));
+	return pre;
 }
 
 void Code::call(
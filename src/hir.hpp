@@ -144,6 +144,9 @@ class Code {
  public:
 	std::vector<Instruction> instructions;
 
+	// move the instructions of other to the end of this code
+	Code& append(Code&& other);
+
 	void copy(hir::Register, hir::Operand);
 	void call(hir::Register, hir::Register, std::vector<hir::Operand>);
 	void if_false(hir::Register, hir::Block);
@@ -186,6 +189,7 @@ struct Module {
 	hir::Label register_constant(hir::Label name, const Constant& constant);
 };
 
+// concatenation of both codes. use Code::append to avoid copying them
 Code operator+(Code pre, Code post);
 
 void print_code(FILE* fd, const Code& code, const StringPool& pool, int spaces);
@@ -4,6 +4,7 @@
 #include <cstdio>
 #include <cstring>
 #include <memory>
+#include <utility>
 
 #include "hir.hpp"
 
@@ -27,7 +28,7 @@ hir::Module Compiler::compile() {
 	};
 	auto result = compile(node_idx, ctx);
 	hir::Block entry_block {
-		.body_code = std::make_shared<hir::Code>(result.code),
+		.body_code = std::make_shared<hir::Code>(std::move(result.code)),
 		.child_blocks = {},
 	};
 	auto entry = make_label();
@@ -76,7 +77,7 @@ Result Compiler::compile_app(NodeIndex node_idx, Context ctx) {
 
 	if (!builtin_function_found) {
 		auto func_result = compile(node[0], ctx);
-		code = code + func_result.code;
+		code.append(std::move(func_result.code));
 		function = func_result.result_register;
 	}
 
@@ -92,13 +93,13 @@ Result Compiler::compile_app(NodeIndex node_idx, Context ctx) {
 	for (size_t i = 0; i < args_node.branch.children_count; i++) {
 		auto arg_idx = args_node[i];
 		auto arg_result = compile(arg_idx, ctx);
-		code = code + arg_result.code;
+		code.append(std::move(arg_result.code));
 		args.push_back(arg_result.result_register);
 	}
 
 	code.call(result_register, function, args);
 
-	return Result {code, result_register};
+	return Result {std::move(code), result_register};
 }
 
 Result Compiler::compile_if(NodeIndex node_idx, Context ctx) {
@@ -112,7 +113,7 @@ Result Compiler::compile_if(NodeIndex node_idx, Context ctx) {
 	auto result_register = make_register();
 
 	auto cond_res = compile(cond_idx, ctx);
-	code = code + cond_res.code;
+	code.append(std::move(cond_res.code));
 	auto cond_opnd = cond_res.result_register;
 
 	auto then_res = compile(then_idx, ctx);
@@ -121,8 +122,8 @@ Result Compiler::compile_if(NodeIndex node_idx, Context ctx) {
 	auto else_res = compile(else_idx, ctx);
 	else_res.code.copy(result_register, else_res.result_register);
 
-	auto if_true_code = std::make_shared<hir::Code>(then_res.code);
-	auto if_false_code = std::make_shared<hir::Code>(else_res.code);
+	auto if_true_code = std::make_shared<hir::Code>(std::move(then_res.code));
+	auto if_false_code = std::make_shared<hir::Code>(std::move(else_res.code));
 
 	code.if_true(
 		cond_opnd,
@@ -139,7 +140,7 @@ Result Compiler::compile_if(NodeIndex node_idx, Context ctx) {
 		}
 	);
 
-	return Result {code, result_register};
+	return Result {std::move(code), result_register};
 }
 
 Result Compiler::compile(NodeIndex node_idx, Context ctx) {
@@ -154,7 +155,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			auto l = make_label();
 			auto l2 = ctx.current_module.register_constant(l, {literal_num});
 			code.get_global(result_register, l2);
-			return Result {code, result_register};
+			return Result {std::move(code), result_register};
 		}
 		case NodeType::BLK: {
 			hir::Code code {};
@@ -167,10 +168,10 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			};
 			for (auto idx : node) {
 				auto opnd_res = compile(idx, inner_ctx);
-				code = code + opnd_res.code;
+				code.append(std::move(opnd_res.code));
 				result_register = opnd_res.result_register;
 			}
-			return Result {code, result_register};
+			return Result {std::move(code), result_register};
 		}
 		case NodeType::IF: return compile_if(node_idx, ctx);
 		case NodeType::WHEN: {
@@ -183,13 +184,13 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			auto result_register = make_register();
 
 			auto cond_res = compile(cond_idx, ctx);
-			code = code + cond_res.code;
+			code.append(std::move(cond_res.code));
 			auto cond_opnd = cond_res.result_register;
 
 			auto then_res = compile(then_idx, ctx);
 			then_res.code.copy(result_register, then_res.result_register);
 
-			auto if_true_code = std::make_shared<hir::Code>(then_res.code);
+			auto if_true_code = std::make_shared<hir::Code>(std::move(then_res.code));
 
 			code.if_true(
 				cond_opnd,
@@ -199,7 +200,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 				}
 			);
 
-			return Result {code, result_register};
+			return Result {std::move(code), result_register};
 		}
 		case NodeType::FOR: {
 			hir::Code code {};
@@ -226,7 +227,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 
 			if (step_node.type != NodeType::EMPTY) {
 				auto step_result = compile(step_idx, ctx);
-				code = code + step_result.code;
+				code.append(std::move(step_result.code));
 				step_value = step_result.result_register;
 			} else {
 				auto l = make_label();
@@ -251,11 +252,11 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			};
 
 			auto var_result = compile(decl_idx, header_ctx);
-			code = code + var_result.code;
+			code.append(std::move(var_result.code));
 			auto var_opnd = var_result.result_register;
 
 			auto to_result = compile(to_idx, header_ctx);
-			code = code + to_result.code;
+			code.append(std::move(to_result.code));
 			auto to_opnd = to_result.result_register;
 
 			auto then_result = compile(then_idx, body_ctx);
@@ -274,7 +275,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 					.child_blocks = {},
 				}
 			);
-			loop_body = loop_body + then_result.code;
+			loop_body.append(std::move(then_result.code));
 			auto t1 = make_register();
 			auto l = make_label();
 			auto l2 = ctx.current_module.register_constant(l, hir::Integer(1));
@@ -292,7 +293,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 				}
 			);
 
-			return {code, then_opnd};
+			return {std::move(code), then_opnd};
 		}
 		case NodeType::WHILE: {
 			hir::Code code {};
@@ -329,7 +330,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			if_break.brake(stop_label);
 
 			hir::Code loop_body {};
-			loop_body = loop_body + cond_result.code;
+			loop_body.append(std::move(cond_result.code));
 			loop_body.if_false(
 				cond_opnd,
 				hir::Block {
@@ -337,7 +338,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 					.child_blocks = {},
 				}
 			);
-			loop_body = loop_body + then_result.code;
+			loop_body.append(std::move(then_result.code));
 
 			code.loop(
 				next_label,
@@ -348,7 +349,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 				}
 			);
 
-			return {code, then_opnd};
+			return {std::move(code), then_opnd};
 		}
 		case NodeType::BREAK: assert(false);
 		case NodeType::CONTINUE: assert(false);
@@ -357,15 +358,15 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 
 			auto place_idx = node[0];
 			auto place_result = compile_lvalue(place_idx, ctx);
-			code = code + place_result.code;
+			code.append(std::move(place_result.code));
 			auto place = place_result.result_register;
 			auto value_idx = node[1];
 			auto value_result = compile(value_idx, ctx);
-			code = code + value_result.code;
+			code.append(std::move(value_result.code));
 			auto value = value_result.result_register;
 			code.store(place, value);
 
-			return {code, value};
+			return {std::move(code), value};
 		}
 
 #define BINARY_ARITH(OPCODE)                            \
@@ -376,7 +377,8 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
                                                         \
 		auto left_result = compile(left_idx, ctx);          \
 		auto right_result = compile(right_idx, ctx);        \
-		code = code + left_result.code + right_result.code; \
+		code.append(std::move(left_result.code));           \
+		code.append(std::move(right_result.code));          \
 		auto result_register = make_register();             \
 		code.instructions.push_back(                        \
 			hir::Instruction {                                \
@@ -386,7 +388,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 		     right_result.result_register}                  \
 			}                                                 \
 		);                                                  \
-		return {code, result_register};                     \
+		return {std::move(code), result_register};                     \
 	}
 
 		case NodeType::OR: BINARY_ARITH(OR);
@@ -414,13 +416,13 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			hir::Code code {};
 			auto result_register = make_register();
 			auto exp_result = compile(node[0], ctx);
-			code = code + exp_result.code;
+			code.append(std::move(exp_result.code));
 			code.instructions.push_back(
 				hir::Instruction {
 					hir::Opcode::NOT, {result_register, exp_result.result_register}
 				}
 			);
-			return {code, result_register};
+			return {std::move(code), result_register};
 		}
 		case NodeType::ID: {
 			auto res = compile_lvalue(node_idx, ctx);
@@ -435,7 +437,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			auto l =
 				ctx.current_module.register_constant(make_label(), literal_string);
 			code.get_global(result_register, l);
-			return Result {code, result_register};
+			return Result {std::move(code), result_register};
 		}
 		case NodeType::VAR_DECL: {
 			hir::Code code {};
@@ -450,7 +452,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			const auto name = std::string(pool.find(id_node.str_id));
 
 			auto initial_result = compile(exp_idx, ctx);
-			code = code + initial_result.code;
+			code.append(std::move(initial_result.code));
 			auto initial = initial_result.result_register;
 
 			auto l = make_variable(name);
@@ -462,7 +464,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 
 			env.insert(ctx.scope_id, id_node.str_id, l);
 
-			return Result {code, l};
+			return Result {std::move(code), l};
 		}
 		case NodeType::FUN_DECL: {
 			hir::Code code {};
@@ -515,7 +517,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			);
 
 			hir::Block block {
-				.body_code = std::make_shared<hir::Code>(body_result.code),
+				.body_code = std::make_shared<hir::Code>(std::move(body_result.code)),
 				.child_blocks = {},
 			};
 			auto entry = make_label();
@@ -532,7 +534,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			auto l2 = ctx.current_module.register_constant(l, function);
 			code.get_global(variable_register, l2);
 
-			return {code, variable_register};
+			return {std::move(code), variable_register};
 		}
 		case NodeType::NIL: {
 			hir::Code code {};
@@ -541,7 +543,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			auto l = make_label();
 			auto l2 = ctx.current_module.register_constant(l, literal_nil);
 			code.get_global(result_register, l2);
-			return Result {code, result_register};
+			return Result {std::move(code), result_register};
 		}
 		case NodeType::TRUE: {
 			hir::Code code {};
@@ -550,7 +552,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			auto l = make_label();
 			auto l2 = ctx.current_module.register_constant(l, literal_true);
 			code.get_global(result_register, l2);
-			return Result {code, result_register};
+			return Result {std::move(code), result_register};
 		}
 		case NodeType::FALSE: {
 			hir::Code code {};
@@ -559,7 +561,7 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			auto l = make_label();
 			auto l2 = ctx.current_module.register_constant(l, literal_false);
 			code.get_global(result_register, l2);
-			return Result {code, result_register};
+			return Result {std::move(code), result_register};
 		}
 		case NodeType::LET: {
 			hir::Code code {};
@@ -577,11 +579,11 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			};
 			for (auto idx : decls_node) {
 				auto initial_result = compile(idx, inner_ctx);
-				code = code + initial_result.code;
+				code.append(std::move(initial_result.code));
 			}
 			auto expression_result = compile(exp_idx, inner_ctx);
-			code = code + expression_result.code;
-			return {code, expression_result.result_register};
+			code.append(std::move(expression_result.code));
+			return {std::move(code), expression_result.result_register};
 		}
 		case NodeType::CHAR: {
 			hir::Code code {};
@@ -590,16 +592,16 @@ Result Compiler::compile(NodeIndex node_idx, Context ctx) {
 			auto l =
 				ctx.current_module.register_constant(make_label(), literal_character);
 			code.get_global(result_register, l);
-			return Result {code, result_register};
+			return Result {std::move(code), result_register};
 		}
 		case NodeType::PATH: {
 			hir::Code code {};
 			auto v_res = compile_lvalue(node[0], ctx);
-			code = code + v_res.code;
+			code.append(std::move(v_res.code));
 			auto v = v_res.result_register;
 			auto a = make_register();
 			code.load(a, v);
-			return {code, a};
+			return {std::move(code), a};
 		}
 		case NodeType::INSTANCE:
 			assert(false && "used only in typechecking. should not be evaluated");
@@ -673,14 +675,14 @@ Result Compiler::compile_lvalue(NodeIndex node_idx, Context ctx) {
 			auto offset_idx = node[1];
 			hir::Code code {};
 			auto place_res = compile_lvalue(place_idx, ctx);
-			code = code + place_res.code;
+			code.append(std::move(place_res.code));
 			auto place = place_res.result_register;
 			auto offset_res = compile(offset_idx, ctx);
-			code = code + offset_res.code;
+			code.append(std::move(offset_res.code));
 			auto offset = offset_res.result_register;
 			auto a = make_variable("fixme");
 			code.get_element(a, place, offset);
-			return {code, a};
+			return {std::move(code), a};
 		}
 		case NodeType::ID: {
 			hir::Code code {};
@@ -693,7 +695,7 @@ Result Compiler::compile_lvalue(NodeIndex node_idx, Context ctx) {
 				pool.find(node.str_id)
 			);
 			auto v = variable_ptr->registuhr;
-			return Result {code, v};
+			return Result {std::move(code), v};
 		}
 		case NodeType::PATH: {
 			return compile_lvalue(node[0], ctx);
@@ -0,0 +1,381 @@
+// Loop-invariant code motion
+//
+// Instructions in a loop that compute the same value on every iteration are
+// moved to the preheader, a block running once right before the loop. When
+// the header has other predecessors from outside the loop, or the only one
+// also goes elsewhere, a preheader is made for it.
+//
+// LIR isn't in SSA form, so an instruction is only moved when its register is
+// written nowhere else in the loop and isn't alive on entry to the header:
+// every read of it, inside the loop or after it, then comes after the write.
+// Its operands must not be written in the loop, other than by instructions
+// already moved. Loads additionally need no store in the loop to possibly
+// reach the same array, and no call. The preheader runs even when the loop
+// body doesn't, so instructions that may fail, like divisions or accesses
+// past the first cell, are only moved from blocks that run on every iteration,
+// on every way out of the loop or back to its header. Nothing with an effect
+// seen outside the loop, like printing or storing, may run before them in the
+// iteration either, as it would be skipped when they fail.
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "cfg.hpp"
+#include "lir.hpp"
+#include "passes.hpp"
+
+namespace passes {
+
+using lir::Opcode;
+using lir::Operand;
+
+static bool is_pure(Opcode op);
+static bool may_fail(const lir::Instruction& inst);
+static bool is_store(Opcode op);
+static bool has_effect(Opcode op);
+static std::vector<std::vector<bool>> live_in(
+	const cfg::Graph& graph, size_t register_count
+);
+static size_t make_preheader(cfg::Graph& graph, const cfg::Loop& loop);
+
+// instructions whose result only depends on their operands
+bool is_pure(Opcode op) {
+	switch (op) {
+		case Opcode::MOV:
+		case Opcode::ADD:
+		case Opcode::SUB:
+		case Opcode::MUL:
+		case Opcode::DIV:
+		case Opcode::MOD:
+		case Opcode::NOT:
+		case Opcode::OR:
+		case Opcode::AND:
+		case Opcode::EQ:
+		case Opcode::DIFF:
+		case Opcode::LESS:
+		case Opcode::LESS_EQ:
+		case Opcode::GREATER:
+		case Opcode::GREATER_EQ:
+		case Opcode::SHIFTA: return true;
+		default: return false;
+	}
+}
+
+bool may_fail(const lir::Instruction& inst) {
+	const auto& opnds = inst.operands;
+	auto is_immediate = [](const Operand& opnd, bool zero) {
+		return opnd.type == Operand::Type::IMMEDIATE
+		   and (opnd.as_immediate().number == 0) == zero;
+	};
+	switch (inst.opcode) {
+		case Opcode::DIV:
+		case Opcode::MOD: return not is_immediate(opnds[2], false);
+		// arrays have at least one cell
+		case Opcode::LOADA:
+		case Opcode::SHIFTA: return not is_immediate(opnds[1], true);
+		default: return false;
+	}
+}
+
+bool is_store(Opcode op) {
+	return op == Opcode::STOREA or op == Opcode::ADDA or op == Opcode::SUBA;
+}
+
+// instructions whose effects are seen outside the loop
+bool has_effect(Opcode op) {
+	switch (op) {
+		case Opcode::PRINTF:
+		case Opcode::PRINTV:
+		case Opcode::PRINTC:
+		case Opcode::READV:
+		case Opcode::READC:
+		case Opcode::STOREA:
+		case Opcode::STOREA_U:
+		case Opcode::ADDA:
+		case Opcode::SUBA:
+		case Opcode::CALL: return true;
+		default: return false;
+	}
+}
+
+// registers alive on entry of every block. calls don't read any register of
+// the caller, as registers shared with the callee are never moved
+std::vector<std::vector<bool>> live_in(
+	const cfg::Graph& graph, size_t register_count
+) {
+	const auto& blocks = graph.blocks;
+	std::vector<std::vector<bool>> in(
+		blocks.size(), std::vector<bool>(register_count, false)
+	);
+	auto order = cfg::reverse_postorder(graph);
+	std::reverse(order.begin(), order.end());
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (auto b : order) {
+			std::vector<bool> live(register_count, false);
+			for (auto succ : blocks[b].successors)
+				for (size_t reg = 0; reg < register_count; reg++)
+					if (in[succ][reg]) live[reg] = true;
+			for (auto inst = blocks[b].code.rbegin(); inst != blocks[b].code.rend();
+			     inst++) {
+				size_t first = 0;
+				if (defines(inst->opcode)) {
+					if (inst->operands[0].type == Operand::Type::REGISTER)
+						live[inst->operands[0].as_register().index] = false;
+					first = 1;
+				}
+				for (size_t i = first; i < lir::Instruction::max_operands; i++)
+					if (inst->operands[i].type == Operand::Type::REGISTER)
+						live[inst->operands[i].as_register().index] = true;
+			}
+			if (live != in[b]) {
+				in[b] = std::move(live);
+				changed = true;
+			}
+		}
+	}
+	return in;
+}
+
+// block running right before the loop and only going to its header. an
+// existing one is used when it's the only way into the loop
+size_t make_preheader(cfg::Graph& graph, const cfg::Loop& loop) {
+	std::vector<size_t> outside {};
+	for (auto pred : graph.blocks[loop.header].predecessors)
+		if (not loop.contains(pred)) outside.push_back(pred);
+	if (outside.size() == 1) {
+		const auto& block = graph.blocks[outside[0]];
+		auto last = block.code.empty() ? Opcode::NOP : block.code.back().opcode;
+		if (block.successors.size() == 1
+		    and (last == Opcode::JMP or not cfg::ends_block(last)))
+			return outside[0];
+	}
+
+	auto header_labels = graph.blocks[loop.header].labels;
+	auto preheader = graph.add_block();
+	auto label = graph.label_of(preheader);
+	graph.blocks[preheader].fallthrough = loop.header;
+	for (auto pred : outside) {
+		auto& block = graph.blocks[pred];
+		if (block.fallthrough == loop.header) block.fallthrough = preheader;
+		if (block.code.empty()) continue;
+		for (auto& opnd : block.code.back().operands)
+			if (opnd.type == Operand::Type::LABEL
+			    and std::find(
+						header_labels.begin(), header_labels.end(), opnd.as_label().id
+					) != header_labels.end())
+				opnd.as_label().id = label;
+	}
+	auto& layout = graph.layout;
+	auto at = std::find(layout.begin(), layout.end(), loop.header);
+	layout.insert(at, preheader);
+	graph.connect();
+	return preheader;
+}
+
+HoistReport hoist_invariants(lir::Chunk& chunk) {
+	HoistReport report {};
+
+	size_t register_count = 0;
+	std::vector<size_t> defs {};
+	for (const auto& inst : chunk.m_vec)
+		for (const auto& opnd : inst.operands)
+			if (opnd.type == Operand::Type::REGISTER)
+				register_count =
+					std::max(register_count, opnd.as_register().index + 1);
+	defs.assign(register_count, 0);
+	for (const auto& inst : chunk.m_vec)
+		if (defines(inst.opcode)
+		    and inst.operands[0].type == Operand::Type::REGISTER)
+			defs[inst.operands[0].as_register().index]++;
+
+	// array each register points into, when it's known. two pointers into
+	// different arrays never reach the same cell
+	constexpr auto unknown = cfg::none;
+	std::vector<size_t> origin(register_count, unknown);
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (const auto& inst : chunk.m_vec) {
+			const auto& opnds = inst.operands;
+			if (not defines(inst.opcode)
+			    or opnds[0].type != Operand::Type::REGISTER)
+				continue;
+			auto reg = opnds[0].as_register().index;
+			if (defs[reg] != 1 or origin[reg] != unknown) continue;
+			auto from = [&](const Operand& opnd) {
+				return opnd.type == Operand::Type::REGISTER
+				       ? origin[opnd.as_register().index]
+				       : unknown;
+			};
+			size_t found = unknown;
+			if (inst.opcode == Opcode::ALLOCA or inst.opcode == Opcode::CLONEA)
+				found = reg;
+			else if (inst.opcode == Opcode::SHIFTA)
+				found = from(opnds[2]);
+			else if (inst.opcode == Opcode::MOV)
+				found = from(opnds[1]);
+			if (found != unknown) {
+				origin[reg] = found;
+				changed = true;
+			}
+		}
+	}
+
+	cfg::Graph graph {std::move(chunk)};
+
+	// registers of more than one procedure, which calls may write
+	const auto shared = cfg::shared_registers(graph, register_count);
+
+	// loops are done inner first. the analyses are redone after each loop,
+	// as a new preheader changes the graph
+	std::set<size_t> done {};
+	for (;;) {
+		const cfg::Dominators dominators {graph};
+		const cfg::Loops loops {graph, dominators};
+		auto it = std::find_if(
+			loops.loops.begin(),
+			loops.loops.end(),
+			[&](const cfg::Loop& loop) { return not done.contains(loop.header); }
+		);
+		if (it == loops.loops.end()) break;
+		const auto loop = *it;
+		done.insert(loop.header);
+		if (std::find(graph.entries.begin(), graph.entries.end(), loop.header)
+		    != graph.entries.end())
+			continue;
+
+		std::vector<size_t> written(register_count, 0);
+		bool calls = false;
+		std::vector<size_t> stored {};
+		for (auto b : loop.blocks)
+			for (const auto& inst : graph.blocks[b].code) {
+				if (inst.opcode == Opcode::CALL) calls = true;
+				if (is_store(inst.opcode)
+				    and inst.operands[2].type == Operand::Type::REGISTER)
+					stored.push_back(origin[inst.operands[2].as_register().index]);
+				if (defines(inst.opcode)
+				    and inst.operands[0].type == Operand::Type::REGISTER)
+					written[inst.operands[0].as_register().index]++;
+			}
+
+		// blocks leaving the loop, including by returning, and blocks going
+		// back to its header. a block dominating all of them runs on every
+		// iteration, even when the loop never ends
+		std::vector<size_t> ends {};
+		for (auto b : loop.blocks) {
+			const auto& succs = graph.blocks[b].successors;
+			if (succs.empty()
+			    or std::any_of(succs.begin(), succs.end(), [&](size_t succ) {
+						 return not loop.contains(succ) or succ == loop.header;
+					 }))
+				ends.push_back(b);
+		}
+		auto on_every_iteration = [&](size_t b) {
+			return std::all_of(ends.begin(), ends.end(), [&](size_t end) {
+				return dominators.dominates(b, end);
+			});
+		};
+
+		// whether an effect may run between entering the header and the
+		// instruction at i of block b. a failing instruction runs first on the
+		// first arrival at b, so only paths from the header reaching b once
+		// count
+		auto effect_before = [&](size_t b, size_t i) {
+			auto effect = [](const lir::Instruction& inst) {
+				return has_effect(inst.opcode);
+			};
+			const auto& code = graph.blocks[b].code;
+			if (std::any_of(code.begin(), code.begin() + (ptrdiff_t)i, effect))
+				return true;
+			if (b == loop.header) return false;
+			std::vector<bool> seen(graph.blocks.size(), false);
+			seen[b] = true;
+			auto work = graph.blocks[b].predecessors;
+			while (not work.empty()) {
+				auto pred = work.back();
+				work.pop_back();
+				if (seen[pred] or not loop.contains(pred)) continue;
+				seen[pred] = true;
+				const auto& block = graph.blocks[pred];
+				if (std::any_of(block.code.begin(), block.code.end(), effect))
+					return true;
+				if (pred != loop.header)
+					work.insert(
+						work.end(), block.predecessors.begin(), block.predecessors.end()
+					);
+			}
+			return false;
+		};
+
+		const auto live = live_in(graph, register_count);
+		auto invariant = [&](const Operand& opnd) {
+			if (opnd.type != Operand::Type::REGISTER) return true;
+			auto reg = opnd.as_register().index;
+			return written[reg] == 0 and not (calls and shared[reg]);
+		};
+		auto movable = [&](size_t b, size_t i) {
+			const auto& inst = graph.blocks[b].code[i];
+			if (inst.opcode != Opcode::LOADA and not is_pure(inst.opcode))
+				return false;
+			const auto& dest = inst.operands[0];
+			if (dest.type != Operand::Type::REGISTER) return false;
+			auto reg = dest.as_register().index;
+			if (written[reg] != 1 or shared[reg] or live[loop.header][reg])
+				return false;
+			for (size_t i = 1; i < lir::Instruction::max_operands; i++)
+				if (not invariant(inst.operands[i])) return false;
+			if (may_fail(inst)
+			    and (not on_every_iteration(b) or effect_before(b, i)))
+				return false;
+			if (inst.opcode == Opcode::LOADA) {
+				if (calls) return false;
+				auto base = origin[inst.operands[2].as_register().index];
+				for (auto array : stored)
+					if (array == unknown or base == unknown or array == base)
+						return false;
+			}
+			return true;
+		};
+
+		// moving an instruction may make the ones reading its result movable
+		std::vector<lir::Instruction> hoisted {};
+		for (bool changed = true; changed;) {
+			changed = false;
+			for (auto b : loop.blocks) {
+				auto& code = graph.blocks[b].code;
+				for (size_t i = 0; i < code.size();) {
+					if (not movable(b, i)) {
+						i++;
+						continue;
+					}
+					written[code[i].operands[0].as_register().index]--;
+					hoisted.push_back(std::move(code[i]));
+					code.erase(code.begin() + (ptrdiff_t)i);
+					changed = true;
+				}
+			}
+		}
+		if (hoisted.empty()) continue;
+
+		auto preheader = make_preheader(graph, loop);
+		auto& code = graph.blocks[preheader].code;
+		auto at = code.end();
+		if (not code.empty() and code.back().opcode == Opcode::JMP) at--;
+		code.insert(
+			at,
+			std::make_move_iterator(hoisted.begin()),
+			std::make_move_iterator(hoisted.end())
+		);
+		report.loops++;
+		report.hoisted += hoisted.size();
+	}
+
+	chunk = cfg::linearize(std::move(graph));
+	return report;
+}
+
+} // namespace passes
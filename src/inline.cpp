@@ -0,0 +1,280 @@
+// Function inlining
+//
+// A call pushes each argument, calls, opens a register window, pops each
+// parameter, pushes the result, returns and pops it: 2n + 5 instructions
+// around the body of a function with n parameters. Calls to functions whose
+// body is not much larger than that are replaced with a copy of the body,
+// and so are calls to functions that are only called once. Functions that
+// may end up calling themselves are never inlined.
+//
+// Parameters become the argument registers of the call, and registers only
+// used by the function get fresh ones for every copy. Registers of enclosing
+// scopes the function reads are left as they are. Functions are done after
+// the functions they call, so that small functions inlined into each other
+// are copied whole. Functions no call is left to are dropped.
+
+#include <cassert>
+#include <cstddef>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "compiler.hpp"
+#include "lir.hpp"
+#include "passes.hpp"
+
+namespace compiler {
+
+using lir::Opcode;
+
+// how many times the instructions a call costs the body of a function may
+// have and still be copied into every call
+constexpr size_t inline_growth = 4;
+
+size_t Compiler::inline_calls(Chunk& main) {
+	// every function starts with its label, FUNC and a POP per parameter, and
+	// ends pushing its result and returning
+	struct Callee {
+		vector<Operand> params {};
+		size_t begin {0};
+		size_t end {0};
+		Operand result {};
+		std::set<size_t> calls {};
+		size_t call_sites {0};
+		bool exports {false};
+	};
+
+	std::map<size_t, size_t> by_label {};
+	for (size_t f = 0; f < functions.size(); f++)
+		for (const auto& [id, index] : functions[f].label_indexes)
+			if (index == 0) by_label[id] = f;
+	auto callee_of = [&](const lir::Instruction& inst) -> size_t {
+		if (inst.opcode != Opcode::CALL
+		    or inst.operands[0].type != Operand::Type::LABEL)
+			return functions.size();
+		auto it = by_label.find(inst.operands[0].as_label().id);
+		return it == by_label.end() ? functions.size() : it->second;
+	};
+
+	// amount of chunks referencing each register
+	vector<size_t> users(reg_count, 0);
+	auto count_users = [&](const Chunk& chunk) {
+		std::set<size_t> regs {};
+		for (const auto& inst : chunk.m_vec)
+			for (const auto& opnd : inst.operands)
+				if (opnd.type == Operand::Type::REGISTER)
+					regs.insert(opnd.as_register().index);
+		for (auto reg : regs) users[reg]++;
+	};
+	count_users(main);
+	for (const auto& func : functions) count_users(func);
+
+	vector<Callee> callees(functions.size());
+	auto count_calls = [&](const Chunk& chunk, Callee* caller) {
+		for (const auto& inst : chunk.m_vec) {
+			auto f = callee_of(inst);
+			if (f == functions.size()) continue;
+			callees[f].call_sites++;
+			if (caller != nullptr) caller->calls.insert(f);
+		}
+	};
+	// where the parameters, the body and the result of a function are. it's
+	// found again whenever calls are inlined into the function
+	auto lay_out = [&](size_t f) {
+		const auto& vec = functions[f].m_vec;
+		auto& callee = callees[f];
+		assert(vec.size() >= 3 and vec[0].opcode == Opcode::FUNC);
+		callee.params.clear();
+		callee.begin = 1;
+		while (vec[callee.begin].opcode == Opcode::POP)
+			callee.params.push_back(vec[callee.begin++].operands[0]);
+		callee.end = vec.size() - 2;
+		assert(vec[callee.end].opcode == Opcode::PUSH);
+		assert(vec[callee.end + 1].opcode == Opcode::RET);
+		callee.result = vec[callee.end].operands[0];
+	};
+	count_calls(main, nullptr);
+	for (size_t f = 0; f < functions.size(); f++) {
+		const auto& vec = functions[f].m_vec;
+		auto& callee = callees[f];
+		count_calls(functions[f], &callee);
+		lay_out(f);
+
+		// registers of the function that a function declared in it reads
+		for (const auto& inst : vec)
+			if (passes::defines(inst.opcode)
+			    and inst.operands[0].type == Operand::Type::REGISTER
+			    and users[inst.operands[0].as_register().index] > 1)
+				callee.exports = true;
+	}
+
+	auto is_recursive = [&](size_t f) {
+		std::set<size_t> seen {};
+		vector<size_t> work(callees[f].calls.begin(), callees[f].calls.end());
+		while (not work.empty()) {
+			auto g = work.back();
+			work.pop_back();
+			if (g == f) return true;
+			if (not seen.insert(g).second) continue;
+			work.insert(work.end(), callees[g].calls.begin(), callees[g].calls.end());
+		}
+		return false;
+	};
+	vector<bool> inlinable(functions.size(), false);
+	auto decide = [&](size_t f) {
+		const auto& callee = callees[f];
+		auto overhead = 2 * callee.params.size() + 5;
+		auto size = callee.end - callee.begin;
+		inlinable[f] =
+			not callee.exports and not is_recursive(f)
+			and (size <= inline_growth * overhead or callee.call_sites == 1);
+	};
+
+	size_t inlined = 0;
+
+	// replace the calls to inlinable functions made by the chunk
+	auto inline_into = [&](Chunk& caller) {
+		auto& vec = caller.m_vec;
+		std::multimap<size_t, size_t> labels_at {};
+		for (const auto& [id, index] : caller.label_indexes)
+			labels_at.insert({index, id});
+		auto labeled = [&](size_t begin, size_t end) {
+			auto it = labels_at.lower_bound(begin);
+			return it != labels_at.end() and it->first < end;
+		};
+
+		// call sites by the index of their first PUSH
+		std::map<size_t, size_t> sites {};
+		for (size_t c = 0; c < vec.size(); c++) {
+			auto f = callee_of(vec[c]);
+			if (f == functions.size() or not inlinable[f]) continue;
+			auto n = callees[f].params.size();
+			if (c < n or c + 1 >= vec.size() or vec[c + 1].opcode != Opcode::POP)
+				continue;
+			bool pushed = true;
+			for (size_t i = c - n; i < c; i++)
+				pushed = pushed and vec[i].opcode == Opcode::PUSH;
+			if (not pushed or labeled(c - n + 1, c + 2)) continue;
+			sites[c - n] = c;
+		}
+		if (sites.empty()) return;
+
+		Chunk res {};
+		auto add_labels = [&](size_t index) {
+			auto [first, last] = labels_at.equal_range(index);
+			for (auto it = first; it != last; it++)
+				res.add_label(lir::Operand(lir::Label(it->second)));
+		};
+		for (size_t i = 0; i < vec.size();) {
+			add_labels(i);
+			auto site = sites.find(i);
+			if (site == sites.end()) {
+				res.m_vec.push_back(std::move(vec[i++]));
+				continue;
+			}
+			auto c = site->second;
+			auto f = callee_of(vec[c]);
+			const auto& callee = callees[f];
+			const auto& body = functions[f].m_vec;
+
+			std::map<size_t, Operand> regs {};
+			for (size_t k = 0; k < callee.params.size(); k++) {
+				// the first parameter is pushed last
+				const auto& arg = vec[c - 1 - k].operands[0];
+				const auto& param = callee.params[k];
+				bool written = false;
+				for (size_t j = callee.begin; j < callee.end; j++)
+					written = written
+					       or (passes::defines(body[j].opcode)
+					           and passes::same_operand(body[j].operands[0], param));
+				if (arg.type == Operand::Type::REGISTER and not written) {
+					regs.insert({param.as_register().index, arg});
+					continue;
+				}
+				auto copy = make_register();
+				users.push_back(1);
+				res.emit(Opcode::MOV, copy, arg);
+				regs.insert({param.as_register().index, copy});
+			}
+			auto rename = [&](Operand opnd) {
+				if (opnd.type != Operand::Type::REGISTER) return opnd;
+				auto reg = opnd.as_register();
+				if (auto it = regs.find(reg.index); it != regs.end()) return it->second;
+				if (users[reg.index] > 1) return opnd;
+				reg.index = reg_count++;
+				users.push_back(1);
+				regs.insert({opnd.as_register().index, Operand(reg)});
+				return Operand(reg);
+			};
+
+			std::map<size_t, size_t> ids {};
+			std::multimap<size_t, size_t> body_labels {};
+			for (const auto& [id, index] : functions[f].label_indexes)
+				if (index >= callee.begin and index <= callee.end) {
+					ids[id] = make_label().as_label().id;
+					body_labels.insert({index, ids[id]});
+				}
+			auto add_body_labels = [&](size_t index) {
+				auto [first, last] = body_labels.equal_range(index);
+				for (auto it = first; it != last; it++)
+					res.add_label(lir::Operand(lir::Label(it->second)));
+			};
+			for (size_t j = callee.begin; j < callee.end; j++) {
+				add_body_labels(j);
+				auto inst = body[j];
+				for (auto& opnd : inst.operands) {
+					opnd = rename(opnd);
+					if (opnd.type != Operand::Type::LABEL) continue;
+					auto id = ids.find(opnd.as_label().id);
+					if (id != ids.end()) opnd = lir::Operand(lir::Label(id->second));
+				}
+				res.m_vec.push_back(std::move(inst));
+			}
+			add_body_labels(callee.end);
+			res.emit(Opcode::MOV, vec[c + 1].operands[0], rename(callee.result))
+				.with_integer(vec[c + 1].integer);
+
+			inlined++;
+			i = c + 2;
+		}
+		add_labels(vec.size());
+		res.result_opnd = std::move(caller.result_opnd);
+		caller = std::move(res);
+	};
+
+	// callees first, so that what's copied was already inlined into
+	vector<bool> visited(functions.size(), false);
+	auto visit = [&](auto& self, size_t f) -> void {
+		if (visited[f]) return;
+		visited[f] = true;
+		for (auto g : callees[f].calls) self(self, g);
+		inline_into(functions[f]);
+		lay_out(f);
+		decide(f);
+	};
+	for (size_t f = 0; f < functions.size(); f++) visit(visit, f);
+	inline_into(main);
+
+	// functions that aren't called anymore
+	vector<bool> called(functions.size(), false);
+	vector<const Chunk*> work {&main};
+	while (not work.empty()) {
+		const auto* chunk = work.back();
+		work.pop_back();
+		for (const auto& inst : chunk->m_vec) {
+			auto f = callee_of(inst);
+			if (f == functions.size() or called[f]) continue;
+			called[f] = true;
+			work.push_back(&functions[f]);
+		}
+	}
+	vector<Chunk> kept {};
+	for (size_t f = 0; f < functions.size(); f++)
+		if (called[f]) kept.push_back(std::move(functions[f]));
+	functions = std::move(kept);
+
+	return inlined;
+}
+
+} // namespace compiler
@@ -0,0 +1,147 @@
+#include "input.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+
+static bool is_space(char c);
+
+bool is_space(char c) {
+	return c == ' ' or c == '\t' or c == '\n' or c == '\v' or c == '\f'
+	    or c == '\r';
+}
+
+Input::Input(std::istream& stream, bool shared)
+: m_stream {stream},
+  m_shared {shared},
+  m_interactive {&stream == &std::cin and isatty(STDIN_FILENO)} {
+	if (&stream == &std::cin and not shared) map_stdin();
+}
+
+Input::~Input() {
+	if (m_map == nullptr) return;
+	std::fseek(stdin, m_pos - m_map, SEEK_SET);
+	munmap((void*)m_map, m_map_size);
+}
+
+void Input::map_stdin() {
+	struct stat st {};
+	if (fstat(STDIN_FILENO, &st) != 0 or not S_ISREG(st.st_mode)) return;
+	// stdio may have read ahead of where the program is
+	auto offset = std::ftell(stdin);
+	if (offset < 0 or offset > st.st_size) return;
+
+	m_at_eof = true;
+	if (offset == st.st_size) return;
+	auto size = (std::size_t)st.st_size;
+	auto* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+	if (map == MAP_FAILED) {
+		m_at_eof = false;
+		return;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+	m_map = (const char*)map;
+	m_map_size = size;
+	m_pos = m_map + offset;
+	m_end = m_map + size;
+}
+
+bool Input::refill() {
+	if (m_at_eof) return false;
+
+	// what's left goes to the start of the buffer, followed by what's read
+	auto left = (std::size_t)(m_end - m_pos);
+	if (left > 0 and m_pos != m_buffer.data())
+		std::memmove(m_buffer.data(), m_pos, left);
+	if (m_buffer.size() - left < capacity / 2)
+		m_buffer.resize(std::max(capacity, 2 * m_buffer.size()));
+
+	std::size_t read = 0;
+	if (m_interactive) {
+		std::string line {};
+		if (std::getline(m_stream, line)) {
+			if (not m_stream.eof()) line += '\n';
+			if (m_buffer.size() < left + line.size())
+				m_buffer.resize(left + line.size());
+			std::memcpy(m_buffer.data() + left, line.data(), line.size());
+			read = line.size();
+		}
+	} else {
+		auto room = m_buffer.size() - left;
+		read = (std::size_t)m_stream.rdbuf()->sgetn(
+			m_buffer.data() + left, (std::streamsize)room
+		);
+	}
+
+	m_pos = m_buffer.data();
+	m_end = m_pos + left + read;
+	if (read == 0) m_at_eof = true;
+	return read > 0;
+}
+
+std::optional<std::string_view> Input::line() {
+	if (m_shared) {
+		if (not std::getline(m_stream, m_line)) return {};
+		return m_line;
+	}
+	for (std::size_t scanned = 0;;) {
+		auto rest = (std::size_t)(m_end - m_pos);
+		const char* newline = nullptr;
+		if (rest > scanned)
+			newline = (const char*)std::memchr(m_pos + scanned, '\n', rest - scanned);
+		if (newline != nullptr) {
+			std::string_view line(m_pos, (std::size_t)(newline - m_pos));
+			m_pos = newline + 1;
+			return line;
+		}
+		scanned = rest;
+		if (not refill()) break;
+	}
+	// the last line may not end in a newline
+	if (m_pos == m_end) return {};
+	std::string_view line(m_pos, (std::size_t)(m_end - m_pos));
+	m_pos = m_end;
+	return line;
+}
+
+std::optional<char> Input::non_space() {
+	if (m_shared) {
+		char c = 0;
+		if (not(m_stream >> c)) return {};
+		return c;
+	}
+	do {
+		while (m_pos != m_end) {
+			auto c = *m_pos++;
+			if (not is_space(c)) return c;
+		}
+	} while (refill());
+	return {};
+}
+
+std::optional<int> Input::parse_integer(std::string_view line) {
+	std::size_t i = 0;
+	while (i < line.size() and is_space(line[i])) i++;
+	bool negative = i < line.size() and line[i] == '-';
+	if (i < line.size() and (line[i] == '-' or line[i] == '+')) i++;
+	if (i == line.size() or line[i] < '0' or line[i] > '9') return {};
+
+	// one past the largest int, which the smallest one needs
+	constexpr auto limit = (std::int64_t)std::numeric_limits<int>::max() + 1;
+	std::int64_t value = 0;
+	for (; i < line.size() and line[i] >= '0' and line[i] <= '9'; i++) {
+		value = 10 * value + (line[i] - '0');
+		if (value > limit) return {};
+	}
+	if (negative) value = -value;
+	if (value > std::numeric_limits<int>::max()) return {};
+	return (int)value;
+}
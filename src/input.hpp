@@ -0,0 +1,67 @@
+// Buffered input of the interpreters
+
+#ifndef INPUT_HPP
+#define INPUT_HPP
+
+#include <cstddef>
+#include <istream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// reads what a program is given in big blocks instead of a line or a
+// character at a time. when it's given a regular file through stdin, the
+// file is mapped into memory and read in place instead, and stdin is left
+// right after what was read when done. a terminal is read a line at a time,
+// so that nothing is waited for before it's needed. a stream shared with
+// something else, like the source of a REPL, is never read past what's asked
+// for
+class Input {
+ public:
+	explicit Input(std::istream& stream, bool shared = false);
+	~Input();
+
+	Input(const Input&) = delete;
+	Input& operator=(const Input&) = delete;
+
+	// the next line without its newline, or nothing at the end of the input.
+	// it's only valid until the next read
+	std::optional<std::string_view> line();
+
+	// the next character that isn't whitespace, or nothing at the end of the
+	// input
+	std::optional<char> non_space();
+
+	// the integer at the start of a line, after any whitespace, like stoi.
+	// nothing if there's none, or if it doesn't fit an int
+	static std::optional<int> parse_integer(std::string_view line);
+
+	static constexpr std::size_t capacity = 1 << 16;
+
+ private:
+	// reads more after what's left to read. false at the end of the input
+	bool refill();
+
+	// maps stdin if it's a regular file
+	void map_stdin();
+
+	std::istream& m_stream;
+	bool m_shared;
+	bool m_interactive;
+
+	// the last line read from a shared stream
+	std::string m_line {};
+
+	// what's left to read, in the buffer or in the mapped file
+	const char* m_pos {nullptr};
+	const char* m_end {nullptr};
+
+	std::vector<char> m_buffer {};
+	bool m_at_eof {false};
+
+	const char* m_map {nullptr};
+	std::size_t m_map_size {0};
+};
+
+#endif
@@ -1,8 +1,16 @@
 #include "lir.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <limits>
 #include <ostream>
 #include <stdexcept>
+#include <string>
+#include <utility>
 
 namespace lir {
 
@@ -16,6 +24,8 @@ static int print_inst_indirect(FILE* fd, const Instruction& inst);
 static std::ostream& print_inst_indirect(
 	std::ostream& st, const Instruction& inst
 );
+static std::string escape_string(const std::string& str);
+static bool is_indirect(Opcode op);
 
 std::ostream& operator<<(std::ostream& st, const Operand& opnd) {
 	switch (opnd.type) {
@@ -27,6 +37,8 @@ std::ostream& operator<<(std::ostream& st, const Operand& opnd) {
 		case Operand::Type::IMMEDIATE:
 			return st << std::format("{}", opnd.as_immediate().number);
 		case Operand::Type::FUN: assert(false && "unreachable");
+		case Operand::Type::STRING:
+			return st << std::format("S{:03}", opnd.as_string().id);
 	}
 	return st;
 }
@@ -41,6 +53,11 @@ Chunk& Chunk::with_comment(std::string comment) {
 	return *this;
 }
 
+Chunk& Chunk::with_integer(bool integer) {
+	m_vec.back().integer = integer;
+	return *this;
+}
+
 Chunk& Chunk::add_label(Operand label) {
 	label_indexes[label.as_label().id] = m_vec.size();
 	return *this;
@@ -82,10 +99,70 @@ size_t opcode_opnd_count(Opcode op) {
 		case Opcode::SHIFTA: return 3;
 		case Opcode::CLONEA: return 2;
 		case Opcode::NOP: return 0;
+		case Opcode::JMP_EQ:
+		case Opcode::JMP_DIFF:
+		case Opcode::JMP_LESS:
+		case Opcode::JMP_LESS_EQ:
+		case Opcode::JMP_GREATER:
+		case Opcode::JMP_GREATER_EQ: return 3;
+		case Opcode::ADDA:
+		case Opcode::SUBA: return 3;
+		case Opcode::LOADA_U:
+		case Opcode::STOREA_U:
+		case Opcode::SHIFTA_U: return 3;
+		case Opcode::ADD_I:
+		case Opcode::SUB_I:
+		case Opcode::MUL_I:
+		case Opcode::EQ_I:
+		case Opcode::DIFF_I:
+		case Opcode::LESS_I:
+		case Opcode::LESS_EQ_I:
+		case Opcode::GREATER_I:
+		case Opcode::GREATER_EQ_I:
+		case Opcode::JMP_EQ_I:
+		case Opcode::JMP_DIFF_I:
+		case Opcode::JMP_LESS_I:
+		case Opcode::JMP_LESS_EQ_I:
+		case Opcode::JMP_GREATER_I:
+		case Opcode::JMP_GREATER_EQ_I: return 3;
 	}
 	assert(false);
 };
 
+std::optional<int> fold(Opcode op, int left, int right) {
+	// same width as the integers of the VM, so that overflow is caught below
+	const std::int64_t a = left;
+	const std::int64_t b = right;
+	std::int64_t value;
+	switch (op) {
+		case Opcode::ADD: value = a + b; break;
+		case Opcode::SUB: value = a - b; break;
+		case Opcode::MUL: value = a * b; break;
+		case Opcode::DIV:
+			if (b == 0) return {};
+			value = a / b;
+			break;
+		case Opcode::MOD:
+			if (b == 0) return {};
+			value = a % b;
+			break;
+		case Opcode::NOT: value = !a; break;
+		case Opcode::OR: value = a || b; break;
+		case Opcode::AND: value = a && b; break;
+		case Opcode::EQ: value = a == b; break;
+		case Opcode::DIFF: value = a != b; break;
+		case Opcode::LESS: value = a < b; break;
+		case Opcode::LESS_EQ: value = a <= b; break;
+		case Opcode::GREATER: value = a > b; break;
+		case Opcode::GREATER_EQ: value = a >= b; break;
+		default: return {};
+	}
+	if (value < std::numeric_limits<int>::min()
+	    or value > std::numeric_limits<int>::max())
+		return {};
+	return (int)value;
+}
+
 void print_chunk(FILE* fd, const Chunk& chunk) {
 	int max = 0;
 	int printed = 0;
@@ -105,6 +182,10 @@ void print_chunk(FILE* fd, const Chunk& chunk) {
 	}
 	for (auto l : chunk.label_indexes)
 		if (l.second == i) fprintf(fd, "L%03zu:\n", l.first);
+	for (size_t id = 0; id < chunk.strings.size(); id++)
+		fprintf(
+			fd, "S%03zu: \"%s\"\n", id, escape_string(chunk.strings[id]).c_str()
+		);
 }
 
 std::ostream& operator<<(std::ostream& st, const Chunk& chunk) {
@@ -126,6 +207,10 @@ std::ostream& operator<<(std::ostream& st, const Chunk& chunk) {
 	}
 	for (auto l : chunk.label_indexes)
 		if (l.second == i) st << std::format("L%03zu:\n", l.first);
+	for (size_t id = 0; id < chunk.strings.size(); id++)
+		st << std::format(
+			"S{:03}: \"{}\"\n", id, escape_string(chunk.strings[id])
+		);
 	return st;
 }
 
@@ -145,10 +230,30 @@ int print_operand(FILE* fd, Operand opnd) {
 		case Operand::Type::IMMEDIATE:
 			return fprintf(fd, "%d", opnd.as_immediate().number);
 		case Operand::Type::FUN: assert(false && "unreachable");
+		case Operand::Type::STRING:
+			return fprintf(fd, "S%03zu", opnd.as_string().id);
 	}
 	return 0;
 }
 
+std::string escape_string(const std::string& str) {
+	std::string res {};
+	for (char c : str) {
+		switch (c) {
+			case '\n': res += "\\n"; break;
+			case '\t': res += "\\t"; break;
+			case '"': res += "\\\""; break;
+			case '\\': res += "\\\\"; break;
+			default:
+				if (isprint((unsigned char)c))
+					res += c;
+				else
+					res += std::format("\\x{:02x}", (unsigned char)c);
+		}
+	}
+	return res;
+}
+
 // return textual representation of opcode
 const char* opcode_repr(Opcode op) {
 	switch (op) {
@@ -186,6 +291,32 @@ const char* opcode_repr(Opcode op) {
 		case Opcode::SHIFTA: return "shifta";
 		case Opcode::CLONEA: return "clonea";
 		case Opcode::NOP: return "nop";
+		case Opcode::JMP_EQ: return "jequal";
+		case Opcode::JMP_DIFF: return "jdiff";
+		case Opcode::JMP_LESS: return "jless";
+		case Opcode::JMP_LESS_EQ: return "jlesseq";
+		case Opcode::JMP_GREATER: return "jgreater";
+		case Opcode::JMP_GREATER_EQ: return "jgreatereq";
+		case Opcode::ADDA: return "adda";
+		case Opcode::SUBA: return "suba";
+		case Opcode::LOADA_U: return "loadau";
+		case Opcode::STOREA_U: return "storeau";
+		case Opcode::SHIFTA_U: return "shiftau";
+		case Opcode::ADD_I: return "addi";
+		case Opcode::SUB_I: return "subi";
+		case Opcode::MUL_I: return "muli";
+		case Opcode::EQ_I: return "equali";
+		case Opcode::DIFF_I: return "diffi";
+		case Opcode::LESS_I: return "lessi";
+		case Opcode::LESS_EQ_I: return "lesseqi";
+		case Opcode::GREATER_I: return "greateri";
+		case Opcode::GREATER_EQ_I: return "greatereqi";
+		case Opcode::JMP_EQ_I: return "jequali";
+		case Opcode::JMP_DIFF_I: return "jdiffi";
+		case Opcode::JMP_LESS_I: return "jlessi";
+		case Opcode::JMP_LESS_EQ_I: return "jlesseqi";
+		case Opcode::JMP_GREATER_I: return "jgreateri";
+		case Opcode::JMP_GREATER_EQ_I: return "jgreatereqi";
 	}
 	assert(false);
 }
@@ -228,6 +359,12 @@ static std::ostream& print_operand_indirect(std::ostream& st, Operand opnd) {
 	return st;
 }
 
+bool is_indirect(Opcode op) {
+	return op == Opcode::LOADA or op == Opcode::STOREA or op == Opcode::SHIFTA
+	    or op == Opcode::ADDA or op == Opcode::SUBA or op == Opcode::LOADA_U
+	    or op == Opcode::STOREA_U or op == Opcode::SHIFTA_U;
+}
+
 // print an indirect memory access instruction (OP_STORE or OP_LOAD), where
 // the base and offset operands are printed differently depending on their
 // contents.
@@ -259,8 +396,7 @@ std::ostream& print_inst_indirect(std::ostream& st, const Instruction& inst) {
 }
 
 int print_inst(FILE* fd, const Instruction& inst) {
-	if (inst.opcode == Opcode::LOADA || inst.opcode == Opcode::STOREA
-	    || inst.opcode == Opcode::SHIFTA) {
+	if (is_indirect(inst.opcode)) {
 		return print_inst_indirect(fd, inst);
 	} else {
 		constexpr const char* separators[3] = {" ", ", ", ", "};
@@ -276,8 +412,7 @@ int print_inst(FILE* fd, const Instruction& inst) {
 }
 
 std::ostream& operator<<(std::ostream& st, const Instruction& inst) {
-	if (inst.opcode == Opcode::LOADA || inst.opcode == Opcode::STOREA
-	    || inst.opcode == Opcode::SHIFTA) {
+	if (is_indirect(inst.opcode)) {
 		print_inst_indirect(st, inst);
 	} else {
 		constexpr const char* separators[3] = {" ", ", ", ", "};
@@ -291,20 +426,66 @@ std::ostream& operator<<(std::ostream& st, const Instruction& inst) {
 	return st;
 }
 
-Chunk operator+(Chunk x, Chunk y) {
-	Chunk res {};
+Chunk& Chunk::append(Chunk&& other) {
+	auto offset = m_vec.size();
+	if (m_vec.empty()) {
+		m_vec = std::move(other.m_vec);
+	} else {
+		m_vec.insert(
+			m_vec.end(),
+			std::make_move_iterator(other.m_vec.begin()),
+			std::make_move_iterator(other.m_vec.end())
+		);
+	}
+	other.m_vec.clear();
+
+	// ids are mostly increasing, which makes the end the best insertion hint
+	for (const auto& [id, index] : other.label_indexes)
+		label_indexes.insert_or_assign(label_indexes.end(), id, index + offset);
+	other.label_indexes.clear();
 
-	for (auto inst : x.m_vec) res.m_vec.push_back(inst);
-	for (auto inst : y.m_vec) res.m_vec.push_back(inst);
+	result_opnd = std::move(other.result_opnd);
+	return *this;
+}
 
-	for (auto p : x.label_indexes) res.label_indexes[p.first] = p.second;
+Chunk operator+(Chunk x, Chunk y) {
+	x.append(std::move(y));
+	return x;
+}
 
-	for (auto p : y.label_indexes)
-		res.label_indexes[p.first] = p.second + x.m_vec.size();
+std::vector<size_t> resolve_labels(const Chunk& chunk) {
+	size_t max_id = 0;
+	for (const auto& inst : chunk.m_vec)
+		for (const auto& opnd : inst.operands)
+			if (opnd.type == Operand::Type::LABEL)
+				max_id = std::max(max_id, opnd.as_label().id + 1);
+	for (const auto& [id, index] : chunk.label_indexes)
+		max_id = std::max(max_id, id + 1);
+
+	std::vector<size_t> table(max_id, unresolved_label);
+	for (const auto& [id, index] : chunk.label_indexes) table[id] = index;
+	return table;
+}
 
-	res.result_opnd = y.result_opnd;
+void link(Chunk& chunk) {
+	const auto table = resolve_labels(chunk);
+
+	for (auto& inst : chunk.m_vec)
+		for (auto& opnd : inst.operands) {
+			if (opnd.type != Operand::Type::LABEL) continue;
+			auto& label = opnd.as_label();
+			if (table[label.id] == unresolved_label)
+				throw std::runtime_error(
+					std::format("undefined label L{:03}", label.id)
+				);
+			label.id = table[label.id];
+		}
 
-	return res;
+	// every label is now named after the instruction it marks
+	std::map<size_t, size_t> label_indexes {};
+	for (const auto& [id, index] : chunk.label_indexes)
+		label_indexes[index] = index;
+	chunk.label_indexes = std::move(label_indexes);
 }
 
 const char* operand_type_repr(Operand::Type type) {
@@ -314,6 +495,7 @@ const char* operand_type_repr(Operand::Type type) {
 		case Operand::Type::LABEL: return "Operand::Type::LAB";
 		case Operand::Type::IMMEDIATE: return "Operand::Type::NUM";
 		case Operand::Type::FUN: return "Operand::Type::FUN";
+		case Operand::Type::STRING: return "Operand::Type::STR";
 	}
 	assert(false);
 }
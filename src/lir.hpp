@@ -51,6 +51,46 @@ enum class Opcode {
 	STOREA,
 	SHIFTA,
 	CLONEA,
+
+	// superinstructions, formed from the instructions above by
+	// passes::select_superinstructions
+
+	// compare the first two operands and jump if the comparison holds
+	JMP_EQ,
+	JMP_DIFF,
+	JMP_LESS,
+	JMP_LESS_EQ,
+	JMP_GREATER,
+	JMP_GREATER_EQ,
+
+	// add or subtract the value to a cell, in place
+	ADDA,
+	SUBA,
+
+	// accesses whose offset is known to be within the array, which skip the
+	// bounds and type checks. made by passes::eliminate_bounds_checks
+	LOADA_U,
+	STOREA_U,
+	SHIFTA_U,
+
+	// arithmetic, comparisons and compare and jumps whose operands are known
+	// to be integers, which skip the type checks. made by
+	// passes::specialize_types
+	ADD_I,
+	SUB_I,
+	MUL_I,
+	EQ_I,
+	DIFF_I,
+	LESS_I,
+	LESS_EQ_I,
+	GREATER_I,
+	GREATER_EQ_I,
+	JMP_EQ_I,
+	JMP_DIFF_I,
+	JMP_LESS_I,
+	JMP_LESS_EQ_I,
+	JMP_GREATER_I,
+	JMP_GREATER_EQ_I,
 };
 
 class Type;
@@ -97,6 +137,11 @@ struct Immediate {
 	int number;
 };
 
+// index into the string segment of the chunk
+struct String {
+	size_t id;
+};
+
 struct Operand {
 	enum class Type {
 		NOTHING,   // no operand
@@ -104,23 +149,27 @@ struct Operand {
 		LABEL,     // label
 		IMMEDIATE, // immediate number
 		FUN,
+		STRING, // pointer to a string constant
 	};
 
 	Type type;
-	std::variant<Register, Label, Immediate, Function> data;
+	std::variant<Register, Label, Immediate, Function, String> data;
 
 	Operand() : type {Type::NOTHING}, data {Immediate {0}} {}
 	explicit Operand(Register reg) : type(Type::REGISTER), data {reg} {}
 	explicit Operand(Label lab) : type(Type::LABEL), data {lab} {}
 	explicit Operand(Function fun) : type(Type::FUN), data {fun} {}
+	explicit Operand(String str) : type(Type::STRING), data {str} {}
 
 	Label& as_label() { return std::get<Label>(data); }
 	Register& as_register() { return std::get<Register>(data); }
 	Immediate& as_immediate() { return std::get<Immediate>(data); }
+	String& as_string() { return std::get<String>(data); }
 
 	const Label& as_label() const { return std::get<Label>(data); }
 	const Register& as_register() const { return std::get<Register>(data); }
 	const Immediate& as_immediate() const { return std::get<Immediate>(data); }
+	const String& as_string() const { return std::get<String>(data); }
 
 	static auto make_immediate_integer(int integer) -> Operand;
 };
@@ -130,18 +179,34 @@ struct Instruction {
 	Opcode opcode;
 	Operand operands[max_operands];
 	std::string comment;
+	// the value written is an integer, as the typechecker found for the
+	// expression it was compiled from
+	bool integer {false};
+	// where in the source the instruction was compiled from, if anywhere
+	std::optional<Location> location {};
 };
 
 struct Chunk {
 	Chunk& emit(Opcode, Operand fst = {}, Operand snd = {}, Operand trd = {});
 	Chunk& with_comment(std::string comment);
+	// mark the last instruction as writing an integer
+	Chunk& with_integer(bool integer = true);
 	Chunk& add_label(Operand label);
 
+	// move the instructions of other to the end of this chunk, shifting its
+	// labels. the result operand becomes the one of other. it's linear in the
+	// size of other only, so chunks should be built by appending to them
+	Chunk& append(Chunk&& other);
+
 	std::vector<Instruction> m_vec;
 	std::map<size_t, size_t> label_indexes;
 
 	std::optional<Operand> result_opnd;
 
+	// contents of the string constants, indexed by the id of STRING operands.
+	// it's only filled in the complete chunk, and isn't carried over by +
+	std::vector<std::string> strings;
+
 	Chunk& emit_binop(
 		BinaryOperator binop, Operand result, Operand left, Operand right
 	);
@@ -158,13 +223,32 @@ struct Chunk {
 // return amount of operands of each opcode
 size_t opcode_opnd_count(Opcode op);
 
+// result of an arithmetic, logic or comparison opcode over immediates, the
+// same the VM computes. nothing when the VM would fail, like when dividing by
+// zero, or when the result doesn't fit an immediate. NOT only uses left
+std::optional<int> fold(Opcode op, int left, int right = 0);
+
 void print_chunk(FILE*, const Chunk&);
 int print_inst(FILE*, const Instruction& inst);
 
 std::ostream& operator<<(std::ostream&, const Chunk&);
 
+// concatenation of both chunks. x and y are taken by value, so pass
+// temporaries or use Chunk::append to avoid copying them
 Chunk operator+(Chunk x, Chunk y);
 
+// marks labels that were referenced but never added to the chunk
+constexpr size_t unresolved_label = (size_t)-1;
+
+// table from label id to the index of the instruction it marks, so that
+// labels can be resolved by indexing instead of searching label_indexes
+std::vector<size_t> resolve_labels(const Chunk& chunk);
+
+// rewrite every label operand into the index of the instruction it points
+// to. should be done only on complete chunks, as appending to a linked chunk
+// mixes instruction indices with label ids
+void link(Chunk& chunk);
+
 const char* operand_type_repr(Operand::Type type);
 
 } // namespace lir
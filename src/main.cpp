@@ -1,7 +1,11 @@
 #include <exception>
+#include <format>
+#include <fstream>
+#include <string>
 #include <utility>
 
 #include "ast.hpp"
+#include "bytecode.hpp"
 #include "compiler.hpp"
 #include "file.hpp"
 #include "file_reader.hpp"
@@ -11,6 +15,7 @@
 #include "logger.hpp"
 #include "options.hpp"
 #include "parser.hpp"
+#include "passes.hpp"
 #include "str_pool.h"
 #include "typecheck.hpp"
 #include "vm.hpp"
@@ -39,6 +44,9 @@ void usage() {
 		", hir"
 #endif
 		"\n"
+		"\t-p          profile the program run by the lir backend. a report goes\n"
+		"\t            to stderr, and a JSON summary to <path> if -o is given.\n"
+		"\t            also --profile\n"
 		"\n"
 		"Modes:\n"
 		"\t-c          compile\n"
@@ -46,10 +54,78 @@ void usage() {
 	);
 }
 
-void print_phase(const Options& opts, std::string phase) {
+void print_info(const Options& opts, std::string message) {
 	if (opts.verbosity >= 1)
 		std::cerr << ANSI_COLOR_YELLOW << "INFO" << ANSI_COLOR_RESET << ": "
-							<< phase << "..." << '\n';
+							<< message << '\n';
+}
+
+void print_phase(const Options& opts, std::string phase) {
+	print_info(opts, phase + "...");
+}
+
+void print_allocation(const Options& opts, const passes::AllocationReport& r) {
+	print_info(
+		opts, std::format("registers: {} renumbered into {}", r.before, r.after)
+	);
+}
+
+void print_report(const Options& opts, const passes::Report& report) {
+	print_info(opts, std::format("promoted {} variables", report.promoted));
+	const auto& propagation = report.propagation;
+	print_info(
+		opts,
+		std::format(
+			"constants: propagated {} reads, folded {} instructions, {} branches, "
+			"dropped {} blocks",
+			propagation.propagated,
+			propagation.folded,
+			propagation.branches,
+			propagation.unreachable
+		)
+	);
+	print_info(
+		opts,
+		std::format(
+			"licm: hoisted {} instructions out of {} loops",
+			report.hoist.hoisted,
+			report.hoist.loops
+		)
+	);
+	const auto& peephole = report.peephole;
+	print_info(
+		opts,
+		std::format(
+			"peephole: removed {} instructions", peephole.total_removed()
+		)
+	);
+	for (size_t i = 0; i < passes::pattern_count; i++) {
+		if (peephole.applied[i] == 0) continue;
+		print_info(
+			opts,
+			std::format(
+				"  {}: applied {} times, removed {} instructions",
+				passes::pattern_name((passes::Pattern)i),
+				peephole.applied[i],
+				peephole.removed[i]
+			)
+		);
+	}
+}
+
+void print_profile(const Options& opts, const lir::Profile& profile) {
+	profile.report(std::cerr);
+	if (opts.output_path == nullptr) {
+		std::cerr << '\n';
+		profile.write_json(std::cerr);
+		return;
+	}
+	std::ofstream json {opts.output_path};
+	if (not json) {
+		std::cerr << "Couldn't open " << opts.output_path << '\n';
+		return;
+	}
+	profile.write_json(json);
 }
 
 int interpret(Options opts) {
@@ -58,6 +134,7 @@ int interpret(Options opts) {
 	             : static_cast<Reader*>(new FileReader(opts.argv[0], "r"));
 
 	StringPool pool;
+	int status = 0;
 
 	while (!fd->at_eof()) {
 		print_phase(opts, "parsing");
@@ -74,38 +151,104 @@ int interpret(Options opts) {
 		checker.typecheck();
 
 		if (opts.backend == Backend::WALK) {
+			if (opts.profile)
+				std::cerr << "Only the lir backend can be profiled" << '\n';
 			print_phase(opts, "interpreting(walk)");
-			walk::Interpreter inter {pool, ast, std::cin, std::cout};
+			walk::Interpreter inter {
+				pool, ast, std::cin, std::cout, opts.from_stdin
+			};
 			auto val = inter.eval();
 			if (opts.from_stdin) {
 				std::cout << val;
 				printf("\n");
 			}
 		} else if (opts.backend == Backend::LIR) {
-			print_phase(opts, "compiling(lir)");
-			compiler::Compiler comp {ast, pool, checker};
-			auto chunk = comp.compile();
-
-			if (opts.verbosity >= 2) {
-				lir::print_chunk(stdout, chunk);
-				printf("\n");
-			}
-
-			print_phase(opts, "interpreting(lir)");
-			lir::VM vm {std::cin, std::cout};
+			lir::VM vm {std::cin, std::cout, opts.from_stdin};
 			vm.should_print_result = opts.from_stdin or opts.verbosity >= 2;
+			vm.should_profile = opts.profile;
 			try {
-				vm.run(chunk);
+				print_phase(opts, "compiling(lir)");
+				compiler::Compiler comp {ast, pool, checker};
+				auto chunk = comp.compile();
+				print_info(opts, std::format("inlined {} calls", comp.inlined));
+				print_info(
+					opts, std::format("eliminated {} tail calls", comp.tail_calls)
+				);
+
+				print_phase(opts, "optimizing(lir)");
+				print_report(opts, passes::optimize(chunk));
+				auto selected = passes::select_superinstructions(chunk);
+				print_info(
+					opts,
+					std::format(
+						"superinstructions: {} compare and jump, {} array updates",
+						selected.compare_jumps,
+						selected.array_updates
+					)
+				);
+				auto bounds = passes::eliminate_bounds_checks(chunk);
+				print_info(
+					opts,
+					std::format(
+						"bounds checks: removed {} of {}", bounds.unchecked, bounds.accesses
+					)
+				);
+				auto types = passes::specialize_types(chunk);
+				print_info(
+					opts,
+					std::format(
+						"types: {} of {} operations on integers only",
+						types.specialized,
+						types.operations
+					)
+				);
+				print_allocation(opts, passes::allocate_registers(chunk));
+				if (auto unproven = passes::verify_types(chunk); unproven > 0)
+					throw std::runtime_error(std::format(
+						"{} integer instructions may read other values", unproven
+					));
+
+				if (opts.verbosity >= 2) {
+					lir::print_chunk(stdout, chunk);
+					printf("\n");
+				}
+
+				print_phase(opts, "interpreting(lir)");
+				vm.run(bytecode::lower(std::move(chunk)));
 			} catch (std::exception& exn) {
+				vm.output.flush();
 				std::cerr << "ERROR: " << exn.what() << '\n';
+				status = 1;
 			}
+			if (opts.profile) print_profile(opts, vm.profile);
+
+			auto stats = vm.heap.stats();
+			print_info(
+				opts,
+				std::format(
+					"heap: {} bytes in use, {} bytes peak, {} bytes reserved",
+					stats.current,
+					stats.peak,
+					stats.reserved
+				)
+			);
+			print_info(
+				opts,
+				std::format(
+					"gc: {} collections freed {} bytes, {}us paused, {}us longest",
+					stats.collections,
+					stats.collected,
+					stats.pause.count() / 1000,
+					stats.longest_pause.count() / 1000
+				)
+			);
 		} else {
 			std::cerr << "Backend can't be used for interpreting" << '\n';
 			return 1;
 		}
 	}
 
-	return 0;
+	return status;
 }
 
 int compile(Options opts) {
@@ -133,6 +276,13 @@ int compile(Options opts) {
 		print_phase(opts, "compiling(lir)");
 		compiler::Compiler comp {ast, pool, checker};
 		auto chunk = comp.compile();
+		print_info(opts, std::format("inlined {} calls", comp.inlined));
+		print_info(opts, std::format("eliminated {} tail calls", comp.tail_calls));
+
+		print_phase(opts, "optimizing(lir)");
+		print_report(opts, passes::optimize(chunk));
+		passes::materialize_strings(chunk);
+		print_allocation(opts, passes::allocate_registers(chunk));
 
 		File output = (opts.output_path) ? File(opts.output_path, "w") : stdout;
 
@@ -171,7 +321,7 @@ int main(int argc, char* argv[]) {
 	if (opts.compile)
 		compile(opts);
 	else if (opts.interpret)
-		interpret(opts);
+		return interpret(opts);
 	else
 		std::unreachable();
 
@@ -59,9 +59,17 @@ int getopt(int argc, char** argv, const char* opts_) {
 Options parse_args(int argc, char* argv[]) {
 	Options opts {};
 
-	for (char c = 0; (c = (char)getopt(argc, argv, "Vo:cib:")) != -1;)
+	// --profile is the long spelling of -p
+	static char profile_option[] = "-p";
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--") == 0) break;
+		if (strcmp(argv[i], "--profile") == 0) argv[i] = profile_option;
+	}
+
+	for (char c = 0; (c = (char)getopt(argc, argv, "Vo:cipb:")) != -1;)
 		switch (c) {
 			case 'V': opts.verbosity += 1; break;
+			case 'p': opts.profile = true; break;
 			case 'o': opts.output_path = optarg; break;
 			case 'c': opts.compile = true; break;
 			case 'i': opts.interpret = true; break;
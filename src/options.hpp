@@ -17,6 +17,7 @@ struct Options {
 	char* output_path {nullptr};
 	bool compile {false};
 	bool interpret {false};
+	bool profile {false};
 	char** argv {nullptr};
 	int argc {0};
 };
@@ -0,0 +1,70 @@
+#include "output.hpp"
+
+#include <unistd.h>
+
+#include <cassert>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+// head of the list of every output alive
+static Output* live = nullptr;
+
+void Output::flush_live() {
+	for (auto* out = live; out != nullptr; out = out->m_next) out->flush();
+}
+
+Output::Output(std::ostream& stream)
+: m_stream {stream},
+  m_interactive {&stream == &std::cout and isatty(STDOUT_FILENO)},
+  m_buffer {std::make_unique_for_overwrite<char[]>(capacity)} {
+	static const bool registered = std::atexit(flush_live) == 0;
+	(void)registered;
+	m_next = live;
+	if (live != nullptr) live->m_prev = this;
+	live = this;
+}
+
+Output::~Output() {
+	flush();
+	if (m_prev != nullptr) m_prev->m_next = m_next;
+	if (m_next != nullptr) m_next->m_prev = m_prev;
+	if (live == this) live = m_next;
+}
+
+void Output::write(std::int64_t integer) {
+	// the longest is the minimum, 19 digits and a sign
+	constexpr std::size_t longest = 20;
+	if (capacity - m_used < longest) drain();
+	auto* begin = m_buffer.get() + m_used;
+	auto [end, error] = std::to_chars(begin, begin + longest, integer);
+	assert(error == std::errc {});
+	m_used = (std::size_t)(end - m_buffer.get());
+}
+
+void Output::write(std::string_view text) {
+	if (text.size() > capacity - m_used) {
+		drain();
+		if (text.size() > capacity) {
+			m_stream.write(text.data(), (std::streamsize)text.size());
+			if (m_interactive) m_stream.flush();
+			return;
+		}
+	}
+	std::memcpy(m_buffer.get() + m_used, text.data(), text.size());
+	m_used += text.size();
+	if (m_interactive and text.find('\n') != std::string_view::npos) flush();
+}
+
+void Output::flush() {
+	drain();
+	m_stream.flush();
+}
+
+void Output::drain() {
+	if (m_used == 0) return;
+	m_stream.write(m_buffer.get(), (std::streamsize)m_used);
+	m_used = 0;
+}
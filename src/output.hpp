@@ -0,0 +1,60 @@
+// Buffered output of the interpreters
+
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string_view>
+
+// collects what a program writes in a big block, handed to the stream when
+// it fills up, when the program ends or exits, and before reading input when
+// the stream is a terminal. a terminal also gets every line as it ends
+class Output {
+ public:
+	explicit Output(std::ostream& stream);
+	~Output();
+
+	Output(const Output&) = delete;
+	Output& operator=(const Output&) = delete;
+
+	void put(char c) {
+		if (m_used == capacity) [[unlikely]]
+			drain();
+		m_buffer[m_used++] = c;
+		if (c == '\n' and m_interactive) flush();
+	}
+
+	void write(std::int64_t integer);
+	void write(std::string_view text);
+
+	// hands everything written so far to the stream
+	void flush();
+
+	// before reading input, so that a prompt is seen before it's answered
+	void flush_for_input() {
+		if (m_interactive) flush();
+	}
+
+	static constexpr std::size_t capacity = 1 << 16;
+
+ private:
+	// hands the buffer to the stream without flushing the stream itself
+	void drain();
+
+	// when the program exits
+	static void flush_live();
+
+	std::ostream& m_stream;
+	bool m_interactive;
+	std::unique_ptr<char[]> m_buffer;
+	std::size_t m_used {0};
+
+	// every output alive, flushed if the program exits before they're gone
+	Output* m_next {nullptr};
+	Output* m_prev {nullptr};
+};
+
+#endif
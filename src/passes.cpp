@@ -0,0 +1,161 @@
+#include "passes.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "lir.hpp"
+
+namespace passes {
+
+Report optimize(lir::Chunk& chunk) {
+	Report report {};
+	report.promoted = promote_scalars(chunk);
+	remove_nops(chunk);
+	report.propagation = propagate_constants(chunk);
+	report.hoist = hoist_invariants(chunk);
+	report.peephole = peephole(chunk);
+	return report;
+}
+
+bool defines(lir::Opcode op) {
+	using lir::Opcode;
+	switch (op) {
+		case Opcode::READV:
+		case Opcode::READC:
+		case Opcode::MOV:
+		case Opcode::ADD:
+		case Opcode::SUB:
+		case Opcode::MUL:
+		case Opcode::DIV:
+		case Opcode::MOD:
+		case Opcode::NOT:
+		case Opcode::OR:
+		case Opcode::AND:
+		case Opcode::EQ:
+		case Opcode::DIFF:
+		case Opcode::LESS:
+		case Opcode::LESS_EQ:
+		case Opcode::GREATER:
+		case Opcode::GREATER_EQ:
+		case Opcode::POP:
+		case Opcode::ALLOCA:
+		case Opcode::LOADA:
+		case Opcode::SHIFTA:
+		case Opcode::CLONEA:
+		case Opcode::LOADA_U:
+		case Opcode::SHIFTA_U:
+		case Opcode::ADD_I:
+		case Opcode::SUB_I:
+		case Opcode::MUL_I:
+		case Opcode::EQ_I:
+		case Opcode::DIFF_I:
+		case Opcode::LESS_I:
+		case Opcode::LESS_EQ_I:
+		case Opcode::GREATER_I:
+		case Opcode::GREATER_EQ_I: return true;
+		default: return false;
+	}
+}
+
+bool same_operand(const lir::Operand& a, const lir::Operand& b) {
+	using lir::Operand;
+	if (a.type != b.type) return false;
+	switch (a.type) {
+		case Operand::Type::REGISTER:
+			return a.as_register().index == b.as_register().index;
+		case Operand::Type::IMMEDIATE:
+			return a.as_immediate().number == b.as_immediate().number;
+		default: return false;
+	}
+}
+
+RegisterCounts::RegisterCounts(const lir::Chunk& chunk) {
+	auto count = [](std::vector<size_t>& counts, const lir::Operand& opnd) {
+		if (opnd.type != lir::Operand::Type::REGISTER) return;
+		auto index = opnd.as_register().index;
+		if (index >= counts.size()) counts.resize(index + 1, 0);
+		counts[index]++;
+	};
+	for (const auto& inst : chunk.m_vec)
+		for (size_t i = 0; i < lir::Instruction::max_operands; i++)
+			count(i == 0 and defines(inst.opcode) ? defs : uses, inst.operands[i]);
+	if (chunk.result_opnd.has_value()) count(uses, chunk.result_opnd.value());
+}
+
+bool RegisterCounts::is_temporary(const lir::Operand& opnd) const {
+	if (opnd.type != lir::Operand::Type::REGISTER) return false;
+	auto index = opnd.as_register().index;
+	return index < defs.size() and index < uses.size() and defs[index] == 1
+	   and uses[index] == 1;
+}
+
+void remove_nops(lir::Chunk& chunk) {
+	// new index of every instruction, and of the end of the chunk
+	std::vector<size_t> moved(chunk.m_vec.size() + 1);
+	std::vector<lir::Instruction> kept {};
+	kept.reserve(chunk.m_vec.size());
+
+	for (size_t i = 0; i < chunk.m_vec.size(); i++) {
+		moved[i] = kept.size();
+		if (chunk.m_vec[i].opcode != lir::Opcode::NOP)
+			kept.push_back(std::move(chunk.m_vec[i]));
+	}
+	moved[chunk.m_vec.size()] = kept.size();
+
+	for (auto& [id, index] : chunk.label_indexes) index = moved[index];
+	chunk.m_vec = std::move(kept);
+}
+
+void materialize_strings(lir::Chunk& chunk) {
+	if (chunk.strings.empty()) return;
+
+	using lir::Operand;
+
+	size_t register_count = 0;
+	for (const auto& inst : chunk.m_vec)
+		for (const auto& opnd : inst.operands)
+			if (opnd.type == Operand::Type::REGISTER)
+				register_count =
+					std::max(register_count, opnd.as_register().index + 1);
+
+	lir::Chunk prologue {};
+	std::vector<Operand> registers {};
+	for (const auto& str : chunk.strings) {
+		auto reg =
+			Operand(lir::Register(register_count++, lir::Type::make_integer()));
+		auto size = Operand::make_immediate_integer((int)str.size());
+		prologue.emit_alloca(reg, size).with_comment("allocating string");
+		for (size_t i = 0; i < str.size(); i++)
+			prologue.emit_storea(
+				Operand::make_immediate_integer(str[i]),
+				Operand::make_immediate_integer((int)i),
+				reg
+			);
+		registers.push_back(reg);
+	}
+
+	auto replace = [&](Operand& opnd) {
+		if (opnd.type == Operand::Type::STRING)
+			opnd = registers[opnd.as_string().id];
+	};
+	for (auto& inst : chunk.m_vec)
+		for (auto& opnd : inst.operands) replace(opnd);
+	if (chunk.result_opnd.has_value()) replace(chunk.result_opnd.value());
+
+	// the strings are built once, so jumps to the start skip over them
+	auto shift = prologue.m_vec.size();
+	for (auto& [id, index] : chunk.label_indexes) index += shift;
+	prologue.m_vec.insert(
+		prologue.m_vec.end(),
+		std::make_move_iterator(chunk.m_vec.begin()),
+		std::make_move_iterator(chunk.m_vec.end())
+	);
+	chunk.m_vec = std::move(prologue.m_vec);
+	chunk.strings.clear();
+}
+
+} // namespace passes
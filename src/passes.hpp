@@ -0,0 +1,165 @@
+// Optimization passes over LIR
+
+#ifndef PASSES_HPP
+#define PASSES_HPP
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <vector>
+
+#include "lir.hpp"
+
+namespace passes {
+
+// rewrites done by the peephole pass, each over a pair of neighbouring
+// instructions
+enum class Pattern {
+	MOVE_CHAIN,       // a temporary that is only copied somewhere else
+	STORE_LOAD,       // a load of the cell that was just stored to
+	JUMP_NEXT,        // a jump to the following instruction
+	BRANCH_OVER_JUMP, // a conditional jump over an unconditional one
+	COMPARE_BRANCH,   // a branch on a comparison with zero
+	NOT_BRANCH,       // a branch on a negation
+};
+
+constexpr size_t pattern_count = (size_t)Pattern::NOT_BRANCH + 1;
+
+const char* pattern_name(Pattern pattern);
+
+struct PeepholeOptions {
+	std::bitset<pattern_count> enabled {std::bitset<pattern_count>().set()};
+};
+
+struct PeepholeReport {
+	// times each pattern was applied, and instructions it removed
+	std::array<size_t, pattern_count> applied {};
+	std::array<size_t, pattern_count> removed {};
+
+	size_t total_removed() const;
+};
+
+struct PropagationReport {
+	size_t propagated {0};  // reads of a register replaced by its constant
+	size_t folded {0};      // instructions computing a constant
+	size_t branches {0};    // branches on a constant
+	size_t unreachable {0}; // blocks dropped
+};
+
+struct HoistReport {
+	size_t hoisted {0}; // instructions moved out of loops
+	size_t loops {0};   // loops they were moved out of
+};
+
+// what the optimization pipeline did, for verbose output
+struct Report {
+	size_t promoted {0};
+	PropagationReport propagation {};
+	HoistReport hoist {};
+	PeepholeReport peephole {};
+};
+
+// run the optimization pipeline over a complete chunk
+Report optimize(lir::Chunk& chunk);
+
+// whether the first operand of the opcode is the register it writes to
+bool defines(lir::Opcode op);
+
+// whether both operands are the same register or the same immediate
+bool same_operand(const lir::Operand& a, const lir::Operand& b);
+
+// how many times each register is written and read in a chunk. the result
+// operand counts as a read
+struct RegisterCounts {
+	explicit RegisterCounts(const lir::Chunk& chunk);
+
+	// written and read exactly once, so that it can be dropped once its only
+	// read is rewritten
+	bool is_temporary(const lir::Operand& opnd) const;
+
+	std::vector<size_t> defs {};
+	std::vector<size_t> uses {};
+};
+
+// keep variables whose box never escapes in plain registers. the ALLOCA of
+// such a box is dropped and its loads and stores become moves. returns the
+// amount of promoted boxes
+size_t promote_scalars(lir::Chunk& chunk);
+
+// find the registers holding the same constant on every path reaching an
+// instruction, only following branches that can be taken. their reads become
+// immediates, branches on them jumps and code that can't be reached is
+// dropped
+PropagationReport propagate_constants(lir::Chunk& chunk);
+
+// move instructions computing the same value on every iteration of a loop
+// to right before it, inner loops first
+HoistReport hoist_invariants(lir::Chunk& chunk);
+
+// drop NOP instructions, moving their labels to the following instruction
+void remove_nops(lir::Chunk& chunk);
+
+// apply the enabled patterns until none of them matches anymore. labels are
+// kept on the instructions they marked, or moved to the following one when
+// their instruction is removed
+PeepholeReport peephole(lir::Chunk& chunk, const PeepholeOptions& options = {});
+
+struct SelectionReport {
+	size_t shared_addresses {0};
+	size_t compare_jumps {0};
+	size_t array_updates {0};
+};
+
+// fuse comparisons followed by a branch into compare-and-jump instructions,
+// and loads followed by an addition and a store to the same cell into
+// in-place updates. the superinstructions only exist in the VM, so this is
+// done only for chunks that are going to be interpreted
+SelectionReport select_superinstructions(lir::Chunk& chunk);
+
+struct BoundsReport {
+	size_t accesses {0};  // array accesses in reachable code
+	size_t unchecked {0}; // accesses made unchecked
+};
+
+// find the array accesses whose offset is always within the array, from the
+// range of integers registers may hold and the size arrays are allocated
+// with, and make them skip their checks. like the superinstructions, the
+// unchecked accesses only exist in the VM, so this is done after selecting
+// them
+BoundsReport eliminate_bounds_checks(lir::Chunk& chunk);
+
+struct SpecializationReport {
+	size_t operations {0};  // instructions with an integer variant
+	size_t specialized {0}; // instructions whose operands are known integers
+};
+
+// replace arithmetic, comparisons and compare and jumps whose operands are
+// integers on every path reaching them with their integer variants, which
+// skip the type checks. like the other VM only instructions, this is done
+// after selecting superinstructions
+SpecializationReport specialize_types(lir::Chunk& chunk);
+
+// amount of integer variants in the chunk whose operands aren't known to be
+// integers. a chunk is only safe to run when there's none
+size_t verify_types(const lir::Chunk& chunk);
+
+struct AllocationReport {
+	size_t before {0}; // registers referenced by the chunk
+	size_t after {0};
+};
+
+// renumber the registers of a complete chunk so that registers that are
+// never alive at the same time share an index. registers used by more than
+// one procedure or holding the result keep an index of their own. should be
+// the last pass, as it breaks the one register per value assumption of the
+// other ones
+AllocationReport allocate_registers(lir::Chunk& chunk);
+
+// replace the string segment with code that builds every string at the start
+// of the program, for targets that only know about registers and arrays.
+// each string gets a fresh register holding it, like before the segment
+void materialize_strings(lir::Chunk& chunk);
+
+} // namespace passes
+
+#endif
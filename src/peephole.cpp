@@ -0,0 +1,194 @@
+// Peephole optimization
+//
+// The compiler translates every node on its own, so the code has plenty of
+// temporaries that are copied right after being computed, stores followed by
+// loads of the same cell and jumps around nothing. Each pattern looks at a
+// pair of neighbouring instructions and rewrites them into fewer or cheaper
+// ones. Patterns that drop a temporary only do so when it's written and read
+// exactly once in the whole chunk, and never when a label sits between both
+// instructions, as control could reach the second one from elsewhere.
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "lir.hpp"
+#include "passes.hpp"
+
+namespace passes {
+
+using lir::Opcode;
+using lir::Operand;
+
+static bool is_branch(Opcode op);
+static Opcode invert_branch(Opcode op);
+
+bool is_branch(Opcode op) {
+	return op == Opcode::JMP_TRUE or op == Opcode::JMP_FALSE;
+}
+
+Opcode invert_branch(Opcode op) {
+	return op == Opcode::JMP_TRUE ? Opcode::JMP_FALSE : Opcode::JMP_TRUE;
+}
+
+const char* pattern_name(Pattern pattern) {
+	switch (pattern) {
+		case Pattern::MOVE_CHAIN: return "move chain";
+		case Pattern::STORE_LOAD: return "store then load";
+		case Pattern::JUMP_NEXT: return "jump to next";
+		case Pattern::BRANCH_OVER_JUMP: return "branch over jump";
+		case Pattern::COMPARE_BRANCH: return "compare with zero then branch";
+		case Pattern::NOT_BRANCH: return "not then branch";
+	}
+	return "";
+}
+
+size_t PeepholeReport::total_removed() const {
+	size_t total = 0;
+	for (auto count : removed) total += count;
+	return total;
+}
+
+PeepholeReport peephole(lir::Chunk& chunk, const PeepholeOptions& options) {
+	PeepholeReport report {};
+	auto& vec = chunk.m_vec;
+
+	for (bool changed = true; changed;) {
+		changed = false;
+
+		// the counts are taken once per sweep. a rewrite only ever makes them
+		// stale for the registers it touched, so both instructions of a rewrite
+		// are skipped until the next sweep
+		const RegisterCounts counts {chunk};
+
+		std::vector<bool> labeled(vec.size() + 1, false);
+		for (const auto& [id, index] : chunk.label_indexes) labeled[index] = true;
+		auto label_index = [&](const Operand& opnd) -> size_t {
+			auto it = chunk.label_indexes.find(opnd.as_label().id);
+			return it == chunk.label_indexes.end() ? lir::unresolved_label
+			                                       : it->second;
+		};
+
+		auto apply = [&](Pattern pattern, size_t removed) {
+			report.applied[(size_t)pattern]++;
+			report.removed[(size_t)pattern] += removed;
+			changed = true;
+		};
+		auto enabled = [&](Pattern pattern) {
+			return options.enabled[(size_t)pattern];
+		};
+
+		for (size_t i = 0; i < vec.size(); i++) {
+			auto& fst = vec[i];
+
+			// jumps to the following instruction do nothing. a conditional one
+			// only reads its condition
+			if (enabled(Pattern::JUMP_NEXT)
+			    and (fst.opcode == Opcode::JMP or is_branch(fst.opcode))) {
+				const auto& target = fst.operands[fst.opcode == Opcode::JMP ? 0 : 1];
+				if (label_index(target) == i + 1) {
+					fst = {Opcode::NOP, {}, fst.comment};
+					apply(Pattern::JUMP_NEXT, 1);
+					continue;
+				}
+			}
+
+			if (i + 1 >= vec.size() or labeled[i + 1]) continue;
+			auto& snd = vec[i + 1];
+			bool rewritten = false;
+
+			// DEF t, ...; MOV y, t => DEF y, ...
+			// MOV t, x; OP ..., t, ... => OP ..., x, ...
+			if (enabled(Pattern::MOVE_CHAIN)) {
+				if (defines(fst.opcode) and snd.opcode == Opcode::MOV
+				    and same_operand(fst.operands[0], snd.operands[1])
+				    and counts.is_temporary(fst.operands[0])) {
+					fst.operands[0] = snd.operands[0];
+					snd = {Opcode::NOP, {}, snd.comment};
+					rewritten = true;
+				} else if (fst.opcode == Opcode::MOV
+				           and fst.operands[1].type == Operand::Type::REGISTER
+				           and counts.is_temporary(fst.operands[0])) {
+					size_t first = defines(snd.opcode) ? 1 : 0;
+					for (size_t j = first; j < lir::Instruction::max_operands; j++)
+						if (same_operand(snd.operands[j], fst.operands[0])) {
+							snd.operands[j] = fst.operands[1];
+							fst = {Opcode::NOP, {}, fst.comment};
+							rewritten = true;
+							break;
+						}
+				}
+				if (rewritten) apply(Pattern::MOVE_CHAIN, 1);
+			}
+
+			// STOREA v, o(b); LOADA t, o(b) => STOREA v, o(b); MOV t, v
+			if (not rewritten and enabled(Pattern::STORE_LOAD)
+			    and fst.opcode == Opcode::STOREA and snd.opcode == Opcode::LOADA
+			    and same_operand(fst.operands[1], snd.operands[1])
+			    and same_operand(fst.operands[2], snd.operands[2])) {
+				snd = {
+					Opcode::MOV,
+					{snd.operands[0], fst.operands[0]},
+					snd.comment,
+					snd.integer,
+					snd.location
+				};
+				apply(Pattern::STORE_LOAD, 0);
+				rewritten = true;
+			}
+
+			// JT c, L1; JMP L2; L1: => JF c, L2
+			if (not rewritten and enabled(Pattern::BRANCH_OVER_JUMP)
+			    and is_branch(fst.opcode) and snd.opcode == Opcode::JMP
+			    and label_index(fst.operands[1]) == i + 2) {
+				fst.opcode = invert_branch(fst.opcode);
+				fst.operands[1] = snd.operands[0];
+				snd = {Opcode::NOP, {}, snd.comment};
+				apply(Pattern::BRANCH_OVER_JUMP, 1);
+				rewritten = true;
+			}
+
+			// EQ t, x, 0; JT t, L => JF x, L
+			// DIFF t, x, 0; JT t, L => JT x, L
+			if (not rewritten and enabled(Pattern::COMPARE_BRANCH)
+			    and (fst.opcode == Opcode::EQ or fst.opcode == Opcode::DIFF)
+			    and is_branch(snd.opcode)
+			    and same_operand(fst.operands[0], snd.operands[0])
+			    and counts.is_temporary(fst.operands[0])) {
+				const auto zero = Operand::make_immediate_integer(0);
+				std::optional<Operand> value {};
+				if (same_operand(fst.operands[2], zero))
+					value = fst.operands[1];
+				else if (same_operand(fst.operands[1], zero))
+					value = fst.operands[2];
+				if (value.has_value()) {
+					if (fst.opcode == Opcode::EQ) snd.opcode = invert_branch(snd.opcode);
+					snd.operands[0] = value.value();
+					fst = {Opcode::NOP, {}, fst.comment};
+					apply(Pattern::COMPARE_BRANCH, 1);
+					rewritten = true;
+				}
+			}
+
+			// NOT t, x; JT t, L => JF x, L
+			if (not rewritten and enabled(Pattern::NOT_BRANCH)
+			    and fst.opcode == Opcode::NOT and is_branch(snd.opcode)
+			    and same_operand(fst.operands[0], snd.operands[0])
+			    and counts.is_temporary(fst.operands[0])) {
+				snd.opcode = invert_branch(snd.opcode);
+				snd.operands[0] = fst.operands[1];
+				fst = {Opcode::NOP, {}, fst.comment};
+				apply(Pattern::NOT_BRANCH, 1);
+				rewritten = true;
+			}
+
+			if (rewritten) i++;
+		}
+
+		remove_nops(chunk);
+	}
+
+	return report;
+}
+
+} // namespace passes
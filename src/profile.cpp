@@ -0,0 +1,197 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <format>
+#include <string>
+#include <utility>
+
+namespace lir {
+
+template <typename Key>
+static std::vector<std::pair<Key, Profile::Counter>> most_cycles(
+	std::vector<std::pair<Key, Profile::Counter>> rows
+);
+static double percent(std::uint64_t part, std::uint64_t whole);
+
+template <typename Key>
+std::vector<std::pair<Key, Profile::Counter>> most_cycles(
+	std::vector<std::pair<Key, Profile::Counter>> rows
+) {
+	std::stable_sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+		if (a.second.cycles != b.second.cycles)
+			return a.second.cycles > b.second.cycles;
+		return a.second.executions > b.second.executions;
+	});
+	return rows;
+}
+
+double percent(std::uint64_t part, std::uint64_t whole) {
+	return whole == 0 ? 0.0 : 100.0 * (double)part / (double)whole;
+}
+
+void Profile::reset(
+	const bytecode::Chunk& chunk, const std::vector<bytecode::Code>& codes
+) {
+	m_counters.assign(codes.size(), Counter {});
+	m_opcodes.clear();
+	for (const auto& code : codes) m_opcodes.push_back(code.opcode);
+	m_locations = chunk.locations;
+	m_locations.resize(codes.size());
+	m_last = 0;
+	m_calls = 0;
+	m_allocations = 0;
+	m_peak_depth = 1;
+	m_since = now();
+}
+
+std::uint64_t Profile::total_instructions() const {
+	std::uint64_t total = 0;
+	for (const auto& counter : m_counters) total += counter.executions;
+	return total;
+}
+
+std::uint64_t Profile::total_cycles() const {
+	std::uint64_t total = 0;
+	for (const auto& counter : m_counters) total += counter.cycles;
+	return total;
+}
+
+std::map<bytecode::Opcode, Profile::Counter> Profile::by_opcode() const {
+	std::map<bytecode::Opcode, Counter> res {};
+	for (size_t pc = 0; pc < m_counters.size(); pc++) {
+		if (m_counters[pc].executions == 0) continue;
+		auto& counter = res[m_opcodes[pc]];
+		counter.executions += m_counters[pc].executions;
+		counter.cycles += m_counters[pc].cycles;
+	}
+	return res;
+}
+
+std::map<int, Profile::Counter> Profile::by_line() const {
+	std::map<int, Counter> res {};
+	for (size_t pc = 0; pc < m_counters.size(); pc++) {
+		if (m_counters[pc].executions == 0 or not m_locations[pc].has_value())
+			continue;
+		auto& counter = res[m_locations[pc]->begin.line + 1];
+		counter.executions += m_counters[pc].executions;
+		counter.cycles += m_counters[pc].cycles;
+	}
+	return res;
+}
+
+void Profile::report(std::ostream& stream, std::size_t rows) const {
+	auto total = total_cycles();
+	stream << std::format(
+		"profile: {} instructions, {} cycles, {} calls, {} allocations, peak "
+		"stack depth {}\n",
+		total_instructions(),
+		total,
+		m_calls,
+		m_allocations,
+		m_peak_depth
+	);
+
+	auto opcodes = by_opcode();
+	auto sorted_opcodes = most_cycles(
+		std::vector<std::pair<bytecode::Opcode, Counter>>(
+			opcodes.begin(), opcodes.end()
+		)
+	);
+	stream << std::format(
+		"\n{:<20} {:>12} {:>14} {:>6}\n", "opcode", "executions", "cycles", "%"
+	);
+	for (const auto& [opcode, counter] : sorted_opcodes)
+		stream << std::format(
+			"{:<20} {:>12} {:>14} {:>6.2f}\n",
+			bytecode::opcode_name(opcode),
+			counter.executions,
+			counter.cycles,
+			percent(counter.cycles, total)
+		);
+
+	auto lines = by_line();
+	auto sorted_lines = most_cycles(
+		std::vector<std::pair<int, Counter>>(lines.begin(), lines.end())
+	);
+	stream << std::format(
+		"\n{:<20} {:>12} {:>14} {:>6}\n", "line", "executions", "cycles", "%"
+	);
+	for (size_t i = 0; i < sorted_lines.size() and i < rows; i++) {
+		const auto& [line, counter] = sorted_lines[i];
+		stream << std::format(
+			"{:<20} {:>12} {:>14} {:>6.2f}\n",
+			line,
+			counter.executions,
+			counter.cycles,
+			percent(counter.cycles, total)
+		);
+	}
+
+	std::vector<std::pair<size_t, Counter>> codes {};
+	for (size_t pc = 0; pc < m_counters.size(); pc++)
+		if (m_counters[pc].executions > 0) codes.push_back({pc, m_counters[pc]});
+	codes = most_cycles(std::move(codes));
+	stream << std::format(
+		"\n{:>6} {:<20} {:>12} {:>14} {:>6}  {}\n",
+		"pc",
+		"opcode",
+		"executions",
+		"cycles",
+		"%",
+		"location"
+	);
+	for (size_t i = 0; i < codes.size() and i < rows; i++) {
+		const auto& [pc, counter] = codes[i];
+		std::string location {"-"};
+		if (const auto& loc = m_locations[pc])
+			location =
+				std::format("{}:{}", loc->begin.line + 1, loc->begin.column + 1);
+		stream << std::format(
+			"{:>6} {:<20} {:>12} {:>14} {:>6.2f}  {}\n",
+			pc,
+			bytecode::opcode_name(m_opcodes[pc]),
+			counter.executions,
+			counter.cycles,
+			percent(counter.cycles, total),
+			location
+		);
+	}
+}
+
+void Profile::write_json(std::ostream& stream) const {
+	stream << std::format(
+		"{{\"total_instructions\": {}, \"total_cycles\": {}, \"calls\": {}, "
+		"\"allocations\": {}, \"peak_stack_depth\": {}, \"opcodes\": {{",
+		total_instructions(),
+		total_cycles(),
+		m_calls,
+		m_allocations,
+		m_peak_depth
+	);
+	const char* separator = "";
+	for (const auto& [opcode, counter] : by_opcode()) {
+		stream << std::format(
+			"{}\"{}\": {{\"executions\": {}, \"cycles\": {}}}",
+			separator,
+			bytecode::opcode_name(opcode),
+			counter.executions,
+			counter.cycles
+		);
+		separator = ", ";
+	}
+	stream << "}, \"lines\": {";
+	separator = "";
+	for (const auto& [line, counter] : by_line()) {
+		stream << std::format(
+			"{}\"{}\": {{\"executions\": {}, \"cycles\": {}}}",
+			separator,
+			line,
+			counter.executions,
+			counter.cycles
+		);
+		separator = ", ";
+	}
+	stream << "}}\n";
+}
+
+} // namespace lir
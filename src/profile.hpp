@@ -0,0 +1,99 @@
+// Execution profile of the virtual machine
+
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "location.hpp"
+
+namespace lir {
+
+// what a run of the VM spent its time on, per code and summed per opcode and
+// per source line. the time between two codes starting is charged to the
+// first one, in cycles of the time stamp counter where there's one and in
+// nanoseconds otherwise
+class Profile {
+ public:
+	struct Counter {
+		std::uint64_t executions {0};
+		std::uint64_t cycles {0};
+	};
+
+	// starts over for a chunk, whose codes may have been quickened
+	void reset(
+		const bytecode::Chunk& chunk, const std::vector<bytecode::Code>& codes
+	);
+
+	// the code at pc starts running
+	void enter(std::size_t pc) {
+		auto time = now();
+		m_counters[m_last].cycles += time - m_since;
+		m_counters[pc].executions++;
+		m_last = pc;
+		m_since = time;
+	}
+
+	// a call starts, depth calls deep counting the program itself
+	void call(std::size_t depth) {
+		m_calls++;
+		if (depth > m_peak_depth) m_peak_depth = depth;
+	}
+
+	void allocation() { m_allocations++; }
+
+	// the program stops, which ends the last code
+	void finish() { m_counters[m_last].cycles += now() - m_since; }
+
+	const std::vector<Counter>& counters() const { return m_counters; }
+	std::uint64_t total_instructions() const;
+	std::uint64_t total_cycles() const;
+	std::uint64_t calls() const { return m_calls; }
+	std::uint64_t allocations() const { return m_allocations; }
+	std::size_t peak_stack_depth() const { return m_peak_depth; }
+
+	std::map<bytecode::Opcode, Counter> by_opcode() const;
+	// lines counted from 1. codes without a location are left out
+	std::map<int, Counter> by_line() const;
+
+	// tables of the opcodes, source lines and codes that took the most cycles,
+	// at most rows of the last two
+	void report(std::ostream& stream, std::size_t rows = 20) const;
+
+	// the totals and the tables of opcodes and lines, on a line of JSON
+	void write_json(std::ostream& stream) const;
+
+ private:
+	static std::uint64_t now() {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+		return __builtin_ia32_rdtsc();
+#else
+		auto since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+		return (std::uint64_t)
+			std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch)
+				.count();
+#endif
+	}
+
+	std::vector<Counter> m_counters {};
+	std::vector<bytecode::Opcode> m_opcodes {};
+	std::vector<std::optional<Location>> m_locations {};
+
+	std::size_t m_last {0};
+	std::uint64_t m_since {0};
+
+	std::uint64_t m_calls {0};
+	std::uint64_t m_allocations {0};
+	std::size_t m_peak_depth {0};
+};
+
+} // namespace lir
+
+#endif
@@ -0,0 +1,161 @@
+// Scalar promotion of variable boxes
+//
+// The compiler gives every scalar variable a box, a single-cell array created
+// by `ALLOCA box, 1` and accessed with `LOADA x, 0(box)`/`STOREA x, 0(box)`.
+// A box escapes when its address is used for anything else, like being
+// passed to a function, stored, printed or being the program result. Boxes
+// that don't escape can hold the value themselves, turning every access into
+// a move between registers.
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "lir.hpp"
+#include "passes.hpp"
+
+namespace passes {
+
+using lir::Opcode;
+using lir::Operand;
+
+static bool is_immediate(const Operand& opnd, int number);
+
+bool is_immediate(const Operand& opnd, int number) {
+	return opnd.type == Operand::Type::IMMEDIATE
+	   and opnd.as_immediate().number == number;
+}
+
+size_t promote_scalars(lir::Chunk& chunk) {
+	enum class State { UNSEEN, BOX, ESCAPES };
+
+	size_t register_count = 0;
+	for (const auto& inst : chunk.m_vec)
+		for (const auto& opnd : inst.operands)
+			if (opnd.type == Operand::Type::REGISTER)
+				register_count =
+					std::max(register_count, opnd.as_register().index + 1);
+
+	std::vector<State> state(register_count, State::UNSEEN);
+	auto escape = [&](const Operand& opnd) {
+		if (opnd.type == Operand::Type::REGISTER)
+			state[opnd.as_register().index] = State::ESCAPES;
+	};
+	auto box = [&](const Operand& opnd) {
+		auto& st = state[opnd.as_register().index];
+		if (st == State::UNSEEN) st = State::BOX;
+	};
+
+	// boxes are created by ALLOCA 1, or by cloning another box. a clone ties
+	// both boxes together, so that either both or none are promoted
+	std::vector<std::pair<size_t, size_t>> clones {};
+
+	for (const auto& inst : chunk.m_vec) {
+		const auto& opnds = inst.operands;
+		switch (inst.opcode) {
+			case Opcode::ALLOCA:
+				if (opnds[0].type == Operand::Type::REGISTER
+				    and is_immediate(opnds[1], 1))
+					box(opnds[0]);
+				else
+					escape(opnds[0]);
+				escape(opnds[1]);
+				break;
+			case Opcode::CLONEA:
+				// copies of string constants are never boxes
+				if (opnds[1].type != Operand::Type::REGISTER) {
+					escape(opnds[0]);
+					break;
+				}
+				box(opnds[0]);
+				box(opnds[1]);
+				clones.push_back(
+					{opnds[0].as_register().index, opnds[1].as_register().index}
+				);
+				break;
+			case Opcode::LOADA:
+				escape(opnds[0]);
+				escape(opnds[1]);
+				if (not is_immediate(opnds[1], 0)) escape(opnds[2]);
+				break;
+			case Opcode::STOREA:
+				escape(opnds[0]);
+				escape(opnds[1]);
+				if (not is_immediate(opnds[1], 0)) escape(opnds[2]);
+				break;
+			default:
+				for (const auto& opnd : opnds) escape(opnd);
+				break;
+		}
+	}
+	if (chunk.result_opnd.has_value()) escape(chunk.result_opnd.value());
+
+	for (bool changed = true; changed;) {
+		changed = false;
+		for (auto [dst, src] : clones)
+			if ((state[dst] == State::ESCAPES) != (state[src] == State::ESCAPES)) {
+				state[dst] = state[src] = State::ESCAPES;
+				changed = true;
+			}
+	}
+
+	auto promoted = [&](const Operand& opnd) {
+		return opnd.type == Operand::Type::REGISTER
+		   and state[opnd.as_register().index] == State::BOX;
+	};
+	auto value = [](const Operand& opnd) {
+		return Operand(
+			lir::Register(opnd.as_register().index, lir::Type::make_integer())
+		);
+	};
+
+	for (auto& inst : chunk.m_vec) {
+		auto& opnds = inst.operands;
+		switch (inst.opcode) {
+			case Opcode::ALLOCA:
+				if (promoted(opnds[0])) inst = {Opcode::NOP, {}, inst.comment};
+				break;
+			case Opcode::CLONEA:
+				if (promoted(opnds[0])) {
+					auto src = value(opnds[1]);
+					inst = {
+						Opcode::MOV,
+						{value(opnds[0]), src},
+						inst.comment,
+						inst.integer,
+						inst.location
+					};
+				}
+				break;
+			case Opcode::LOADA:
+				if (promoted(opnds[2]))
+					inst = {
+						Opcode::MOV,
+						{opnds[0], value(opnds[2])},
+						inst.comment,
+						inst.integer,
+						inst.location
+					};
+				break;
+			case Opcode::STOREA:
+				if (promoted(opnds[2]))
+					inst = {
+						Opcode::MOV,
+						{value(opnds[2]), opnds[0]},
+						inst.comment,
+						inst.integer,
+						inst.location
+					};
+				break;
+			default: break;
+		}
+	}
+
+	size_t count = 0;
+	for (auto st : state)
+		if (st == State::BOX) count++;
+	return count;
+}
+
+} // namespace passes
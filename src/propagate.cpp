@@ -0,0 +1,283 @@
+// Conditional constant propagation
+//
+// After promotion, variables that are never assigned after their declaration
+// are registers written once with an immediate, and every read of them goes
+// through a register anyway. The values of registers are followed through the
+// control flow graph, starting out unknown and only ever moving towards
+// varying, and blocks are only visited once a branch can reach them. A branch
+// on a constant only reaches one of its targets, so loops that never run and
+// code behind `if false` don't spoil the registers they write.
+//
+// Once nothing changes anymore, reads of constant registers become
+// immediates, instructions computing a constant become moves of it, branches
+// on constants become jumps and unreachable blocks are dropped. Moves of
+// constants that are not read anymore are dropped as well.
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "cfg.hpp"
+#include "lir.hpp"
+#include "passes.hpp"
+
+namespace passes {
+
+using lir::Opcode;
+using lir::Operand;
+
+// what's known about a register at some point
+struct Known {
+	enum class State {
+		NOTHING,  // no path reaching it was seen yet
+		CONSTANT, // same value on every path seen
+		VARYING,
+	};
+
+	State state {State::NOTHING};
+	int value {0};
+
+	bool operator==(const Known&) const = default;
+};
+
+static Known meet(Known a, Known b);
+static bool is_foldable(Opcode op);
+static bool accepts_immediate(Opcode op, size_t i);
+
+Known meet(Known a, Known b) {
+	if (a.state == Known::State::NOTHING) return b;
+	if (b.state == Known::State::NOTHING) return a;
+	if (a == b) return a;
+	return {Known::State::VARYING, 0};
+}
+
+bool is_foldable(Opcode op) {
+	switch (op) {
+		case Opcode::ADD:
+		case Opcode::SUB:
+		case Opcode::MUL:
+		case Opcode::DIV:
+		case Opcode::MOD:
+		case Opcode::NOT:
+		case Opcode::OR:
+		case Opcode::AND:
+		case Opcode::EQ:
+		case Opcode::DIFF:
+		case Opcode::LESS:
+		case Opcode::LESS_EQ:
+		case Opcode::GREATER:
+		case Opcode::GREATER_EQ: return true;
+		default: return false;
+	}
+}
+
+// whether the VM reads the operand as a value rather than as a pointer
+bool accepts_immediate(Opcode op, size_t i) {
+	switch (op) {
+		case Opcode::LOADA:
+		case Opcode::STOREA:
+		case Opcode::SHIFTA:
+		case Opcode::ADDA:
+		case Opcode::SUBA: return i != 2;
+		case Opcode::CLONEA: return i != 1;
+		case Opcode::PRINTF: return false;
+		default: return true;
+	}
+}
+
+PropagationReport propagate_constants(lir::Chunk& chunk) {
+	PropagationReport report {};
+
+	size_t register_count = 0;
+	for (const auto& inst : chunk.m_vec)
+		for (const auto& opnd : inst.operands)
+			if (opnd.type == Operand::Type::REGISTER)
+				register_count =
+					std::max(register_count, opnd.as_register().index + 1);
+
+	cfg::Graph graph {std::move(chunk)};
+	auto& blocks = graph.blocks;
+
+	// registers of more than one procedure may be written by any call
+	const auto shared = cfg::shared_registers(graph, register_count);
+
+	using State = std::vector<Known>;
+	auto known = [](const State& state, const Operand& opnd) -> Known {
+		switch (opnd.type) {
+			case Operand::Type::IMMEDIATE:
+				return {Known::State::CONSTANT, opnd.as_immediate().number};
+			case Operand::Type::REGISTER:
+				return state[opnd.as_register().index];
+			default: return {Known::State::VARYING, 0};
+		}
+	};
+
+	// effect of a single instruction on the registers
+	auto step = [&](State& state, const lir::Instruction& inst) {
+		if (inst.opcode == Opcode::CALL) {
+			for (size_t reg = 0; reg < register_count; reg++)
+				if (shared[reg]) state[reg] = {Known::State::VARYING, 0};
+			return;
+		}
+		if (not defines(inst.opcode)) return;
+		const auto& dest = inst.operands[0];
+		if (dest.type != Operand::Type::REGISTER) return;
+
+		Known result {Known::State::VARYING, 0};
+		if (inst.opcode == Opcode::MOV) {
+			result = known(state, inst.operands[1]);
+		} else if (is_foldable(inst.opcode)) {
+			auto left = known(state, inst.operands[1]);
+			auto right = inst.opcode == Opcode::NOT
+			             ? Known {Known::State::CONSTANT, 0}
+			             : known(state, inst.operands[2]);
+			if (left.state == Known::State::NOTHING
+			    or right.state == Known::State::NOTHING) {
+				result = {};
+			} else if (left.state == Known::State::CONSTANT
+			           and right.state == Known::State::CONSTANT) {
+				auto value = lir::fold(inst.opcode, left.value, right.value);
+				if (value.has_value())
+					result = {Known::State::CONSTANT, value.value()};
+			}
+		}
+		state[dest.as_register().index] = result;
+	};
+
+	// successors a block reaches with the registers at its end. a branch on
+	// a constant only reaches one of them, and one on a register nothing is
+	// known about yet none
+	auto reached = [&](size_t b, const State& state) -> std::vector<size_t> {
+		const auto& block = blocks[b];
+		if (block.code.empty()) return block.successors;
+		const auto& last = block.code.back();
+		if (last.opcode != Opcode::JMP_TRUE and last.opcode != Opcode::JMP_FALSE)
+			return block.successors;
+		auto cond = known(state, last.operands[0]);
+		if (cond.state == Known::State::NOTHING) return {};
+		if (cond.state == Known::State::VARYING) return block.successors;
+		bool taken = (cond.value != 0) == (last.opcode == Opcode::JMP_TRUE);
+		if (taken) return graph.jump_targets(b);
+		if (block.fallthrough == cfg::none) return {};
+		return {block.fallthrough};
+	};
+
+	std::vector<State> in(blocks.size());
+	std::vector<bool> executable(blocks.size(), false);
+	std::vector<size_t> work {};
+	for (auto entry : graph.entries) {
+		in[entry].assign(register_count, {Known::State::VARYING, 0});
+		executable[entry] = true;
+		work.push_back(entry);
+	}
+	while (not work.empty()) {
+		auto b = work.back();
+		work.pop_back();
+		auto state = in[b];
+		for (const auto& inst : blocks[b].code) step(state, inst);
+
+		for (auto succ : reached(b, state)) {
+			if (not executable[succ]) {
+				executable[succ] = true;
+				in[succ] = state;
+				work.push_back(succ);
+				continue;
+			}
+			bool changed = false;
+			for (size_t reg = 0; reg < register_count; reg++) {
+				auto met = meet(in[succ][reg], state[reg]);
+				if (met == in[succ][reg]) continue;
+				in[succ][reg] = met;
+				changed = true;
+			}
+			if (changed) work.push_back(succ);
+		}
+	}
+
+	std::vector<size_t> layout {};
+	for (auto b : graph.layout) {
+		if (not executable[b]) {
+			report.unreachable++;
+			continue;
+		}
+		layout.push_back(b);
+
+		auto& block = blocks[b];
+		auto state = in[b];
+		for (auto& inst : block.code) {
+			const bool defining = defines(inst.opcode);
+			for (size_t i = defining ? 1 : 0; i < lir::Instruction::max_operands;
+			     i++) {
+				auto value = known(state, inst.operands[i]);
+				if (inst.operands[i].type == Operand::Type::REGISTER
+				    and value.state == Known::State::CONSTANT
+				    and accepts_immediate(inst.opcode, i)) {
+					inst.operands[i] = Operand::make_immediate_integer(value.value);
+					report.propagated++;
+				}
+			}
+			step(state, inst);
+
+			if (not is_foldable(inst.opcode)) continue;
+			auto value = known(state, inst.operands[0]);
+			if (value.state != Known::State::CONSTANT) continue;
+			inst = {
+				Opcode::MOV,
+				{inst.operands[0], Operand::make_immediate_integer(value.value)},
+				inst.comment,
+				inst.integer,
+				inst.location
+			};
+			report.folded++;
+		}
+
+		if (block.code.empty()) continue;
+		auto& last = block.code.back();
+		if ((last.opcode != Opcode::JMP_TRUE and last.opcode != Opcode::JMP_FALSE)
+		    or last.operands[0].type != Operand::Type::IMMEDIATE)
+			continue;
+		bool taken =
+			(last.operands[0].as_immediate().number != 0)
+			== (last.opcode == Opcode::JMP_TRUE);
+		if (taken) {
+			last = {
+				Opcode::JMP,
+				{last.operands[1]},
+				last.comment,
+				last.integer,
+				last.location
+			};
+			block.fallthrough = cfg::none;
+		} else {
+			block.code.pop_back();
+		}
+		report.branches++;
+	}
+	graph.layout = std::move(layout);
+
+	// constants moved into registers nobody reads anymore
+	std::vector<size_t> uses(register_count, 0);
+	for (auto b : graph.layout)
+		for (const auto& inst : blocks[b].code)
+			for (size_t i = defines(inst.opcode) ? 1 : 0;
+			     i < lir::Instruction::max_operands;
+			     i++)
+				if (inst.operands[i].type == Operand::Type::REGISTER)
+					uses[inst.operands[i].as_register().index]++;
+	if (graph.result_opnd.has_value()
+	    and graph.result_opnd->type == Operand::Type::REGISTER)
+		uses[graph.result_opnd->as_register().index]++;
+	for (auto b : graph.layout)
+		std::erase_if(blocks[b].code, [&](const lir::Instruction& inst) {
+			return inst.opcode == Opcode::MOV
+			   and inst.operands[0].type == Operand::Type::REGISTER
+			   and inst.operands[1].type == Operand::Type::IMMEDIATE
+			   and uses[inst.operands[0].as_register().index] == 0;
+		});
+
+	chunk = cfg::linearize(std::move(graph));
+	return report;
+}
+
+} // namespace passes
@@ -0,0 +1,199 @@
+// Superinstruction selection
+//
+// Loop tests compare two values into a temporary and branch on it right
+// after, and updates of array cells load the cell, add to it and store the
+// sum back. Each of these sequences becomes a single superinstruction, which
+// the VM executes with a single dispatch. Like the peephole pass, sequences
+// are only fused when their temporaries are written and read exactly once and
+// no label sits inside them.
+
+#include <cassert>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "lir.hpp"
+#include "passes.hpp"
+
+namespace passes {
+
+using lir::Opcode;
+using lir::Operand;
+
+static bool is_branch(Opcode op);
+static bool is_control(Opcode op);
+static std::optional<Opcode> compare_jump(Opcode compare);
+static Opcode negate_compare_jump(Opcode jump);
+static size_t share_addresses(lir::Chunk& chunk);
+
+bool is_branch(Opcode op) {
+	return op == Opcode::JMP_TRUE or op == Opcode::JMP_FALSE;
+}
+
+// whether control may leave the instruction other than by falling through
+bool is_control(Opcode op) {
+	switch (op) {
+		case Opcode::JMP:
+		case Opcode::JMP_TRUE:
+		case Opcode::JMP_FALSE:
+		case Opcode::CALL:
+		case Opcode::RET:
+		case Opcode::FUNC: return true;
+		default: return false;
+	}
+}
+
+// the jump taken when the comparison holds
+std::optional<Opcode> compare_jump(Opcode compare) {
+	switch (compare) {
+		case Opcode::EQ: return Opcode::JMP_EQ;
+		case Opcode::DIFF: return Opcode::JMP_DIFF;
+		case Opcode::LESS: return Opcode::JMP_LESS;
+		case Opcode::LESS_EQ: return Opcode::JMP_LESS_EQ;
+		case Opcode::GREATER: return Opcode::JMP_GREATER;
+		case Opcode::GREATER_EQ: return Opcode::JMP_GREATER_EQ;
+		default: return {};
+	}
+}
+
+// the jump taken when the comparison doesn't hold. operands are always
+// integers, so this is exact
+Opcode negate_compare_jump(Opcode jump) {
+	switch (jump) {
+		case Opcode::JMP_EQ: return Opcode::JMP_DIFF;
+		case Opcode::JMP_DIFF: return Opcode::JMP_EQ;
+		case Opcode::JMP_LESS: return Opcode::JMP_GREATER_EQ;
+		case Opcode::JMP_LESS_EQ: return Opcode::JMP_GREATER;
+		case Opcode::JMP_GREATER: return Opcode::JMP_LESS_EQ;
+		case Opcode::JMP_GREATER_EQ: return Opcode::JMP_LESS;
+		default: break;
+	}
+	assert(false);
+}
+
+// the compiler computes the address of an array element again for every
+// access, so `a[i] = a[i] + 1` loads and stores through different registers.
+// a SHIFTA right after an identical one is dropped, and the only read of its
+// result uses the first one instead. this is only done when the read comes
+// later in the same straight-line code, where the first result can't change
+size_t share_addresses(lir::Chunk& chunk) {
+	auto& vec = chunk.m_vec;
+	const RegisterCounts counts {chunk};
+	std::vector<bool> labeled(vec.size() + 1, false);
+	for (const auto& [id, index] : chunk.label_indexes) labeled[index] = true;
+
+	size_t shared = 0;
+	for (size_t i = 0; i + 1 < vec.size(); i++) {
+		const auto& fst = vec[i];
+		auto& snd = vec[i + 1];
+		if (fst.opcode != Opcode::SHIFTA or snd.opcode != Opcode::SHIFTA
+		    or labeled[i + 1])
+			continue;
+		const auto& address = fst.operands[0];
+		if (not same_operand(fst.operands[1], snd.operands[1])
+		    or not same_operand(fst.operands[2], snd.operands[2])
+		    or same_operand(address, fst.operands[1])
+		    or same_operand(address, fst.operands[2])
+		    or counts.defs[address.as_register().index] != 1
+		    or not counts.is_temporary(snd.operands[0]))
+			continue;
+
+		for (size_t j = i + 2; j < vec.size() and not labeled[j]; j++) {
+			auto& inst = vec[j];
+			bool found = false;
+			for (auto& opnd : inst.operands)
+				if (same_operand(opnd, snd.operands[0])) {
+					opnd = address;
+					found = true;
+				}
+			if (found) {
+				snd = {Opcode::NOP, {}, snd.comment};
+				shared++;
+				break;
+			}
+			if (is_control(inst.opcode)) break;
+		}
+	}
+
+	remove_nops(chunk);
+	return shared;
+}
+
+SelectionReport select_superinstructions(lir::Chunk& chunk) {
+	SelectionReport report {};
+	report.shared_addresses = share_addresses(chunk);
+
+	auto& vec = chunk.m_vec;
+	const RegisterCounts counts {chunk};
+	std::vector<bool> labeled(vec.size() + 1, false);
+	for (const auto& [id, index] : chunk.label_indexes) labeled[index] = true;
+
+	for (size_t i = 0; i + 1 < vec.size(); i++) {
+		auto& fst = vec[i];
+		auto& snd = vec[i + 1];
+		if (labeled[i + 1]) continue;
+
+		// CMP t, a, b; JT t, L => JCMP a, b, L
+		auto jump = compare_jump(fst.opcode);
+		if (jump.has_value() and is_branch(snd.opcode)
+		    and same_operand(fst.operands[0], snd.operands[0])
+		    and counts.is_temporary(fst.operands[0])) {
+			auto opcode = snd.opcode == Opcode::JMP_TRUE
+			              ? jump.value()
+			              : negate_compare_jump(jump.value());
+			auto comment = fst.comment.empty() ? snd.comment : fst.comment;
+			fst = {
+				opcode,
+				{fst.operands[1], fst.operands[2], snd.operands[1]},
+				comment,
+				false,
+				fst.location ? fst.location : snd.location
+			};
+			snd = {Opcode::NOP, {}, ""};
+			report.compare_jumps++;
+			i++;
+			continue;
+		}
+
+		// LOADA t, o(b); ADD s, t, x; STOREA s, o(b) => ADDA x, o(b)
+		if (i + 2 >= vec.size() or labeled[i + 2]) continue;
+		auto& trd = vec[i + 2];
+		if (fst.opcode != Opcode::LOADA
+		    or (snd.opcode != Opcode::ADD and snd.opcode != Opcode::SUB)
+		    or trd.opcode != Opcode::STOREA)
+			continue;
+		const auto& loaded = fst.operands[0];
+		const auto& sum = snd.operands[0];
+		if (not counts.is_temporary(loaded) or not counts.is_temporary(sum)
+		    or not same_operand(sum, trd.operands[0])
+		    or not same_operand(fst.operands[1], trd.operands[1])
+		    or not same_operand(fst.operands[2], trd.operands[2]))
+			continue;
+
+		std::optional<Operand> value {};
+		if (same_operand(snd.operands[1], loaded))
+			value = snd.operands[2];
+		else if (snd.opcode == Opcode::ADD
+		         and same_operand(snd.operands[2], loaded))
+			value = snd.operands[1];
+		if (not value.has_value()) continue;
+
+		auto opcode = snd.opcode == Opcode::ADD ? Opcode::ADDA : Opcode::SUBA;
+		trd = {
+			opcode,
+			{value.value(), trd.operands[1], trd.operands[2]},
+			trd.comment,
+			false,
+			trd.location
+		};
+		fst = {Opcode::NOP, {}, fst.comment};
+		snd = {Opcode::NOP, {}, snd.comment};
+		report.array_updates++;
+		i += 2;
+	}
+
+	remove_nops(chunk);
+	return report;
+}
+
+} // namespace passes
@@ -0,0 +1,260 @@
+// Type specialization
+//
+// The VM checks the tag of every operand it reads as an integer, even though
+// the typechecker already rejected the programs where it could be anything
+// else. What's known about the tag of each register is followed through the
+// control flow graph: results of arithmetic, comparisons and reads are
+// integers, and so are immediates and the loads and call results the
+// compiler marked from the type of their expression. Calls may write any
+// register shared with another procedure, and nothing is known about any
+// register when a procedure is entered.
+//
+// Arithmetic, comparisons and compare and jumps whose operands are integers
+// on every path reaching them become their integer variants, which skip the
+// checks. The same analysis verifies a chunk before it runs, which catches
+// passes later moving those instructions somewhere their operands may be
+// something else.
+
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "cfg.hpp"
+#include "lir.hpp"
+#include "passes.hpp"
+
+namespace passes {
+
+using lir::Opcode;
+using lir::Operand;
+
+// what's known about the tag of a register at some point
+enum class Tag {
+	INTEGER, // an integer on every path seen
+	UNKNOWN,
+};
+
+using State = std::vector<Tag>;
+
+static Tag meet(Tag a, Tag b);
+static bool writes_integer(const lir::Instruction& inst);
+static std::optional<Opcode> integer_variant(Opcode op);
+static bool is_integer_variant(Opcode op);
+static size_t first_read(Opcode op);
+static size_t count_registers(const lir::Chunk& chunk);
+static Tag tag_of(const State& state, const Operand& opnd);
+static void step(
+	State& state, const lir::Instruction& inst, const std::vector<bool>& shared
+);
+static std::vector<std::optional<State>> analyze(
+	const cfg::Graph& graph, size_t register_count
+);
+
+Tag meet(Tag a, Tag b) { return a == b ? a : Tag::UNKNOWN; }
+
+bool writes_integer(const lir::Instruction& inst) {
+	if (inst.integer) return true;
+	switch (inst.opcode) {
+		case Opcode::READV:
+		case Opcode::READC:
+		case Opcode::ADD:
+		case Opcode::SUB:
+		case Opcode::MUL:
+		case Opcode::DIV:
+		case Opcode::MOD:
+		case Opcode::NOT:
+		case Opcode::OR:
+		case Opcode::AND:
+		case Opcode::EQ:
+		case Opcode::DIFF:
+		case Opcode::LESS:
+		case Opcode::LESS_EQ:
+		case Opcode::GREATER:
+		case Opcode::GREATER_EQ: return true;
+		default: return is_integer_variant(inst.opcode) and defines(inst.opcode);
+	}
+}
+
+std::optional<Opcode> integer_variant(Opcode op) {
+	switch (op) {
+		case Opcode::ADD: return Opcode::ADD_I;
+		case Opcode::SUB: return Opcode::SUB_I;
+		case Opcode::MUL: return Opcode::MUL_I;
+		case Opcode::EQ: return Opcode::EQ_I;
+		case Opcode::DIFF: return Opcode::DIFF_I;
+		case Opcode::LESS: return Opcode::LESS_I;
+		case Opcode::LESS_EQ: return Opcode::LESS_EQ_I;
+		case Opcode::GREATER: return Opcode::GREATER_I;
+		case Opcode::GREATER_EQ: return Opcode::GREATER_EQ_I;
+		case Opcode::JMP_EQ: return Opcode::JMP_EQ_I;
+		case Opcode::JMP_DIFF: return Opcode::JMP_DIFF_I;
+		case Opcode::JMP_LESS: return Opcode::JMP_LESS_I;
+		case Opcode::JMP_LESS_EQ: return Opcode::JMP_LESS_EQ_I;
+		case Opcode::JMP_GREATER: return Opcode::JMP_GREATER_I;
+		case Opcode::JMP_GREATER_EQ: return Opcode::JMP_GREATER_EQ_I;
+		default: return {};
+	}
+}
+
+bool is_integer_variant(Opcode op) {
+	switch (op) {
+		case Opcode::ADD_I:
+		case Opcode::SUB_I:
+		case Opcode::MUL_I:
+		case Opcode::EQ_I:
+		case Opcode::DIFF_I:
+		case Opcode::LESS_I:
+		case Opcode::LESS_EQ_I:
+		case Opcode::GREATER_I:
+		case Opcode::GREATER_EQ_I:
+		case Opcode::JMP_EQ_I:
+		case Opcode::JMP_DIFF_I:
+		case Opcode::JMP_LESS_I:
+		case Opcode::JMP_LESS_EQ_I:
+		case Opcode::JMP_GREATER_I:
+		case Opcode::JMP_GREATER_EQ_I: return true;
+		default: return false;
+	}
+}
+
+// the two integer operands follow the register written, if any
+size_t first_read(Opcode op) { return defines(op) ? 1 : 0; }
+
+size_t count_registers(const lir::Chunk& chunk) {
+	size_t register_count = 0;
+	for (const auto& inst : chunk.m_vec)
+		for (const auto& opnd : inst.operands)
+			if (opnd.type == Operand::Type::REGISTER)
+				register_count =
+					std::max(register_count, opnd.as_register().index + 1);
+	if (chunk.result_opnd.has_value()
+	    and chunk.result_opnd->type == Operand::Type::REGISTER)
+		register_count =
+			std::max(register_count, chunk.result_opnd->as_register().index + 1);
+	return register_count;
+}
+
+Tag tag_of(const State& state, const Operand& opnd) {
+	switch (opnd.type) {
+		case Operand::Type::IMMEDIATE: return Tag::INTEGER;
+		case Operand::Type::REGISTER: return state[opnd.as_register().index];
+		default: return Tag::UNKNOWN;
+	}
+}
+
+// effect of a single instruction on the tags
+void step(
+	State& state, const lir::Instruction& inst, const std::vector<bool>& shared
+) {
+	if (inst.opcode == Opcode::CALL) {
+		for (size_t reg = 0; reg < state.size(); reg++)
+			if (shared[reg]) state[reg] = Tag::UNKNOWN;
+		return;
+	}
+	if (not defines(inst.opcode)) return;
+	const auto& dest = inst.operands[0];
+	if (dest.type != Operand::Type::REGISTER) return;
+	auto& tag = state[dest.as_register().index];
+	if (writes_integer(inst))
+		tag = Tag::INTEGER;
+	else if (inst.opcode == Opcode::MOV)
+		tag = tag_of(state, inst.operands[1]);
+	else
+		tag = Tag::UNKNOWN;
+}
+
+// tags on entry of every block, or nothing for blocks that can't be reached
+std::vector<std::optional<State>> analyze(
+	const cfg::Graph& graph, size_t register_count
+) {
+	const auto& blocks = graph.blocks;
+	const auto shared = cfg::shared_registers(graph, register_count);
+
+	std::vector<std::optional<State>> in(blocks.size());
+	std::vector<size_t> work {};
+	for (auto entry : graph.entries) {
+		in[entry] = State(register_count, Tag::UNKNOWN);
+		work.push_back(entry);
+	}
+	while (not work.empty()) {
+		auto b = work.back();
+		work.pop_back();
+		auto state = in[b].value();
+		for (const auto& inst : blocks[b].code) step(state, inst, shared);
+
+		for (auto succ : blocks[b].successors) {
+			if (not in[succ].has_value()) {
+				in[succ] = state;
+				work.push_back(succ);
+				continue;
+			}
+			bool changed = false;
+			auto& known = in[succ].value();
+			for (size_t reg = 0; reg < register_count; reg++) {
+				auto met = meet(known[reg], state[reg]);
+				if (met == known[reg]) continue;
+				known[reg] = met;
+				changed = true;
+			}
+			if (changed) work.push_back(succ);
+		}
+	}
+	return in;
+}
+
+SpecializationReport specialize_types(lir::Chunk& chunk) {
+	SpecializationReport report {};
+
+	const auto register_count = count_registers(chunk);
+	cfg::Graph graph {std::move(chunk)};
+	const auto shared = cfg::shared_registers(graph, register_count);
+	const auto in = analyze(graph, register_count);
+
+	for (auto b : graph.layout) {
+		if (not in[b].has_value()) continue;
+		auto state = in[b].value();
+		for (auto& inst : graph.blocks[b].code) {
+			auto variant = integer_variant(inst.opcode);
+			if (variant.has_value()) {
+				report.operations++;
+				auto first = first_read(inst.opcode);
+				if (tag_of(state, inst.operands[first]) == Tag::INTEGER
+				    and tag_of(state, inst.operands[first + 1]) == Tag::INTEGER) {
+					inst.opcode = variant.value();
+					report.specialized++;
+				}
+			}
+			step(state, inst, shared);
+		}
+	}
+
+	chunk = cfg::linearize(std::move(graph));
+	return report;
+}
+
+size_t verify_types(const lir::Chunk& chunk) {
+	const auto register_count = count_registers(chunk);
+	const cfg::Graph graph {chunk};
+	const auto shared = cfg::shared_registers(graph, register_count);
+	const auto in = analyze(graph, register_count);
+
+	size_t unproven = 0;
+	for (size_t b = 0; b < graph.blocks.size(); b++) {
+		if (not in[b].has_value()) continue;
+		auto state = in[b].value();
+		for (const auto& inst : graph.blocks[b].code) {
+			if (is_integer_variant(inst.opcode)) {
+				auto first = first_read(inst.opcode);
+				if (tag_of(state, inst.operands[first]) != Tag::INTEGER
+				    or tag_of(state, inst.operands[first + 1]) != Tag::INTEGER)
+					unproven++;
+			}
+			step(state, inst, shared);
+		}
+	}
+	return unproven;
+}
+
+} // namespace passes
@@ -0,0 +1,142 @@
+// Tail call elimination
+//
+// A function calling itself as the last thing it does needs nothing of its
+// frame after the call returns, so the call can reuse it: the parameters are
+// set to the arguments and the body is jumped back to, instead of pushing
+// them, calling, popping the result and returning it. Recursion in tail
+// position then runs in constant stack space, like a loop.
+//
+// A call is in tail position when every instruction after it up to the RET
+// only moves its result around, possibly through jumps, until it's pushed.
+// Arguments are box pointers, so assigning them to the parameters is the
+// same as popping them. When an argument is another parameter, they are all
+// copied to fresh registers first, as the parameters are assigned at once.
+
+#include <cassert>
+#include <cstddef>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "compiler.hpp"
+#include "lir.hpp"
+#include "passes.hpp"
+
+namespace compiler {
+
+using lir::Opcode;
+
+size_t Compiler::eliminate_tail_calls(Chunk& func) {
+	auto& vec = func.m_vec;
+	assert(vec.size() >= 3 and vec[0].opcode == Opcode::FUNC);
+
+	std::optional<size_t> self {};
+	for (const auto& [id, index] : func.label_indexes)
+		if (index == 0) self = id;
+	assert(self.has_value());
+
+	vector<Operand> params {};
+	size_t begin = 1;
+	while (vec[begin].opcode == Opcode::POP)
+		params.push_back(vec[begin++].operands[0]);
+	const auto n = params.size();
+
+	std::multimap<size_t, size_t> labels_at {};
+	for (const auto& [id, index] : func.label_indexes)
+		labels_at.insert({index, id});
+	auto labeled = [&](size_t from, size_t to) {
+		auto it = labels_at.lower_bound(from);
+		return it != labels_at.end() and it->first < to;
+	};
+
+	// whether the value popped at index i is returned as it is
+	auto returned = [&](size_t i) {
+		auto result = vec[i].operands[0];
+		auto j = i + 1;
+		for (size_t steps = 0; steps < vec.size() and j < vec.size(); steps++) {
+			const auto& inst = vec[j];
+			if (inst.opcode == Opcode::NOP) {
+				j++;
+			} else if (inst.opcode == Opcode::MOV
+			           and passes::same_operand(inst.operands[1], result)) {
+				result = inst.operands[0];
+				j++;
+			} else if (inst.opcode == Opcode::JMP) {
+				auto it = func.label_indexes.find(inst.operands[0].as_label().id);
+				if (it == func.label_indexes.end()) return false;
+				j = it->second;
+			} else {
+				return inst.opcode == Opcode::PUSH and j + 1 < vec.size()
+				   and vec[j + 1].opcode == Opcode::RET
+				   and passes::same_operand(inst.operands[0], result);
+			}
+		}
+		return false;
+	};
+
+	// tail calls by the index of their first PUSH
+	std::map<size_t, size_t> sites {};
+	for (size_t c = begin; c < vec.size(); c++) {
+		const auto& inst = vec[c];
+		if (inst.opcode != Opcode::CALL
+		    or inst.operands[0].type != Operand::Type::LABEL
+		    or inst.operands[0].as_label().id != self.value())
+			continue;
+		if (c < begin + n or c + 1 >= vec.size()
+		    or vec[c + 1].opcode != Opcode::POP)
+			continue;
+		bool pushed = true;
+		for (size_t i = c - n; i < c; i++)
+			pushed = pushed and vec[i].opcode == Opcode::PUSH;
+		if (not pushed or labeled(c - n + 1, c + 2) or not returned(c + 1))
+			continue;
+		sites[c - n] = c;
+	}
+	if (sites.empty()) return 0;
+
+	Chunk res {};
+	auto add_labels = [&](size_t index) {
+		auto [first, last] = labels_at.equal_range(index);
+		for (auto it = first; it != last; it++)
+			res.add_label(lir::Operand(lir::Label(it->second)));
+	};
+	auto body = make_label();
+	for (size_t i = 0; i < vec.size();) {
+		add_labels(i);
+		if (i == begin) res.add_label(body);
+		auto site = sites.find(i);
+		if (site == sites.end()) {
+			res.m_vec.push_back(std::move(vec[i++]));
+			continue;
+		}
+		auto c = site->second;
+
+		// the first parameter is pushed last
+		vector<Operand> args {};
+		for (size_t k = 0; k < n; k++) args.push_back(vec[c - 1 - k].operands[0]);
+		bool overlapping = false;
+		for (size_t k = 0; k < n; k++)
+			for (size_t j = 0; j < n; j++)
+				overlapping = overlapping
+				           or (j != k and passes::same_operand(args[k], params[j]));
+		if (overlapping)
+			for (auto& arg : args) {
+				auto copy = make_register();
+				res.emit(Opcode::MOV, copy, arg);
+				arg = copy;
+			}
+		for (size_t k = 0; k < n; k++)
+			if (not passes::same_operand(params[k], args[k]))
+				res.emit(Opcode::MOV, params[k], args[k]);
+		res.emit(Opcode::JMP, body).with_comment("tail call");
+		i = c + 2;
+	}
+	add_labels(vec.size());
+	res.result_opnd = std::move(func.result_opnd);
+	func = std::move(res);
+
+	return sites.size();
+}
+
+} // namespace compiler
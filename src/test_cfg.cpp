@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include "cfg.hpp"
+#include "lir.hpp"
+
+static lir::Operand make_int_reg(size_t idx) {
+	return lir::Operand(lir::Register(idx, lir::Type::make_integer()));
+}
+
+static lir::Operand make_label(size_t id) {
+	return lir::Operand(lir::Label {id});
+}
+
+// x = 0
+// L0: if x >= 10 goto L3
+//     y = 0
+// L1: if y >= 10 goto L2
+//     y = y + 1
+//     goto L1
+// L2: x = x + 1
+//     goto L0
+// L3: print x
+static lir::Chunk make_nested_loops() {
+	const auto x = make_int_reg(0);
+	const auto y = make_int_reg(1);
+	const auto zero = lir::Operand::make_immediate_integer(0);
+	const auto one = lir::Operand::make_immediate_integer(1);
+	const auto ten = lir::Operand::make_immediate_integer(10);
+
+	lir::Chunk chunk {};
+	chunk.emit_mov(x, zero);
+	chunk.add_label(make_label(0));
+	chunk.emit(lir::Opcode::JMP_GREATER_EQ, x, ten, make_label(3));
+	chunk.emit_mov(y, zero);
+	chunk.add_label(make_label(1));
+	chunk.emit(lir::Opcode::JMP_GREATER_EQ, y, ten, make_label(2));
+	chunk.emit_binop(BinaryOperator::PLUS, y, y, one);
+	chunk.emit_jmp(make_label(1));
+	chunk.add_label(make_label(2));
+	chunk.emit_binop(BinaryOperator::PLUS, x, x, one);
+	chunk.emit_jmp(make_label(0));
+	chunk.add_label(make_label(3));
+	chunk.emit(lir::Opcode::PRINTV, x);
+	return chunk;
+}
+
+TEST(CFGTest, blocks) {
+	const cfg::Graph graph {make_nested_loops()};
+
+	// entry, outer header, outer body, inner header, inner body, outer latch
+	// and exit
+	ASSERT_EQ(graph.blocks.size(), 7);
+	EXPECT_EQ(graph.entries, std::vector<size_t>({0}));
+	EXPECT_EQ(graph.label_blocks.at(0), 1);
+	EXPECT_EQ(graph.label_blocks.at(3), 6);
+
+	EXPECT_EQ(graph.blocks[0].successors, std::vector<size_t>({1}));
+	EXPECT_EQ(graph.blocks[1].successors, std::vector<size_t>({2, 6}));
+	EXPECT_EQ(graph.blocks[3].successors, std::vector<size_t>({4, 5}));
+	EXPECT_EQ(graph.blocks[4].successors, std::vector<size_t>({3}));
+	EXPECT_EQ(graph.blocks[4].fallthrough, cfg::none);
+	EXPECT_EQ(graph.blocks[1].predecessors, std::vector<size_t>({0, 5}));
+	EXPECT_TRUE(graph.blocks[6].successors.empty());
+}
+
+TEST(CFGTest, linearize) {
+	const auto chunk = make_nested_loops();
+	const auto same = cfg::linearize(cfg::Graph {chunk});
+	ASSERT_EQ(same.m_vec.size(), chunk.m_vec.size());
+	for (size_t i = 0; i < chunk.m_vec.size(); i++)
+		EXPECT_EQ(same.m_vec[i].opcode, chunk.m_vec[i].opcode);
+	EXPECT_EQ(same.label_indexes, chunk.label_indexes);
+
+	// moving the exit before the outer loop needs a jump to it, and one from
+	// the entry to the loop, which no longer follows it
+	cfg::Graph graph {chunk};
+	graph.layout = {0, 6, 1, 2, 3, 4, 5};
+	const auto moved = cfg::linearize(std::move(graph));
+	ASSERT_EQ(moved.m_vec.size(), chunk.m_vec.size() + 1);
+	EXPECT_EQ(moved.m_vec[1].opcode, lir::Opcode::JMP);
+	EXPECT_EQ(moved.m_vec[1].operands[0].as_label().id, 0);
+	EXPECT_EQ(moved.label_indexes.at(3), 2);
+	EXPECT_EQ(moved.label_indexes.at(0), 3);
+}
+
+TEST(CFGTest, dominators) {
+	const cfg::Graph graph {make_nested_loops()};
+	const cfg::Dominators dominators {graph};
+
+	EXPECT_EQ(dominators.idom[0], 0);
+	EXPECT_EQ(dominators.idom[1], 0);
+	EXPECT_EQ(dominators.idom[3], 2);
+	EXPECT_EQ(dominators.idom[5], 3);
+	EXPECT_EQ(dominators.idom[6], 1);
+	EXPECT_TRUE(dominators.dominates(1, 4));
+	EXPECT_TRUE(dominators.dominates(4, 4));
+	EXPECT_FALSE(dominators.dominates(4, 5));
+	EXPECT_FALSE(dominators.dominates(2, 6));
+	EXPECT_EQ(dominators.children[1], std::vector<size_t>({2, 6}));
+}
+
+TEST(CFGTest, loops) {
+	const cfg::Graph graph {make_nested_loops()};
+	const cfg::Loops loops {graph, cfg::Dominators {graph}};
+
+	ASSERT_EQ(loops.loops.size(), 2);
+	const auto& inner = loops.loops[0];
+	const auto& outer = loops.loops[1];
+	EXPECT_EQ(inner.header, 3);
+	EXPECT_EQ(inner.blocks, std::vector<size_t>({3, 4}));
+	EXPECT_EQ(inner.latches, std::vector<size_t>({4}));
+	EXPECT_EQ(inner.parent, 1);
+	EXPECT_EQ(inner.depth, 2);
+	EXPECT_EQ(outer.header, 1);
+	EXPECT_EQ(outer.blocks, std::vector<size_t>({1, 2, 3, 4, 5}));
+	EXPECT_EQ(outer.parent, cfg::none);
+	EXPECT_EQ(outer.depth, 1);
+
+	EXPECT_EQ(loops.innermost[0], cfg::none);
+	EXPECT_EQ(loops.innermost[2], 1);
+	EXPECT_EQ(loops.innermost[4], 0);
+	EXPECT_EQ(loops.innermost[6], cfg::none);
+}
+
+TEST(CFGTest, procedures) {
+	// main calls f and ends, f is only reached through the call
+	lir::Chunk chunk {};
+	chunk.emit(lir::Opcode::CALL, make_label(0));
+	chunk.emit(lir::Opcode::PRINTV, make_int_reg(0));
+	chunk.emit(lir::Opcode::RET);
+	chunk.add_label(make_label(0));
+	chunk.emit(lir::Opcode::FUNC);
+	chunk.emit(lir::Opcode::JMP_TRUE, make_int_reg(1), make_label(1));
+	chunk.emit(lir::Opcode::PRINTV, make_int_reg(1));
+	chunk.add_label(make_label(1));
+	chunk.emit(lir::Opcode::RET);
+
+	const cfg::Graph graph {chunk};
+	ASSERT_EQ(graph.blocks.size(), 4);
+	EXPECT_EQ(graph.entries, std::vector<size_t>({0, 1}));
+	EXPECT_TRUE(graph.blocks[0].successors.empty());
+
+	const cfg::Dominators dominators {graph};
+	EXPECT_EQ(dominators.idom[1], 1);
+	EXPECT_EQ(dominators.idom[3], 1);
+	EXPECT_FALSE(dominators.dominates(0, 3));
+	EXPECT_EQ(cfg::reverse_postorder(graph), std::vector<size_t>({0, 1, 2, 3}));
+
+	lir::Chunk dangling {};
+	dangling.emit_jmp(make_label(7));
+	EXPECT_THROW(cfg::Graph {dangling}, std::runtime_error);
+}
@@ -5,13 +5,18 @@
 #include <exception>
 #include <sstream>
 #include <stdexcept>
+#include <utility>
 #include <variant>
 
 #include "ast.hpp"
 #include "compiler.hpp"
 #include "lir.hpp"
+#include "parser.hpp"
+#include "passes.hpp"
 #include "str_pool.h"
+#include "string_reader.hpp"
 #include "typecheck.hpp"
+#include "vm.hpp"
 
 static bool compare_maps(
 	const std::map<size_t, size_t>& a, const std::map<size_t, size_t>& b
@@ -23,6 +28,9 @@ static bool operator==(const lir::Immediate& a, const lir::Immediate& b);
 static bool operator==(const lir::Function&, const lir::Function&);
 static bool operator==(const lir::Operand& a, const lir::Operand& b);
 static bool operator==(const lir::Chunk& a, const lir::Chunk& b);
+static std::string run_source(
+	std::string source, size_t* inlined = nullptr
+);
 
 bool compare_maps(
 	const std::map<size_t, size_t>& a, const std::map<size_t, size_t>& b
@@ -96,6 +104,9 @@ bool operator==(const lir::Operand& a, const lir::Operand& b) {
 		case lir::Operand::Type::FUN: {
 			return std::get<lir::Function>(a.data) == std::get<lir::Function>(b.data);
 		}
+		case lir::Operand::Type::STRING: {
+			return a.as_string().id == b.as_string().id;
+		}
 	}
 	return false;
 }
@@ -196,6 +207,442 @@ TEST(LIRTest, add_label) {
 	EXPECT_TRUE(chunk == expected);
 }
 
+TEST(LIRTest, link) {
+	lir::Chunk chunk {};
+	chunk.emit_jmp(lir::Operand(lir::Label(69)));
+	chunk.emit_mov(make_int_reg(0), lir::Operand::make_immediate_integer(1));
+	chunk.add_label(lir::Operand(lir::Label(69)));
+	lir::link(chunk);
+	EXPECT_EQ(chunk.m_vec[0].operands[0].as_label().id, 2);
+	EXPECT_EQ(chunk.label_indexes.at(2), 2);
+
+	lir::Chunk dangling {};
+	dangling.emit_jmp(lir::Operand(lir::Label(3)));
+	EXPECT_THROW(lir::link(dangling), std::runtime_error);
+}
+
+TEST(LIRTest, append) {
+	const auto one = lir::Operand::make_immediate_integer(1);
+	lir::Chunk chunk {};
+	chunk.emit_mov(make_int_reg(0), one);
+	chunk.add_label(lir::Operand(lir::Label(0)));
+
+	lir::Chunk other {};
+	other.add_label(lir::Operand(lir::Label(1)));
+	other.emit_mov(make_int_reg(1), one);
+	other.emit_jmp(lir::Operand(lir::Label(0)));
+	other.result_opnd = make_int_reg(1);
+
+	chunk.append(std::move(other));
+	ASSERT_EQ(chunk.m_vec.size(), 3);
+	EXPECT_EQ(chunk.m_vec[2].opcode, lir::Opcode::JMP);
+	EXPECT_EQ(chunk.label_indexes.at(0), 1);
+	EXPECT_EQ(chunk.label_indexes.at(1), 1);
+	EXPECT_TRUE(chunk.result_opnd.value() == make_int_reg(1));
+}
+
+TEST(PassesTest, promote_scalars) {
+	const auto zero = lir::Operand::make_immediate_integer(0);
+	const auto one = lir::Operand::make_immediate_integer(1);
+	const auto x = make_int_reg(0);
+	const auto y = make_int_reg(1);
+	const auto t = make_int_reg(2);
+
+	// x never escapes its box, but y is pushed to a function
+	lir::Chunk chunk {};
+	chunk.emit_alloca(x, one);
+	chunk.emit_storea(one, zero, x);
+	chunk.emit_loada(t, zero, x);
+	chunk.emit_alloca(y, one);
+	chunk.emit(lir::Opcode::PUSH, y);
+
+	EXPECT_EQ(passes::promote_scalars(chunk), 1);
+	passes::remove_nops(chunk);
+
+	ASSERT_EQ(chunk.m_vec.size(), 4);
+	EXPECT_EQ(chunk.m_vec[0].opcode, lir::Opcode::MOV);
+	EXPECT_TRUE(chunk.m_vec[0].operands[0] == x);
+	EXPECT_TRUE(chunk.m_vec[0].operands[1] == one);
+	EXPECT_EQ(chunk.m_vec[1].opcode, lir::Opcode::MOV);
+	EXPECT_TRUE(chunk.m_vec[1].operands[0] == t);
+	EXPECT_TRUE(chunk.m_vec[1].operands[1] == x);
+	EXPECT_EQ(chunk.m_vec[2].opcode, lir::Opcode::ALLOCA);
+}
+
+TEST(PassesTest, remove_nops) {
+	lir::Chunk chunk {};
+	chunk.emit_nop();
+	chunk.add_label(lir::Operand(lir::Label(0)));
+	chunk.emit_nop();
+	chunk.emit_jmp(lir::Operand(lir::Label(0)));
+	chunk.add_label(lir::Operand(lir::Label(1)));
+	passes::remove_nops(chunk);
+	ASSERT_EQ(chunk.m_vec.size(), 1);
+	EXPECT_EQ(chunk.label_indexes.at(0), 0);
+	EXPECT_EQ(chunk.label_indexes.at(1), 1);
+}
+
+TEST(PassesTest, peephole) {
+	const auto zero = lir::Operand::make_immediate_integer(0);
+	const auto one = lir::Operand::make_immediate_integer(1);
+	const auto x = make_int_reg(0);
+	const auto t = make_int_reg(1);
+	const auto c = make_int_reg(2);
+	const auto l0 = lir::Operand(lir::Label(0));
+	const auto l1 = lir::Operand(lir::Label(1));
+
+	auto make_chunk = [&]() {
+		lir::Chunk chunk {};
+		chunk.add_label(l0);
+		chunk.emit_binop(BinaryOperator::PLUS, t, x, one);
+		chunk.emit_mov(x, t);
+		chunk.emit(lir::Opcode::NOT, c, x);
+		chunk.emit(lir::Opcode::JMP_FALSE, c, l0);
+		chunk.emit_jmp(l1);
+		chunk.add_label(l1);
+		chunk.emit(lir::Opcode::PRINTV, x);
+		return chunk;
+	};
+
+	auto chunk = make_chunk();
+	auto report = passes::peephole(chunk);
+	EXPECT_EQ(report.total_removed(), 3);
+	EXPECT_EQ(report.removed[(size_t)passes::Pattern::MOVE_CHAIN], 1);
+	EXPECT_EQ(report.removed[(size_t)passes::Pattern::NOT_BRANCH], 1);
+	EXPECT_EQ(report.removed[(size_t)passes::Pattern::JUMP_NEXT], 1);
+
+	ASSERT_EQ(chunk.m_vec.size(), 3);
+	EXPECT_EQ(chunk.m_vec[0].opcode, lir::Opcode::ADD);
+	EXPECT_TRUE(chunk.m_vec[0].operands[0] == x);
+	EXPECT_EQ(chunk.m_vec[1].opcode, lir::Opcode::JMP_TRUE);
+	EXPECT_TRUE(chunk.m_vec[1].operands[0] == x);
+	EXPECT_EQ(chunk.label_indexes.at(0), 0);
+	EXPECT_EQ(chunk.label_indexes.at(1), 2);
+
+	// a load right after a store to the same cell reads the stored value
+	lir::Chunk store {};
+	store.emit_storea(one, zero, c);
+	store.emit_loada(t, zero, c);
+	store.emit(lir::Opcode::PRINTV, t);
+	report = passes::peephole(store);
+	EXPECT_EQ(report.applied[(size_t)passes::Pattern::STORE_LOAD], 1);
+	ASSERT_EQ(store.m_vec.size(), 3);
+	EXPECT_EQ(store.m_vec[1].opcode, lir::Opcode::MOV);
+	EXPECT_TRUE(store.m_vec[1].operands[1] == one);
+
+	// disabled patterns are left alone
+	passes::PeepholeOptions options {};
+	options.enabled.reset();
+	chunk = make_chunk();
+	report = passes::peephole(chunk, options);
+	EXPECT_EQ(report.total_removed(), 0);
+	EXPECT_EQ(chunk.m_vec.size(), 6);
+}
+
+TEST(PassesTest, propagate_constants) {
+	const auto one = lir::Operand::make_immediate_integer(1);
+	const auto two = lir::Operand::make_immediate_integer(2);
+	const auto x = make_int_reg(0);
+	const auto y = make_int_reg(1);
+	const auto c = make_int_reg(2);
+	const auto l0 = lir::Operand(lir::Label(0));
+	const auto l1 = lir::Operand(lir::Label(1));
+
+	// x is never assigned again, so the loop condition is always false
+	lir::Chunk chunk {};
+	chunk.emit_mov(x, one);
+	chunk.emit_mov(y, one);
+	chunk.add_label(l0);
+	chunk.emit(lir::Opcode::GREATER, c, x, two);
+	chunk.emit(lir::Opcode::JMP_FALSE, c, l1);
+	chunk.emit_binop(BinaryOperator::PLUS, y, y, x);
+	chunk.emit_jmp(l0);
+	chunk.add_label(l1);
+	chunk.emit(lir::Opcode::PRINTV, y);
+
+	auto report = passes::propagate_constants(chunk);
+	EXPECT_EQ(report.folded, 1);
+	EXPECT_EQ(report.branches, 1);
+	EXPECT_EQ(report.unreachable, 1);
+
+	ASSERT_EQ(chunk.m_vec.size(), 2);
+	EXPECT_EQ(chunk.m_vec[0].opcode, lir::Opcode::JMP);
+	EXPECT_EQ(chunk.m_vec[1].opcode, lir::Opcode::PRINTV);
+	EXPECT_TRUE(chunk.m_vec[1].operands[0] == one);
+
+	// y varies once the loop can run
+	chunk = {};
+	chunk.emit(lir::Opcode::READV, x);
+	chunk.emit_mov(y, one);
+	chunk.add_label(l0);
+	chunk.emit(lir::Opcode::GREATER, c, x, two);
+	chunk.emit(lir::Opcode::JMP_FALSE, c, l1);
+	chunk.emit_binop(BinaryOperator::PLUS, y, y, one);
+	chunk.emit_jmp(l0);
+	chunk.add_label(l1);
+	chunk.emit(lir::Opcode::PRINTV, y);
+
+	report = passes::propagate_constants(chunk);
+	EXPECT_EQ(report.branches, 0);
+	EXPECT_EQ(chunk.m_vec.size(), 7);
+	EXPECT_TRUE(chunk.m_vec[6].operands[0] == y);
+}
+
+TEST(PassesTest, hoist_invariants) {
+	const auto zero = lir::Operand::make_immediate_integer(0);
+	const auto one = lir::Operand::make_immediate_integer(1);
+	const auto ten = lir::Operand::make_immediate_integer(10);
+	const auto a = make_int_reg(0);
+	const auto i = make_int_reg(1);
+	const auto c = make_int_reg(2);
+	const auto t = make_int_reg(3);
+	const auto l0 = lir::Operand(lir::Label(0));
+	const auto l1 = lir::Operand(lir::Label(1));
+
+	// a + 1 is the same on every iteration, i + t isn't
+	lir::Chunk chunk {};
+	chunk.emit(lir::Opcode::READV, a);
+	chunk.emit_mov(i, zero);
+	chunk.add_label(l0);
+	chunk.emit(lir::Opcode::GREATER_EQ, c, i, ten);
+	chunk.emit(lir::Opcode::JMP_TRUE, c, l1);
+	chunk.emit_binop(BinaryOperator::PLUS, t, a, one);
+	chunk.emit_binop(BinaryOperator::PLUS, i, i, t);
+	chunk.emit_jmp(l0);
+	chunk.add_label(l1);
+	chunk.emit(lir::Opcode::PRINTV, i);
+
+	auto report = passes::hoist_invariants(chunk);
+	EXPECT_EQ(report.hoisted, 1);
+	EXPECT_EQ(report.loops, 1);
+	ASSERT_EQ(chunk.m_vec.size(), 8);
+	EXPECT_EQ(chunk.m_vec[2].opcode, lir::Opcode::ADD);
+	EXPECT_TRUE(chunk.m_vec[2].operands[0] == t);
+	EXPECT_EQ(chunk.label_indexes.at(0), 3);
+
+	// the load reads the cell stored to by the previous iteration
+	const auto b = make_int_reg(4);
+	chunk = {};
+	chunk.emit_alloca(b, one);
+	chunk.emit_storea(zero, zero, b);
+	chunk.add_label(l0);
+	chunk.emit_loada(t, zero, b);
+	chunk.emit_binop(BinaryOperator::PLUS, i, t, one);
+	chunk.emit_storea(i, zero, b);
+	chunk.emit(lir::Opcode::LESS, c, i, ten);
+	chunk.emit(lir::Opcode::JMP_TRUE, c, l0);
+
+	report = passes::hoist_invariants(chunk);
+	EXPECT_EQ(report.hoisted, 0);
+	EXPECT_EQ(chunk.m_vec[2].opcode, lir::Opcode::LOADA);
+
+	// a loop that never ends may not divide on every iteration
+	const auto five = lir::Operand::make_immediate_integer(5);
+	const auto d = make_int_reg(5);
+	chunk = {};
+	chunk.emit_mov(a, ten);
+	chunk.emit_mov(d, zero);
+	chunk.add_label(l0);
+	chunk.emit(lir::Opcode::READV, i);
+	chunk.emit(lir::Opcode::EQ, c, i, five);
+	chunk.emit(lir::Opcode::JMP_FALSE, c, l1);
+	chunk.emit(lir::Opcode::DIV, t, a, d);
+	chunk.emit(lir::Opcode::PRINTV, t);
+	chunk.emit_jmp(l0);
+	chunk.add_label(l1);
+	chunk.emit(lir::Opcode::PRINTV, i);
+	chunk.emit_jmp(l0);
+
+	report = passes::hoist_invariants(chunk);
+	EXPECT_EQ(report.hoisted, 0);
+	EXPECT_EQ(chunk.m_vec[5].opcode, lir::Opcode::DIV);
+
+	// the division would fault before the print of the first iteration
+	chunk = {};
+	chunk.emit_mov(a, ten);
+	chunk.emit(lir::Opcode::READV, d);
+	chunk.emit_mov(i, zero);
+	chunk.add_label(l0);
+	chunk.emit(lir::Opcode::PRINTV, i);
+	chunk.emit(lir::Opcode::DIV, t, a, d);
+	chunk.emit(lir::Opcode::GREATER, c, t, i);
+	chunk.emit(lir::Opcode::JMP_FALSE, c, l1);
+	chunk.emit_binop(BinaryOperator::PLUS, i, i, one);
+	chunk.emit_jmp(l0);
+	chunk.add_label(l1);
+
+	report = passes::hoist_invariants(chunk);
+	EXPECT_EQ(report.hoisted, 0);
+	EXPECT_EQ(chunk.m_vec[4].opcode, lir::Opcode::DIV);
+}
+
+TEST(PassesTest, eliminate_bounds_checks) {
+	const auto zero = lir::Operand::make_immediate_integer(0);
+	const auto one = lir::Operand::make_immediate_integer(1);
+	const auto ten = lir::Operand::make_immediate_integer(10);
+	const auto a = make_int_reg(0);
+	const auto i = make_int_reg(1);
+	const auto c = make_int_reg(2);
+	const auto p = make_int_reg(3);
+	const auto t = make_int_reg(4);
+	const auto l0 = lir::Operand(lir::Label(0));
+	const auto l1 = lir::Operand(lir::Label(1));
+
+	// i is below 10 inside the loop, and 10 once it's done
+	lir::Chunk chunk {};
+	chunk.emit_alloca(a, ten);
+	chunk.emit_mov(i, zero);
+	chunk.add_label(l0);
+	chunk.emit(lir::Opcode::EQ, c, i, ten);
+	chunk.emit(lir::Opcode::JMP_TRUE, c, l1);
+	chunk.emit_shifta(p, i, a);
+	chunk.emit_storea(i, zero, p);
+	chunk.emit_binop(BinaryOperator::PLUS, i, i, one);
+	chunk.emit_jmp(l0);
+	chunk.add_label(l1);
+	chunk.emit_loada(t, i, a);
+	chunk.emit(lir::Opcode::PRINTV, t);
+
+	auto report = passes::eliminate_bounds_checks(chunk);
+	EXPECT_EQ(report.accesses, 3);
+	EXPECT_EQ(report.unchecked, 2);
+	EXPECT_EQ(chunk.m_vec[4].opcode, lir::Opcode::SHIFTA_U);
+	EXPECT_EQ(chunk.m_vec[5].opcode, lir::Opcode::STOREA_U);
+	EXPECT_EQ(chunk.m_vec[8].opcode, lir::Opcode::LOADA);
+}
+
+TEST(PassesTest, specialize_types) {
+	const auto zero = lir::Operand::make_immediate_integer(0);
+	const auto one = lir::Operand::make_immediate_integer(1);
+	const auto a = make_int_reg(0);
+	const auto x = make_int_reg(1);
+	const auto y = make_int_reg(2);
+	const auto z = make_int_reg(3);
+	const auto l0 = lir::Operand(lir::Label(0));
+
+	// y was loaded from an array of integers, z from anything
+	lir::Chunk chunk {};
+	chunk.emit_alloca(a, one);
+	chunk.emit(lir::Opcode::READV, x);
+	chunk.emit_loada(y, zero, a).with_integer();
+	chunk.emit_loada(z, zero, a);
+	chunk.emit_binop(BinaryOperator::PLUS, x, x, y);
+	chunk.emit_binop(BinaryOperator::PLUS, z, z, one);
+	chunk.emit(lir::Opcode::JMP_LESS, x, one, l0);
+	chunk.emit(lir::Opcode::PRINTV, z);
+	chunk.add_label(l0);
+	chunk.emit(lir::Opcode::PRINTV, x);
+
+	auto report = passes::specialize_types(chunk);
+	EXPECT_EQ(report.operations, 3);
+	EXPECT_EQ(report.specialized, 2);
+	EXPECT_EQ(chunk.m_vec[4].opcode, lir::Opcode::ADD_I);
+	EXPECT_EQ(chunk.m_vec[5].opcode, lir::Opcode::ADD);
+	EXPECT_EQ(chunk.m_vec[6].opcode, lir::Opcode::JMP_LESS_I);
+	EXPECT_EQ(passes::verify_types(chunk), 0);
+
+	chunk.m_vec[5].opcode = lir::Opcode::ADD_I;
+	EXPECT_EQ(passes::verify_types(chunk), 1);
+}
+
+TEST(PassesTest, allocate_registers) {
+	const auto one = lir::Operand::make_immediate_integer(1);
+	const auto l0 = lir::Operand(lir::Label(0));
+	const auto l1 = lir::Operand(lir::Label(1));
+	auto index = [](const lir::Operand& opnd) {
+		return opnd.as_register().index;
+	};
+
+	// x is alive around the loop, the temporaries only inside of it. f has
+	// registers of its own
+	const auto x = make_int_reg(10);
+	lir::Chunk chunk {};
+	chunk.emit_mov(x, one);
+	chunk.add_label(l0);
+	chunk.emit_binop(BinaryOperator::PLUS, make_int_reg(11), x, one);
+	chunk.emit(lir::Opcode::PRINTV, make_int_reg(11));
+	chunk.emit_binop(BinaryOperator::PLUS, make_int_reg(12), x, one);
+	chunk.emit(lir::Opcode::PUSH, make_int_reg(12));
+	chunk.emit(lir::Opcode::CALL, l1);
+	chunk.emit(lir::Opcode::JMP_TRUE, x, l0);
+	chunk.emit(lir::Opcode::RET);
+	chunk.add_label(l1);
+	chunk.emit(lir::Opcode::FUNC);
+	chunk.emit(lir::Opcode::POP, make_int_reg(20));
+	chunk.emit(lir::Opcode::PRINTV, make_int_reg(20));
+	chunk.emit(lir::Opcode::RET);
+
+	auto report = passes::allocate_registers(chunk);
+	EXPECT_EQ(report.before, 21);
+	EXPECT_EQ(report.after, 3);
+
+	const auto& vec = chunk.m_vec;
+	const auto kept = index(vec[0].operands[0]);
+	EXPECT_EQ(index(vec[6].operands[0]), kept);
+	EXPECT_NE(index(vec[1].operands[0]), kept);
+	EXPECT_EQ(index(vec[1].operands[0]), index(vec[3].operands[0]));
+	EXPECT_NE(index(vec[9].operands[0]), kept);
+	EXPECT_NE(index(vec[9].operands[0]), index(vec[1].operands[0]));
+}
+
+TEST(PassesTest, materialize_strings) {
+	const auto zero = lir::Operand::make_immediate_integer(0);
+	const auto hi = lir::Operand(lir::String {0});
+
+	lir::Chunk chunk {};
+	chunk.add_label(lir::Operand(lir::Label(0)));
+	chunk.emit(lir::Opcode::PRINTF, hi);
+	chunk.emit_jmp(lir::Operand(lir::Label(0)));
+	chunk.strings = {"hi"};
+	chunk.result_opnd = hi;
+
+	passes::materialize_strings(chunk);
+
+	ASSERT_EQ(chunk.m_vec.size(), 5);
+	EXPECT_TRUE(chunk.strings.empty());
+	EXPECT_EQ(chunk.m_vec[0].opcode, lir::Opcode::ALLOCA);
+	EXPECT_EQ(chunk.m_vec[1].opcode, lir::Opcode::STOREA);
+	EXPECT_TRUE(chunk.m_vec[1].operands[1] == zero);
+	EXPECT_EQ(chunk.m_vec[2].opcode, lir::Opcode::STOREA);
+	EXPECT_TRUE(chunk.m_vec[3].operands[0] == make_int_reg(0));
+	EXPECT_TRUE(chunk.result_opnd.value() == make_int_reg(0));
+	EXPECT_EQ(chunk.label_indexes.at(0), 3);
+}
+
+TEST(CompilerTest, string_literals) {
+	StringPool pool {};
+	AST ast {};
+	{
+		(void)"do write_str \"hi\"; write_str \"hi\" end";
+		auto block = new_list_node(&ast, NodeType::BLK);
+		for (int i = 0; i < 2; i++) {
+			const auto _1 =
+				new_string_node(&ast, NodeType::ID, {}, pool, "write_str");
+			const auto _2 = new_string_node(&ast, NodeType::STR, {}, pool, "hi");
+			const auto _3 = new_list_node(&ast, NodeType::METALIST);
+			const auto _4 = list_append_node(&ast, _3, _2);
+			const auto _5 = new_node(&ast, NodeType::APP, {_1, _4});
+			block = list_append_node(&ast, block, _5);
+		}
+		ast.root_index = block;
+	}
+	Typechecker checker {ast, pool};
+	checker.typecheck();
+	compiler::Compiler comp {ast, pool, checker};
+	const auto chunk = comp.compile();
+
+	ASSERT_EQ(chunk.strings.size(), 1);
+	EXPECT_EQ(chunk.strings[0], "hi");
+	size_t prints = 0;
+	for (const auto& inst : chunk.m_vec) {
+		EXPECT_NE(inst.opcode, lir::Opcode::STOREA);
+		if (inst.opcode != lir::Opcode::PRINTF) continue;
+		prints++;
+		EXPECT_TRUE(inst.operands[0] == lir::Operand(lir::String {0}));
+	}
+	EXPECT_EQ(prints, 2);
+}
+
 TEST(CompilerTest, add_integers) {
 	StringPool pool {};
 	AST ast {};
@@ -213,16 +660,14 @@ TEST(CompilerTest, add_integers) {
 	{
 		const auto hp = lir::Operand::make_immediate_integer(2047);
 		const auto r0 = make_int_reg(0);
-		const auto r1 = make_int_reg(1);
 		const auto l0 = lir::Operand(lir::Label(0));
-		const auto c_one = lir::Operand::make_immediate_integer(1);
-		const auto c_two = lir::Operand::make_immediate_integer(2);
+		const auto c_three = lir::Operand::make_immediate_integer(3);
+		// the sum of constants is folded while compiling
 		expected
 			.emit_mov(r0, hp) //
 			.emit_jmp(l0)
-			.add_label(l0)
-			.emit_binop(BinaryOperator::PLUS, r1, c_one, c_two);
-		expected.result_opnd = r1;
+			.add_label(l0);
+		expected.result_opnd = c_three;
 	}
 	try {
 		auto are_equal = chunk == expected;
@@ -284,3 +729,92 @@ TEST(CompilerTest, let_expression) {
 		EXPECT_TRUE(false) << exn.what();
 	}
 }
+
+// compiles and optimizes a program like the interpreter does, and runs it.
+// the number of calls inlined is stored in inlined, if given
+std::string run_source(std::string source, size_t* inlined) {
+	StringReader reader {std::move(source)};
+	StringPool pool {};
+	AST ast = parse(&reader, pool);
+	Typechecker checker {ast, pool};
+	checker.typecheck();
+	compiler::Compiler comp {ast, pool, checker};
+	auto chunk = comp.compile();
+	if (inlined != nullptr) *inlined = comp.inlined;
+	passes::optimize(chunk);
+
+	std::istringstream input {""};
+	std::ostringstream output {};
+	lir::VM vm {input, output};
+	vm.should_print_result = false;
+	vm.run(chunk);
+	return output.str();
+}
+
+TEST(CompilerTest, string_literals_are_writable) {
+	// a literal may reach a variable through a call or a conditional
+	EXPECT_EQ(
+		run_source(
+			"let\n"
+			"\tfun f x = \"abc\",\n"
+			"\tvar s = f 1,\n"
+			"\tvar t = if 1 == 1 then \"xyz\" else \"uvw\"\n"
+			"in do s[0] = 'A'; t[0] = 'B'; write_str s; write_str t end\n"
+		),
+		"AbcByz"
+	);
+}
+
+TEST(CompilerTest, nested_inlining) {
+	// sq is inlined into sumsq, which is then inlined into both of its calls
+	size_t inlined = 0;
+	EXPECT_EQ(
+		run_source(
+			"let\n"
+			"\tfun sq x = x * x,\n"
+			"\tfun sumsq n = let var s = 0 in do\n"
+			"\t\tfor var i = 0 to n then s = s + (sq i); s\n"
+			"\tend\n"
+			"in do write_int (sumsq 5); write_int (sumsq 4) end\n",
+			&inlined
+		),
+		"3014"
+	);
+	EXPECT_EQ(inlined, 3);
+}
+
+TEST(CompilerTest, source_locations) {
+	StringPool pool {};
+	AST ast {};
+	{
+		(void)"do write_int 1;\n   write_int 2 end";
+		auto block = new_list_node(&ast, NodeType::BLK);
+		for (int i = 0; i < 2; i++) {
+			const auto _1 =
+				new_string_node(&ast, NodeType::ID, {}, pool, "write_int");
+			const auto _2 = new_number_node(&ast, {}, i + 1);
+			const auto _3 = new_list_node(&ast, NodeType::METALIST);
+			const auto _4 = list_append_node(&ast, _3, _2);
+			const auto _5 = new_node(&ast, NodeType::APP, {_1, _4});
+			ast.at(_5).loc = {{0, i, 3}, {0, i, 14}};
+			block = list_append_node(&ast, block, _5);
+		}
+		ast.root_index = block;
+	}
+	Typechecker checker {ast, pool};
+	checker.typecheck();
+	compiler::Compiler comp {ast, pool, checker};
+	auto chunk = comp.compile();
+	passes::optimize(chunk);
+
+	// each print keeps the location of the call it was compiled from
+	int line = 0;
+	for (const auto& inst : chunk.m_vec) {
+		if (inst.opcode != lir::Opcode::PRINTV) continue;
+		ASSERT_TRUE(inst.location.has_value());
+		EXPECT_EQ(inst.location->begin.line, line);
+		EXPECT_EQ(inst.location->begin.column, 3);
+		line++;
+	}
+	EXPECT_EQ(line, 2);
+}
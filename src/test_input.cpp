@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+
+#include "input.hpp"
+
+TEST(InputTest, lines) {
+	std::istringstream stream {"12\n  -7 trailing\n\n+3\nlast"};
+	Input input {stream};
+	EXPECT_EQ(input.line(), "12");
+	EXPECT_EQ(input.line(), "  -7 trailing");
+	EXPECT_EQ(input.line(), "");
+	EXPECT_EQ(input.line(), "+3");
+	EXPECT_EQ(input.line(), "last");
+	EXPECT_EQ(input.line(), std::nullopt);
+}
+
+TEST(InputTest, parse_integer) {
+	EXPECT_EQ(Input::parse_integer("42"), 42);
+	EXPECT_EQ(Input::parse_integer("  -7 trailing"), -7);
+	EXPECT_EQ(Input::parse_integer("+3"), 3);
+	EXPECT_EQ(Input::parse_integer("2147483647"), 2147483647);
+	EXPECT_EQ(Input::parse_integer("-2147483648"), -2147483648);
+	EXPECT_EQ(Input::parse_integer("2147483648"), std::nullopt);
+	EXPECT_EQ(Input::parse_integer("-2147483649"), std::nullopt);
+	EXPECT_EQ(Input::parse_integer(""), std::nullopt);
+	EXPECT_EQ(Input::parse_integer("-"), std::nullopt);
+	EXPECT_EQ(Input::parse_integer("x1"), std::nullopt);
+}
+
+TEST(InputTest, non_space) {
+	std::istringstream stream {" \n a\tb\n1\n"};
+	Input input {stream};
+	EXPECT_EQ(input.non_space(), 'a');
+	EXPECT_EQ(input.non_space(), 'b');
+	// a line is read from right after the character
+	EXPECT_EQ(input.line(), "");
+	EXPECT_EQ(input.line(), "1");
+	EXPECT_EQ(input.non_space(), std::nullopt);
+}
+
+TEST(InputTest, large_input) {
+	std::string text {};
+	for (int i = 0; i < 100000; i++) text += std::to_string(i) + '\n';
+	std::string large(3 * Input::capacity, 'x');
+	text += large + '\n';
+
+	std::istringstream stream {text};
+	Input input {stream};
+	for (int i = 0; i < 100000; i++) {
+		auto line = input.line();
+		ASSERT_TRUE(line.has_value());
+		EXPECT_EQ(Input::parse_integer(line.value()), i);
+	}
+	EXPECT_EQ(input.line(), large);
+	EXPECT_EQ(input.line(), std::nullopt);
+}
+
+TEST(InputTest, shared_stream) {
+	// what isn't asked for is left to whoever else reads the stream
+	std::istringstream stream {"42\n  x rest\nwrite_int 7\n"};
+	{
+		Input input {stream, true};
+		EXPECT_EQ(input.line(), "42");
+		EXPECT_EQ(input.non_space(), 'x');
+	}
+	std::string rest {};
+	std::getline(stream, rest);
+	EXPECT_EQ(rest, " rest");
+	std::getline(stream, rest);
+	EXPECT_EQ(rest, "write_int 7");
+}
@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+
+#include "output.hpp"
+
+TEST(OutputTest, integers_and_characters) {
+	std::ostringstream stream {};
+	{
+		Output output {stream};
+		output.write(0);
+		output.put(' ');
+		output.write(-42);
+		output.put(' ');
+		output.write(std::numeric_limits<std::int64_t>::min());
+		output.write(" and ");
+		output.write(std::numeric_limits<std::int64_t>::max());
+		output.put('\n');
+		// nothing reaches the stream until it's flushed
+		EXPECT_EQ(stream.str(), "");
+	}
+	EXPECT_EQ(
+		stream.str(), "0 -42 -9223372036854775808 and 9223372036854775807\n"
+	);
+}
+
+TEST(OutputTest, large_writes) {
+	std::ostringstream stream {};
+	Output output {stream};
+	std::string expected {};
+	for (std::int64_t i = 0; i < 100000; i++) {
+		output.write(i);
+		output.put(',');
+		expected += std::to_string(i) + ',';
+	}
+	std::string large(2 * Output::capacity, 'x');
+	output.write(large);
+	expected += large;
+	output.write("end");
+	expected += "end";
+
+	// the buffer was handed over whenever it filled up
+	EXPECT_GT(stream.str().size(), 0);
+	output.flush();
+	EXPECT_EQ(stream.str(), expected);
+}
@@ -1,9 +1,12 @@
 #include <gtest/gtest.h>
 
 #include <sstream>
+#include <stdexcept>
 #include <string>
 
+#include "bytecode.hpp"
 #include "lir.hpp"
+#include "passes.hpp"
 #include "vm.hpp"
 
 static lir::Operand make_integer_register(std::size_t index) {
@@ -76,6 +79,12 @@ TEST(VMTest, arithmetic) {
 	vm.run(chunk);
 
 	EXPECT_EQ(vm.cells[c.as_register().index].as_integer(), 36);
+
+	// dividing by zero is an error, so that the output so far isn't lost
+	lir::Chunk zero {};
+	zero.emit(lir::Opcode::MOV, b, lir::Operand::make_immediate_integer(0));
+	zero.emit(lir::Opcode::DIV, c, a, b);
+	EXPECT_THROW(vm.run(zero), std::runtime_error);
 }
 
 TEST(VMTest, push_immediate) {
@@ -183,6 +192,75 @@ TEST(VMTest, function_call) {
 	EXPECT_EQ(integer_value, 4);
 }
 
+TEST(VMTest, profile) {
+	// let fun f x = x + 1 in f (f 3), with a location on the addition
+	auto imm_one = lir::Operand::make_immediate_integer(1);
+	auto imm_three = lir::Operand::make_immediate_integer(3);
+	auto l0 = lir::Operand(lir::Label {0});
+	auto l1 = lir::Operand(lir::Label {1});
+	auto r0 = make_integer_register(0);
+	auto r1 = make_integer_register(1);
+	auto r2 = make_integer_register(2);
+	auto r3 = make_integer_register(3);
+
+	lir::Chunk chunk {};
+	chunk.emit(lir::Opcode::JMP, l0);
+	chunk.add_label(l1);
+	chunk.emit(lir::Opcode::FUNC);
+	chunk.emit(lir::Opcode::POP, r0);
+	chunk.emit(lir::Opcode::ADD, r1, r0, imm_one);
+	chunk.m_vec.back().location = Location {{0, 4, 2}, {0, 4, 7}};
+	chunk.emit(lir::Opcode::PUSH, r1);
+	chunk.emit(lir::Opcode::RET);
+	chunk.add_label(l0);
+	chunk.emit(lir::Opcode::PUSH, imm_three);
+	chunk.emit(lir::Opcode::CALL, l1);
+	chunk.emit(lir::Opcode::CALL, l1);
+	chunk.emit(lir::Opcode::POP, r2);
+	chunk.emit(lir::Opcode::ALLOCA, r3, imm_one);
+
+	std::istringstream input {""};
+	std::ostringstream output {};
+	lir::VM vm {input, output};
+	vm.should_print_result = false;
+	vm.should_profile = true;
+	vm.run(chunk);
+	EXPECT_EQ(vm.cells[2].as_integer(), 5);
+
+	const auto& profile = vm.profile;
+	// the jump, 2 calls of 5 codes each, 5 codes of the program and HALT
+	EXPECT_EQ(profile.total_instructions(), 1 + 2 * 5 + 5 + 1);
+	EXPECT_EQ(profile.calls(), 2);
+	EXPECT_EQ(profile.allocations(), 1);
+	EXPECT_EQ(profile.peak_stack_depth(), 2);
+
+	auto opcodes = profile.by_opcode();
+	EXPECT_EQ(opcodes[bytecode::Opcode::FUNC].executions, 2);
+	EXPECT_EQ(opcodes[bytecode::Opcode::HALT].executions, 1);
+	auto lines = profile.by_line();
+	ASSERT_EQ(lines.size(), 1);
+	EXPECT_EQ(lines.begin()->first, 5);
+	EXPECT_EQ(lines.begin()->second.executions, 2);
+
+	std::ostringstream json {};
+	profile.write_json(json);
+	EXPECT_TRUE(
+		json.str().starts_with(
+			"{\"total_instructions\": 17, \"total_cycles\": "
+			+ std::to_string(profile.total_cycles())
+			+ ", \"calls\": 2, \"allocations\": 1, \"peak_stack_depth\": 2, "
+		)
+	);
+	EXPECT_NE(
+		json.str().find("\"lines\": {\"5\": {\"executions\": 2, "),
+		std::string::npos
+	);
+
+	std::ostringstream report {};
+	profile.report(report);
+	EXPECT_NE(report.str().find("5:3"), std::string::npos);
+}
+
 TEST(VMTest, function_integer_out_parameter) {
 	// The following:
 
@@ -438,3 +516,315 @@ TEST(VMTest, io_operations) {
 
 	EXPECT_STREQ(output.str().c_str(), expected.c_str());
 }
+
+TEST(BytecodeTest, lower_resolves_labels) {
+	auto l0 = lir::Operand(lir::Label {0});
+	auto r3 = make_integer_register(3);
+
+	lir::Chunk chunk {};
+	chunk.emit_jmp(l0);
+	chunk.emit_mov(r3, lir::Operand::make_immediate_integer(1));
+	chunk.add_label(l0);
+	chunk.emit_mov(r3, lir::Operand::make_immediate_integer(-2));
+
+	auto code = bytecode::lower(chunk);
+
+	ASSERT_EQ(code.codes.size(), 4);
+	EXPECT_EQ(code.register_count, 4);
+	EXPECT_EQ(code.codes[0].opcode, bytecode::Opcode::JMP);
+	EXPECT_EQ(code.codes[0].kind(0), bytecode::Kind::OFFSET);
+	EXPECT_EQ(code.codes[0].operands[0], 2);
+	EXPECT_EQ(code.codes[2].kind(0), bytecode::Kind::REGISTER);
+	EXPECT_EQ(code.codes[2].kind(1), bytecode::Kind::IMMEDIATE);
+	EXPECT_EQ(code.codes[2].kind(2), bytecode::Kind::NOTHING);
+	EXPECT_EQ(code.codes[2].operands[1], -2);
+	EXPECT_EQ(code.codes[3].opcode, bytecode::Opcode::HALT);
+
+	std::istringstream input {""};
+	std::ostringstream output {};
+
+	lir::VM vm {input, output};
+	vm.should_print_result = false;
+	vm.run(code);
+
+	EXPECT_EQ(vm.cells[3].as_integer(), -2);
+}
+
+TEST(ValueTest, tags) {
+	lir::Value undefined {};
+	EXPECT_TRUE(undefined.is_undefined());
+	EXPECT_THROW(undefined.as_integer(), std::runtime_error);
+
+	lir::Value integer {-7};
+	EXPECT_TRUE(integer.is_integer());
+	EXPECT_EQ(integer.as_integer(), -7);
+	EXPECT_THROW(integer.as_pointer(), std::runtime_error);
+
+	lir::Value cells[2] {1, 2};
+	lir::Value pointer {cells, 2};
+	EXPECT_TRUE(pointer.is_pointer());
+	EXPECT_EQ((*pointer.as_pointer()[1]).as_integer(), 2);
+	EXPECT_THROW(pointer.as_pointer()[2], std::runtime_error);
+}
+
+TEST(BytecodeTest, lower_assigns_register_windows) {
+	auto l0 = lir::Operand(lir::Label {0});
+	auto l1 = lir::Operand(lir::Label {1});
+	auto r0 = make_integer_register(0);
+	auto r1 = make_integer_register(1);
+	auto r2 = make_integer_register(2);
+
+	// r1 and r2 are only used by the function, r0 by the main program
+	lir::Chunk chunk {};
+	chunk.emit_jmp(l0);
+	chunk.add_label(l1);
+	chunk.emit(lir::Opcode::FUNC);
+	chunk.emit(lir::Opcode::POP, r1);
+	chunk.emit(lir::Opcode::ADD, r2, r1, lir::Operand::make_immediate_integer(1));
+	chunk.emit(lir::Opcode::PUSH, r2);
+	chunk.emit(lir::Opcode::RET);
+	chunk.add_label(l0);
+	chunk.emit(lir::Opcode::PUSH, lir::Operand::make_immediate_integer(41));
+	chunk.emit(lir::Opcode::CALL, l1);
+	chunk.emit(lir::Opcode::POP, r0);
+
+	auto code = bytecode::lower(chunk);
+
+	EXPECT_EQ(code.register_count, 1);
+	EXPECT_EQ(code.codes[1].opcode, bytecode::Opcode::FUNC);
+	EXPECT_EQ(code.codes[1].operands[0], 2);
+	EXPECT_EQ(code.codes[2].kind(0), bytecode::Kind::LOCAL);
+	EXPECT_EQ(code.codes[3].kind(0), bytecode::Kind::LOCAL);
+	EXPECT_EQ(code.codes[8].kind(0), bytecode::Kind::REGISTER);
+
+	std::istringstream input {""};
+	std::ostringstream output {};
+
+	lir::VM vm {input, output};
+	vm.should_print_result = false;
+	vm.run(code);
+
+	EXPECT_EQ(vm.cells[0].as_integer(), 42);
+	EXPECT_TRUE(vm.frames.empty());
+}
+
+TEST(BytecodeTest, verify) {
+	auto l0 = lir::Operand(lir::Label {0});
+	auto l1 = lir::Operand(lir::Label {1});
+	auto r0 = make_integer_register(0);
+	auto r1 = make_integer_register(1);
+	auto one = lir::Operand::make_immediate_integer(1);
+
+	// the function pops its argument and pushes its result, so the program
+	// pushes one value before calling it
+	lir::Chunk chunk {};
+	chunk.emit_jmp(l0);
+	chunk.add_label(l1);
+	chunk.emit(lir::Opcode::FUNC);
+	chunk.emit(lir::Opcode::POP, r1);
+	chunk.emit(lir::Opcode::PUSH, r1);
+	chunk.emit(lir::Opcode::RET);
+	chunk.add_label(l0);
+	chunk.emit(lir::Opcode::PUSH, one);
+	chunk.emit(lir::Opcode::CALL, l1);
+	chunk.emit(lir::Opcode::POP, r0);
+	auto code = bytecode::lower(chunk);
+	EXPECT_NO_THROW(bytecode::verify(code));
+
+	auto unbalanced = chunk;
+	unbalanced.m_vec.erase(unbalanced.m_vec.begin() + 5);
+	EXPECT_THROW(
+		bytecode::verify(bytecode::lower(unbalanced)), std::runtime_error
+	);
+
+	auto kind = code;
+	kind.codes[5].set_kind(0, bytecode::Kind::OFFSET);
+	EXPECT_THROW(bytecode::verify(kind), std::runtime_error);
+
+	auto window = code;
+	window.codes[2].operands[0] = 1;
+	EXPECT_THROW(bytecode::verify(window), std::runtime_error);
+
+	auto offset = code;
+	offset.codes[0].operands[0] = 100;
+	EXPECT_THROW(bytecode::verify(offset), std::runtime_error);
+
+	lir::Chunk ret {};
+	ret.emit(lir::Opcode::RET);
+	EXPECT_THROW(bytecode::verify(bytecode::lower(ret)), std::runtime_error);
+
+	// checked before anything runs
+	std::istringstream input {""};
+	std::ostringstream output {};
+	lir::VM vm {input, output};
+	vm.should_print_result = false;
+	EXPECT_THROW(vm.run(unbalanced), std::runtime_error);
+}
+
+TEST(BytecodeTest, quicken) {
+	auto l0 = lir::Operand(lir::Label {0});
+	auto l1 = lir::Operand(lir::Label {1});
+	auto r0 = make_integer_register(0);
+	auto r1 = make_integer_register(1);
+	auto r2 = make_integer_register(2);
+	auto r3 = make_integer_register(3);
+	auto one = lir::Operand::make_immediate_integer(1);
+
+	// r0 is global, and only in the main program's window
+	lir::Chunk chunk {};
+	chunk.emit_mov(r0, lir::Operand::make_immediate_integer(5));
+	chunk.emit(lir::Opcode::ADD_I, r1, r0, one);
+	chunk.emit(lir::Opcode::LESS_I, r2, one, r0);
+	chunk.emit(lir::Opcode::SUB_I, r2, one, r0);
+	chunk.emit(lir::Opcode::JMP_LESS_I, r1, r0, l0);
+	chunk.emit(lir::Opcode::CALL, l1);
+	chunk.add_label(l0);
+	chunk.emit_jmp(l0);
+	chunk.add_label(l1);
+	chunk.emit(lir::Opcode::FUNC);
+	chunk.emit(lir::Opcode::ADD_I, r3, r3, one);
+	chunk.emit(lir::Opcode::ADD_I, r0, r3, one);
+	chunk.emit(lir::Opcode::RET);
+
+	auto code = bytecode::lower(chunk);
+	auto quick = bytecode::quicken(code);
+	ASSERT_EQ(quick.size(), code.codes.size());
+	EXPECT_EQ(quick[0].opcode, bytecode::Opcode::MOV_I);
+	EXPECT_EQ(quick[1].opcode, bytecode::Opcode::ADD_I_RI);
+	EXPECT_EQ(quick[2].opcode, bytecode::Opcode::GREATER_I_RI);
+	EXPECT_EQ(quick[2].operands[1], code.codes[2].operands[2]);
+	EXPECT_EQ(quick[2].operands[2], 1);
+	EXPECT_EQ(quick[3].opcode, bytecode::Opcode::SUB_I);
+	EXPECT_EQ(quick[4].opcode, bytecode::Opcode::JMP_LESS_I_RR);
+	EXPECT_EQ(quick[8].opcode, bytecode::Opcode::ADD_I_RI);
+	EXPECT_EQ(quick[9].opcode, bytecode::Opcode::ADD_I);
+
+	// quickened chunks are only made by the VM
+	auto quickened = code;
+	quickened.codes = quick;
+	EXPECT_THROW(bytecode::verify(quickened), std::runtime_error);
+}
+
+TEST(ArenaTest, release_to_mark) {
+	lir::Arena arena {4};
+	auto* a = arena.allocate(2);
+	auto mark = arena.mark();
+	auto* b = arena.allocate(3);
+	auto* c = arena.allocate(10);
+	EXPECT_TRUE(a[1].is_undefined());
+	EXPECT_FALSE(arena.allocated_since(mark, a));
+	EXPECT_TRUE(arena.allocated_since(mark, b + 2));
+	EXPECT_TRUE(arena.allocated_since(mark, c + 9));
+	EXPECT_EQ(arena.stats().current, 15 * sizeof(lir::Value));
+
+	arena.release(mark);
+	EXPECT_EQ(arena.stats().current, 2 * sizeof(lir::Value));
+	EXPECT_EQ(arena.stats().peak, 15 * sizeof(lir::Value));
+	EXPECT_FALSE(arena.allocated_since(mark, b));
+
+	arena.reset();
+	EXPECT_EQ(arena.stats().current, 0);
+}
+
+TEST(ArenaTest, collect) {
+	lir::Arena arena {8};
+	auto* garbage = arena.allocate(4);
+	auto* array = arena.allocate(3);
+	auto* box = arena.allocate(1);
+	garbage[0] = 1;
+	array[2] = 42;
+	// the box points to the middle of the array
+	box[0] = lir::Value(array + 1, 2);
+
+	lir::Value root {box, 1};
+	arena.collect({&root});
+
+	EXPECT_EQ(arena.stats().current, 4 * sizeof(lir::Value));
+	EXPECT_EQ(arena.stats().collections, 1);
+	EXPECT_EQ(arena.stats().collected, 4 * sizeof(lir::Value));
+	ASSERT_TRUE(root.is_pointer());
+	EXPECT_NE(root.as_pointer().address(), (void*)box);
+	auto inner = (*root.as_pointer()).as_pointer();
+	EXPECT_EQ(inner.size(), 2);
+	EXPECT_EQ((*inner[1]).as_integer(), 42);
+}
+
+TEST(VMTest, string_constants) {
+	const auto r0 = make_array_register(0);
+	const auto r1 = make_array_register(1);
+	const auto zero = lir::Operand::make_immediate_integer(0);
+	const auto x = lir::Operand::make_immediate_integer('x');
+	const auto ab = lir::Operand(lir::String {0});
+
+	// clones of a string constant can be written to
+	lir::Chunk chunk {};
+	chunk.emit(lir::Opcode::PRINTF, ab);
+	chunk.emit_clonea(r0, ab);
+	chunk.emit_storea(x, zero, r0);
+	chunk.emit(lir::Opcode::PRINTF, r0);
+	chunk.emit(lir::Opcode::PRINTF, ab);
+	chunk.strings = {"ab"};
+
+	std::istringstream input {};
+	std::ostringstream output {};
+	lir::VM vm {input, output};
+	vm.should_print_result = false;
+	vm.run(chunk);
+	EXPECT_EQ(output.str(), "abxbab");
+
+	// but the constant itself can't
+	lir::Chunk store {};
+	store.emit_mov(r1, ab);
+	store.emit_storea(x, zero, r1);
+	store.strings = {"ab"};
+	EXPECT_THROW(vm.run(store), std::runtime_error);
+}
+
+TEST(VMTest, superinstructions) {
+	const auto a = make_array_register(0);
+	const auto i = make_integer_register(1);
+	const auto c = make_integer_register(2);
+	const auto t = make_integer_register(3);
+	const auto s = make_integer_register(4);
+	const auto r = make_integer_register(5);
+	const auto zero = lir::Operand::make_immediate_integer(0);
+	const auto one = lir::Operand::make_immediate_integer(1);
+	const auto three = lir::Operand::make_immediate_integer(3);
+	const auto loop = lir::Operand(lir::Label(0));
+	const auto end = lir::Operand(lir::Label(1));
+
+	// a[0] = 0 + 1 + 2
+	lir::Chunk chunk {};
+	chunk.emit_alloca(a, one);
+	chunk.emit_storea(zero, zero, a);
+	chunk.emit_mov(i, zero);
+	chunk.add_label(loop);
+	chunk.emit(lir::Opcode::EQ, c, i, three);
+	chunk.emit(lir::Opcode::JMP_TRUE, c, end);
+	chunk.emit_loada(t, zero, a);
+	chunk.emit(lir::Opcode::ADD, s, t, i);
+	chunk.emit_storea(s, zero, a);
+	chunk.emit(lir::Opcode::ADD, i, i, one);
+	chunk.emit_jmp(loop);
+	chunk.add_label(end);
+	chunk.emit_loada(r, zero, a);
+	chunk.emit(lir::Opcode::PRINTV, r);
+
+	auto fused = chunk;
+	auto report = passes::select_superinstructions(fused);
+	EXPECT_EQ(report.compare_jumps, 1);
+	EXPECT_EQ(report.array_updates, 1);
+	ASSERT_EQ(fused.m_vec.size(), chunk.m_vec.size() - 3);
+	EXPECT_EQ(fused.m_vec[3].opcode, lir::Opcode::JMP_EQ);
+	EXPECT_EQ(fused.m_vec[4].opcode, lir::Opcode::ADDA);
+	EXPECT_EQ(fused.label_indexes.at(1), 7);
+
+	for (const auto* code : {&chunk, &fused}) {
+		std::istringstream input {};
+		std::ostringstream output {};
+		lir::VM vm {input, output};
+		vm.should_print_result = false;
+		vm.run(*code);
+		EXPECT_EQ(output.str(), "3");
+	}
+}
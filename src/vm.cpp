@@ -1,5 +1,6 @@
 #include "vm.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
@@ -7,47 +8,22 @@
 #include <iostream>
 #include <memory>
 #include <stdexcept>
+#include <utility>
 
 #include "lir.hpp"
 
-using lir::Operand;
+using bytecode::Code;
+using bytecode::Kind;
 
-template<typename... Args>
-std::string join(Args&&... args) {
-	std::string result;
-	((result += std::format("{} ", std::forward<Args>(args))), ...);
-	return result;
-}
-
-template<typename T, typename... Args>
-void assert_oneof(T v, Args&&... args) {
-	if (not((v == args) || ...)) {
-		throw std::domain_error(
-			std::format("value {} is not one of {}", v, join(args...))
-		);
-	}
-}
-
-template<>
-struct std::formatter<Operand::Type> {
-	constexpr auto parse(std::format_parse_context& ctx) { return ctx.begin(); }
-	auto format(const Operand::Type& opnd_ty, std::format_context& ctx) const {
-		switch (opnd_ty) {
-			case lir::Operand::Type::NOTHING:
-				return std::format_to(ctx.out(), "NOTHING");
-			case lir::Operand::Type::REGISTER:
-				return std::format_to(ctx.out(), "REGISTER");
-			case lir::Operand::Type::LABEL: return std::format_to(ctx.out(), "LABEL");
-			case lir::Operand::Type::IMMEDIATE:
-				return std::format_to(ctx.out(), "IMMEDIATE");
-			case lir::Operand::Type::FUN: return std::format_to(ctx.out(), "FUN");
-		}
-		assert(false);
-	}
-};
+// labels as values are a GNU extension, other compilers get the switch
+#if defined(THREADED_DISPATCH) && defined(__GNUC__)
+#define VM_THREADED_DISPATCH 1
+#else
+#define VM_THREADED_DISPATCH 0
+#endif
 
 namespace lir {
-static Value clone(Value);
+static Value clone(Arena& heap, Value);
 static void err(const char* msg);
 
 void err(const char* msg) {
@@ -55,266 +31,476 @@ void err(const char* msg) {
 	exit(1);
 }
 
-void VM::run(const lir::Chunk& code) {
-	// cells.fill(Value(0));
-	size_t return_address = 0;
+void VM::run(const lir::Chunk& chunk) { run(bytecode::lower(chunk)); }
 
-	auto deref = [&](Operand opnd) -> Value& {
-		if (opnd.type == Operand::Type::REGISTER) {
-			return cells[opnd.as_register().index];
-		} else {
-			fprintf(stderr, "%s\n", operand_type_repr(opnd.type));
-			exit(1);
-		}
+#if VM_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+void VM::run(const bytecode::Chunk& chunk) {
+	using bytecode::Opcode;
+
+	// instructions are checked once here instead of every time they run: the
+	// handlers below trust the kinds of their operands, that registers and
+	// offsets are within bounds, that RET happens inside a call and that POP
+	// finds a value
+	bytecode::verify(chunk);
+
+	// global registers sit at the bottom of the value stack, and every call
+	// gets a register window above the one of its caller
+	heap.reset();
+	cells.assign(std::max(cells.size(), chunk.register_count), Value());
+	frames.clear();
+	size_t base = 0;
+	size_t top = chunk.register_count;
+
+	// string operands read as read-only pointers into the string segment
+	strings.clear();
+	for (const auto& str : chunk.strings)
+		for (char c : str) strings.push_back(Value((Value::Integer)c));
+	std::vector<Value> literals {};
+	literals.reserve(chunk.strings.size());
+	for (size_t offset = 0; const auto& str : chunk.strings) {
+		literals.push_back(Value(strings.data() + offset, str.size(), true));
+		offset += str.size();
+	}
+
+	auto reg = [&](const Code& code, size_t i) -> Value& {
+		if (code.kind(i) == Kind::LOCAL)
+			return cells[base + (size_t)code.operands[i]];
+		return cells[(size_t)code.operands[i]];
 	};
 
-	auto fetch = [&](Operand opnd) -> Value {
-		if (opnd.type == Operand::Type::REGISTER) {
-			return cells[opnd.as_register().index];
-		} else if (opnd.type == Operand::Type::IMMEDIATE) {
-			return opnd.as_immediate().number;
-		} else if (opnd.type == Operand::Type::NOTHING) {
-			return 0;
-		} else {
-			fprintf(stderr, "%s\n", operand_type_repr(opnd.type));
-			exit(1);
+	auto fetch = [&](const Code& code, size_t i) -> Value {
+		switch (code.kind(i)) {
+			case Kind::REGISTER:
+			case Kind::LOCAL: return reg(code, i);
+			case Kind::IMMEDIATE: return code.operands[i];
+			case Kind::STRING: return literals[(size_t)code.operands[i]];
+			case Kind::NOTHING: return 0;
+			case Kind::OFFSET: break;
 		}
+		std::unreachable();
 	};
 
+	const auto quickened = bytecode::quicken(chunk);
+	const auto* codes = quickened.data();
+
+	// when profiling, every code is counted before it runs, along with the
+	// calls and allocations it makes. a call is as deep as the frames below it
+	// and the program itself
+	if (should_profile) profile.reset(chunk, quickened);
+	auto profile_code = [&](size_t pc, Opcode opcode) {
+		profile.enter(pc);
+		if (opcode == Opcode::CALL)
+			profile.call(frames.size() + 2);
+		else if (opcode == Opcode::ALLOCA or opcode == Opcode::CLONEA)
+			profile.allocation();
+	};
+
+	// with threaded dispatch every handler jumps straight to the next one
+	// through the label table, instead of going back to a shared switch. the
+	// bodies are the same for both modes: VM_CASE names a handler, VM_NEXT
+	// ends it and VM_DISPATCH continues at pc. the chunk always ends in HALT,
+	// so there's no bound check. when profiling, every entry of the table
+	// leads to the profiler first, which goes on to the handler
+#if VM_THREADED_DISPATCH
+	static const void* const dispatch_table[] = {
+#define VM_LABEL(NAME) &&op_##NAME,
+		BYTECODE_OPCODES(VM_LABEL)
+#undef VM_LABEL
+	};
+	static const void* const profile_table[] = {
+#define VM_LABEL(NAME) &&profile,
+		BYTECODE_OPCODES(VM_LABEL)
+#undef VM_LABEL
+	};
+	const auto* table = should_profile ? profile_table : dispatch_table;
+#define VM_SWITCH(OPCODE) goto* table[(size_t)(OPCODE)];
+#define VM_CASE(NAME) op_##NAME
+#define VM_DISPATCH() \
+	code = codes[pc];   \
+	goto* table[(size_t)code.opcode]
+#else
+#define VM_SWITCH(OPCODE) switch (OPCODE)
+#define VM_CASE(NAME) case Opcode::NAME
+#define VM_DISPATCH() continue
+#endif
+#define VM_NEXT() \
+	pc++;           \
+	VM_DISPATCH()
+
 	size_t pc = 0;
-	while (pc < code.m_vec.size()) {
-		const auto& inst = code.m_vec[pc];
-		switch (inst.opcode) {
-			case Opcode::PRINTF: {
-				auto t1 = inst.operands[0];
-				auto t2 = cells[t1.as_register().index];
+	Code code {};
+	for (;;) {
+		code = codes[pc];
+#if not VM_THREADED_DISPATCH
+		if (should_profile) [[unlikely]]
+			profile_code(pc, code.opcode);
+#endif
+		VM_SWITCH(code.opcode) {
+#if VM_THREADED_DISPATCH
+			profile:
+				profile_code(pc, code.opcode);
+				goto* dispatch_table[(size_t)code.opcode];
+#endif
+			VM_CASE(PRINTF): {
+				auto t2 = fetch(code, 0);
 				if (not t2.is_pointer())
 					throw std::runtime_error("printf operand was not a pointer");
 				auto base = t2.as_pointer();
 				auto size = base.size();
 				for (size_t i = 0; i < size; i++) {
-					auto c = (*base[i]).as_integer();
+					auto c = (*base.unchecked_add(i)).as_integer();
 					if (c == 0) break;
-					output << (char)c;
+					output.put((char)c);
 				}
-				break;
-			}
-			case Opcode::PRINTV: {
-				auto t1 = fetch(inst.operands[0]);
-				assert(t1.is_integer());
-				output << t1.as_integer();
-				break;
-			}
-			case Opcode::PRINTC: {
-				auto t1 = fetch(inst.operands[0]);
-				assert(t1.is_integer());
-				output << (char)t1.as_integer();
-				break;
+				VM_NEXT();
 			}
-			case Opcode::READV: {
-				std::string line {};
-				if (not std::getline(input, line)) err("Couldn't read input");
-				int num = std::stoi(line);
-				if (inst.operands[0].type != Operand::Type::REGISTER)
-					err("First argument must be a register");
-				deref(inst.operands[0]) = Value::Integer(num);
-				break;
+			VM_CASE(PRINTV):
+				output.write(fetch(code, 0).as_integer());
+				VM_NEXT();
+			VM_CASE(PRINTC):
+				output.put((char)fetch(code, 0).as_integer());
+				VM_NEXT();
+			VM_CASE(READV): {
+				output.flush_for_input();
+				auto line = input.line();
+				if (not line.has_value()) err("Couldn't read input");
+				auto num = Input::parse_integer(line.value());
+				if (not num.has_value())
+					throw std::runtime_error("input line is not an integer");
+				reg(code, 0) = Value(num.value());
+				VM_NEXT();
 			}
-			case Opcode::READC: {
-				char c;
-				input >> c;
-				deref(inst.operands[0]) = (c == EOF) ? -1 : c;
-				break;
+			VM_CASE(READC): {
+				output.flush_for_input();
+				auto c = input.non_space();
+				reg(code, 0) = c.has_value() ? (Value::Integer)c.value() : -1;
+				VM_NEXT();
 			}
-			case Opcode::MOV: {
-				const auto& dest = inst.operands[0];
-				const auto& src = inst.operands[1];
-				auto& cell = cells[dest.as_register().index];
-				cell = fetch(src);
-				break;
+			VM_CASE(MOV): {
+				auto& cell = reg(code, 0);
+				cell = fetch(code, 1);
+				VM_NEXT();
 			}
-#define BIN_ARITH_OP(OP)                          \
-	{                                               \
-		auto t1 = fetch(inst.operands[1]);            \
-		assert(t1.is_integer());                      \
-		auto t2 = fetch(inst.operands[2]);            \
-		assert(t2.is_integer());                      \
-		cells[inst.operands[0].as_register().index] = \
-			t1.as_integer() OP t2.as_integer();         \
+#define BIN_ARITH_OP(OP)                               \
+	{                                                    \
+		auto t1 = fetch(code, 1);                          \
+		auto t2 = fetch(code, 2);                          \
+		reg(code, 0) = t1.as_integer() OP t2.as_integer(); \
+	}
+			VM_CASE(ADD): BIN_ARITH_OP(+); VM_NEXT();
+			VM_CASE(SUB): BIN_ARITH_OP(-); VM_NEXT();
+			VM_CASE(MUL): BIN_ARITH_OP(*); VM_NEXT();
+#define BIN_DIV_OP(OP)                                 \
+	{                                                    \
+		auto t1 = fetch(code, 1);                          \
+		auto t2 = fetch(code, 2);                          \
+		if (t2.as_integer() == 0) [[unlikely]]             \
+			throw std::runtime_error("division by zero");    \
+		reg(code, 0) = t1.as_integer() OP t2.as_integer(); \
 	}
-			case Opcode::ADD: BIN_ARITH_OP(+); break;
-			case Opcode::SUB: BIN_ARITH_OP(-); break;
-			case Opcode::MUL: BIN_ARITH_OP(*); break;
-			case Opcode::DIV: BIN_ARITH_OP(/); break;
-			case Opcode::MOD: BIN_ARITH_OP(%); break;
-			case Opcode::OR: BIN_ARITH_OP(||); break;
-			case Opcode::AND: BIN_ARITH_OP(&&); break;
-			case Opcode::EQ: BIN_ARITH_OP(==); break;
-			case Opcode::DIFF: BIN_ARITH_OP(!=); break;
-			case Opcode::LESS: BIN_ARITH_OP(<); break;
-			case Opcode::LESS_EQ: BIN_ARITH_OP(<=); break;
-			case Opcode::GREATER: BIN_ARITH_OP(>); break;
-			case Opcode::GREATER_EQ: BIN_ARITH_OP(>=); break;
-			case Opcode::NOT:
-				deref(inst.operands[0]) = !fetch(inst.operands[1]).as_integer();
-				break;
-			case Opcode::JMP:
-				pc = code.label_indexes.at(inst.operands[0].as_label().id);
-				goto dont_inc;
-			case Opcode::JMP_FALSE:
-				if (!fetch(inst.operands[0]).as_integer())
-					pc = code.label_indexes.at(inst.operands[1].as_label().id);
+			VM_CASE(DIV): BIN_DIV_OP(/); VM_NEXT();
+			VM_CASE(MOD): BIN_DIV_OP(%); VM_NEXT();
+#undef BIN_DIV_OP
+			VM_CASE(OR): BIN_ARITH_OP(||); VM_NEXT();
+			VM_CASE(AND): BIN_ARITH_OP(&&); VM_NEXT();
+			VM_CASE(EQ): BIN_ARITH_OP(==); VM_NEXT();
+			VM_CASE(DIFF): BIN_ARITH_OP(!=); VM_NEXT();
+			VM_CASE(LESS): BIN_ARITH_OP(<); VM_NEXT();
+			VM_CASE(LESS_EQ): BIN_ARITH_OP(<=); VM_NEXT();
+			VM_CASE(GREATER): BIN_ARITH_OP(>); VM_NEXT();
+			VM_CASE(GREATER_EQ): BIN_ARITH_OP(>=); VM_NEXT();
+#undef BIN_ARITH_OP
+			VM_CASE(NOT):
+				reg(code, 0) = !fetch(code, 1).as_integer();
+				VM_NEXT();
+			VM_CASE(JMP):
+				pc = (size_t)code.operands[0];
+				VM_DISPATCH();
+			VM_CASE(JMP_FALSE):
+				if (!fetch(code, 0).as_integer())
+					pc = (size_t)code.operands[1];
 				else
 					pc++;
-				goto dont_inc;
-			case Opcode::JMP_TRUE:
-				if (fetch(inst.operands[0]).as_integer())
-					pc = code.label_indexes.at(inst.operands[1].as_label().id);
+				VM_DISPATCH();
+			VM_CASE(JMP_TRUE):
+				if (fetch(code, 0).as_integer())
+					pc = (size_t)code.operands[1];
 				else
 					pc++;
-				goto dont_inc;
-			case Opcode::PUSH: {
-				if (inst.operands[0].type == Operand::Type::IMMEDIATE) {
-					stack.push(Value(inst.operands[0].as_immediate().number));
-				} else if (inst.operands[0].type == Operand::Type::REGISTER) {
-					stack.push(cells[inst.operands[0].as_register().index]);
-				} else {
-					throw std::runtime_error("can't push value");
-				}
-				break;
-			}
-			case Opcode::POP: {
-				assert(inst.operands[0].type == Operand::Type::REGISTER);
-				auto& cell = cells[inst.operands[0].as_register().index];
+				VM_DISPATCH();
+			VM_CASE(PUSH):
+				stack.push(fetch(code, 0));
+				VM_NEXT();
+			VM_CASE(POP): {
+				auto& cell = reg(code, 0);
 				cell = stack.top();
 				stack.pop();
-				break;
+				VM_NEXT();
 			}
-			case Opcode::CALL:
-				stack.push(Value((int64_t)pc));
-				pc = code.label_indexes.at(inst.operands[0].as_label().id) - 1;
-				break;
-			case Opcode::RET: pc = return_address; break;
-			case Opcode::FUNC:
-				return_address = (size_t)stack.top().as_integer();
-				stack.pop();
-				break;
-			case Opcode::ALLOCA: {
-				auto result_register = inst.operands[0];
-				auto size_register = inst.operands[1];
-				assert(result_register.type == Operand::Type::REGISTER);
-				assert(
-					size_register.type == Operand::Type::REGISTER
-					or size_register.type == Operand::Type::IMMEDIATE
-				);
-				auto a = fetch(size_register);
+			VM_CASE(CALL):
+				frames.push_back({pc + 1, base, top, heap.mark(), false});
+				pc = (size_t)code.operands[0];
+				VM_DISPATCH();
+			VM_CASE(FUNC): {
+				// the window must start out undefined, a recursive call would see
+				// the values of an earlier one otherwise
+				base = top;
+				top = base + (size_t)code.operands[0];
+				if (top > cells.size()) cells.resize(std::max(top, 2 * cells.size()));
+				auto window = cells.begin() + (ptrdiff_t)base;
+				std::fill(window, window + code.operands[0], Value());
+				VM_NEXT();
+			}
+			VM_CASE(RET): {
+				auto frame = frames.back();
+				frames.pop_back();
+				// a pointer stored in an array may belong to any frame below
+				if (frame.stored_pointer) {
+					if (not frames.empty()) frames.back().stored_pointer = true;
+				} else if (not escapes(frame.region, chunk.register_count)) {
+					heap.release(frame.region);
+				}
+				pc = frame.return_address;
+				base = frame.base;
+				top = frame.top;
+				VM_DISPATCH();
+			}
+			VM_CASE(ALLOCA): {
+				if (heap.should_collect()) collect_garbage(top);
+				auto a = fetch(code, 1);
 				if (not a.is_integer())
 					throw std::runtime_error("alloca size was not an integer");
-				auto size_integer = fetch(size_register).as_integer();
+				auto size_integer = a.as_integer();
 				assert(size_integer > 0);
-				auto register_index = result_register.as_register().index;
-				auto& cell = cells[register_index];
-				cell = Value(new Value[(size_t)size_integer], (size_t)size_integer);
-				if (not cell.is_pointer())
-					throw std::runtime_error("allocated value was not a pointer");
-				break;
+				if ((size_t)size_integer > Value::max_size)
+					throw std::runtime_error("alloca size is too big");
+				auto& cell = reg(code, 0);
+				auto size = (size_t)size_integer;
+				cell = Value(heap.allocate(size), size);
+				VM_NEXT();
 			}
-			case Opcode::STOREA: {
-				auto value_register = inst.operands[0];
-				auto offset_register = inst.operands[1];
-				auto base_register = inst.operands[2].as_register();
-				assert_oneof(
-					value_register.type, Operand::Type::REGISTER, Operand::Type::IMMEDIATE
-				);
-				assert(
-					value_register.type == Operand::Type::REGISTER
-					or value_register.type == Operand::Type::IMMEDIATE
-				);
-				assert(
-					offset_register.type == Operand::Type::REGISTER
-					or offset_register.type == Operand::Type::IMMEDIATE
-				);
-				auto value = fetch(value_register);
-				auto a = fetch(offset_register);
+			VM_CASE(STOREA): {
+				auto value = fetch(code, 0);
+				auto a = fetch(code, 1);
 				if (not a.is_integer())
 					throw std::runtime_error("storea offset operand was not an integer");
 				auto offset = a.as_integer();
-				if (not cells[base_register.index].is_pointer())
+				auto& target = reg(code, 2);
+				if (not target.is_pointer())
 					throw std::runtime_error("storea base operand was not a pointer");
-				auto t1 = cells[base_register.index];
-				auto pointer = t1.as_pointer();
+				auto pointer = target.as_pointer();
+				if (pointer.read_only())
+					throw std::runtime_error("storea base operand was a string constant");
 				auto cell = pointer[(size_t)offset];
 				*cell = Value(value);
-				break;
+				if (value.is_pointer() and not frames.empty())
+					frames.back().stored_pointer = true;
+				VM_NEXT();
 			}
-			case Opcode::LOADA: {
-				auto result_register = inst.operands[0];
-				auto offset_register = inst.operands[1];
-				auto pointer_register = inst.operands[2].as_register();
-				assert(result_register.type == Operand::Type::REGISTER);
-				auto a = fetch(offset_register);
+			VM_CASE(LOADA): {
+				auto a = fetch(code, 1);
 				if (not a.is_integer())
 					throw std::runtime_error("loada offset operand was not an integer");
 				auto offset = a.as_integer();
-				auto t1 = cells[pointer_register.index];
+				auto t1 = reg(code, 2);
 				if (not t1.is_pointer())
 					throw std::runtime_error("loada base operand was not a pointer");
 				auto pointer = t1.as_pointer();
 				auto value = pointer[(size_t)offset];
-				auto& cell = cells[result_register.as_register().index];
-				cell = *value;
-				break;
+				reg(code, 0) = *value;
+				VM_NEXT();
 			}
-			case Opcode::SHIFTA: {
-				auto result_register = inst.operands[0];
-				auto offset_register = inst.operands[1];
-				auto pointer_register = inst.operands[2];
-				assert(result_register.type == Operand::Type::REGISTER);
-				assert(
-					offset_register.type == Operand::Type::REGISTER
-					|| offset_register.type == Operand::Type::IMMEDIATE
-				);
-				assert(pointer_register.type == Operand::Type::REGISTER);
-				auto t1 = fetch(offset_register);
+			VM_CASE(SHIFTA): {
+				auto t1 = fetch(code, 1);
 				if (not t1.is_integer())
 					throw std::runtime_error("shifta offset operand was not an integer");
 				auto offset = t1.as_integer();
-				auto t2 = cells[pointer_register.as_register().index];
+				auto t2 = reg(code, 2);
 				if (not t2.is_pointer())
 					throw std::runtime_error("shifta base operand was not a pointer");
 				auto pointer = t2.as_pointer();
 				auto x = &pointer[(size_t)offset];
-				cells[result_register.as_register().index] = x;
-				break;
+				reg(code, 0) = x;
+				VM_NEXT();
+			}
+			VM_CASE(CLONEA): {
+				if (heap.should_collect()) collect_garbage(top);
+				auto source = fetch(code, 1);
+				reg(code, 0) = clone(heap, source);
+				VM_NEXT();
+			}
+#define CMP_JUMP_OP(OP)                                             \
+	{                                                                 \
+		if (fetch(code, 0).as_integer() OP fetch(code, 1).as_integer()) \
+			pc = (size_t)code.operands[2];                                \
+		else                                                            \
+			pc++;                                                         \
+	}
+			VM_CASE(JMP_EQ): CMP_JUMP_OP(==); VM_DISPATCH();
+			VM_CASE(JMP_DIFF): CMP_JUMP_OP(!=); VM_DISPATCH();
+			VM_CASE(JMP_LESS): CMP_JUMP_OP(<); VM_DISPATCH();
+			VM_CASE(JMP_LESS_EQ): CMP_JUMP_OP(<=); VM_DISPATCH();
+			VM_CASE(JMP_GREATER): CMP_JUMP_OP(>); VM_DISPATCH();
+			VM_CASE(JMP_GREATER_EQ): CMP_JUMP_OP(>=); VM_DISPATCH();
+#undef CMP_JUMP_OP
+#define UPDATE_ARRAY_OP(OP)                                           \
+	{                                                                   \
+		auto value = fetch(code, 0).as_integer();                         \
+		auto offset = fetch(code, 1).as_integer();                        \
+		auto pointer = reg(code, 2).as_pointer();                         \
+		if (pointer.read_only())                                          \
+			throw std::runtime_error("base operand was a string constant"); \
+		auto cell = pointer[(size_t)offset];                              \
+		*cell = (*cell).as_integer() OP value;                            \
+	}
+			VM_CASE(ADDA): UPDATE_ARRAY_OP(+); VM_NEXT();
+			VM_CASE(SUBA): UPDATE_ARRAY_OP(-); VM_NEXT();
+#undef UPDATE_ARRAY_OP
+			// the offset is an integer within the array, and the array is never
+			// a string constant
+			VM_CASE(LOADA_U): {
+				auto offset = fetch(code, 1).unchecked_integer();
+				auto pointer = reg(code, 2).unchecked_pointer();
+				reg(code, 0) = *pointer.unchecked_add((size_t)offset);
+				VM_NEXT();
+			}
+			VM_CASE(STOREA_U): {
+				auto value = fetch(code, 0);
+				auto offset = fetch(code, 1).unchecked_integer();
+				auto pointer = reg(code, 2).unchecked_pointer();
+				*pointer.unchecked_add((size_t)offset) = value;
+				if (value.is_pointer() and not frames.empty())
+					frames.back().stored_pointer = true;
+				VM_NEXT();
+			}
+			VM_CASE(SHIFTA_U): {
+				auto offset = fetch(code, 1).unchecked_integer();
+				auto pointer = reg(code, 2).unchecked_pointer();
+				reg(code, 0) = pointer.unchecked_add((size_t)offset);
+				VM_NEXT();
 			}
-			case Opcode::CLONEA: {
-				auto result_register = inst.operands[0];
-				auto source_register = inst.operands[1];
-				assert(result_register.type == Operand::Type::REGISTER);
-				assert(source_register.type == Operand::Type::REGISTER);
-				auto source = cells[source_register.as_register().index];
-				auto& destination = cells[result_register.as_register().index];
-				destination = clone(source);
-				break;
+			// the operands are integers on every path reaching the instruction
+#define INT_ARITH_OP(OP)                          \
+	{                                               \
+		auto t1 = fetch(code, 1).unchecked_integer(); \
+		auto t2 = fetch(code, 2).unchecked_integer(); \
+		reg(code, 0) = t1 OP t2;                      \
+	}
+			VM_CASE(ADD_I): INT_ARITH_OP(+); VM_NEXT();
+			VM_CASE(SUB_I): INT_ARITH_OP(-); VM_NEXT();
+			VM_CASE(MUL_I): INT_ARITH_OP(*); VM_NEXT();
+			VM_CASE(EQ_I): INT_ARITH_OP(==); VM_NEXT();
+			VM_CASE(DIFF_I): INT_ARITH_OP(!=); VM_NEXT();
+			VM_CASE(LESS_I): INT_ARITH_OP(<); VM_NEXT();
+			VM_CASE(LESS_EQ_I): INT_ARITH_OP(<=); VM_NEXT();
+			VM_CASE(GREATER_I): INT_ARITH_OP(>); VM_NEXT();
+			VM_CASE(GREATER_EQ_I): INT_ARITH_OP(>=); VM_NEXT();
+#undef INT_ARITH_OP
+#define INT_CMP_JUMP_OP(OP)                    \
+	{                                            \
+		if (fetch(code, 0).unchecked_integer()     \
+		    OP fetch(code, 1).unchecked_integer()) \
+			pc = (size_t)code.operands[2];           \
+		else                                       \
+			pc++;                                    \
+	}
+			VM_CASE(JMP_EQ_I): INT_CMP_JUMP_OP(==); VM_DISPATCH();
+			VM_CASE(JMP_DIFF_I): INT_CMP_JUMP_OP(!=); VM_DISPATCH();
+			VM_CASE(JMP_LESS_I): INT_CMP_JUMP_OP(<); VM_DISPATCH();
+			VM_CASE(JMP_LESS_EQ_I): INT_CMP_JUMP_OP(<=); VM_DISPATCH();
+			VM_CASE(JMP_GREATER_I): INT_CMP_JUMP_OP(>); VM_DISPATCH();
+			VM_CASE(JMP_GREATER_EQ_I): INT_CMP_JUMP_OP(>=); VM_DISPATCH();
+#undef INT_CMP_JUMP_OP
+			// quickened instructions. the registers they read and write are in
+			// the current window
+#define WINDOW(I) cells[base + (size_t)code.operands[I]]
+#define IMMEDIATE(I) ((Value::Integer)code.operands[I])
+			VM_CASE(MOV_R): WINDOW(0) = WINDOW(1); VM_NEXT();
+			VM_CASE(MOV_I): WINDOW(0) = IMMEDIATE(1); VM_NEXT();
+#define QUICK_ARITH_OP(NAME, OP)                                              \
+	VM_CASE(NAME##_RR):                                                         \
+	WINDOW(0) = WINDOW(1).unchecked_integer() OP WINDOW(2).unchecked_integer(); \
+	VM_NEXT();                                                                  \
+	VM_CASE(NAME##_RI):                                                         \
+	WINDOW(0) = WINDOW(1).unchecked_integer() OP IMMEDIATE(2);                  \
+	VM_NEXT()
+			QUICK_ARITH_OP(ADD_I, +);
+			QUICK_ARITH_OP(SUB_I, -);
+			QUICK_ARITH_OP(MUL_I, *);
+			QUICK_ARITH_OP(EQ_I, ==);
+			QUICK_ARITH_OP(DIFF_I, !=);
+			QUICK_ARITH_OP(LESS_I, <);
+			QUICK_ARITH_OP(LESS_EQ_I, <=);
+			QUICK_ARITH_OP(GREATER_I, >);
+			QUICK_ARITH_OP(GREATER_EQ_I, >=);
+#undef QUICK_ARITH_OP
+#define QUICK_CMP_JUMP_OP(NAME, OP)                                   \
+	VM_CASE(NAME##_RR):                                                 \
+	if (WINDOW(0).unchecked_integer() OP WINDOW(1).unchecked_integer()) \
+		pc = (size_t)code.operands[2];                                    \
+	else                                                                \
+		pc++;                                                             \
+	VM_DISPATCH();                                                      \
+	VM_CASE(NAME##_RI):                                                 \
+	if (WINDOW(0).unchecked_integer() OP IMMEDIATE(1))                  \
+		pc = (size_t)code.operands[2];                                    \
+	else                                                                \
+		pc++;                                                             \
+	VM_DISPATCH()
+			QUICK_CMP_JUMP_OP(JMP_EQ_I, ==);
+			QUICK_CMP_JUMP_OP(JMP_DIFF_I, !=);
+			QUICK_CMP_JUMP_OP(JMP_LESS_I, <);
+			QUICK_CMP_JUMP_OP(JMP_LESS_EQ_I, <=);
+			QUICK_CMP_JUMP_OP(JMP_GREATER_I, >);
+			QUICK_CMP_JUMP_OP(JMP_GREATER_EQ_I, >=);
+#undef QUICK_CMP_JUMP_OP
+			VM_CASE(JMP_FALSE_R):
+				if (!WINDOW(0).as_integer())
+					pc = (size_t)code.operands[1];
+				else
+					pc++;
+				VM_DISPATCH();
+			VM_CASE(JMP_TRUE_R):
+				if (WINDOW(0).as_integer())
+					pc = (size_t)code.operands[1];
+				else
+					pc++;
+				VM_DISPATCH();
+			VM_CASE(LOADA_U_RR): {
+				auto offset = WINDOW(1).unchecked_integer();
+				auto pointer = WINDOW(2).unchecked_pointer();
+				WINDOW(0) = *pointer.unchecked_add((size_t)offset);
+				VM_NEXT();
 			}
-			case Opcode::NOP: {
-				break;
+			VM_CASE(LOADA_U_IR): {
+				auto pointer = WINDOW(2).unchecked_pointer();
+				WINDOW(0) = *pointer.unchecked_add((size_t)IMMEDIATE(1));
+				VM_NEXT();
 			}
+#undef IMMEDIATE
+#undef WINDOW
+			VM_CASE(NOP): VM_NEXT();
+			VM_CASE(HALT): goto halt;
 		}
-		pc++;
-	dont_inc:
-		(void)0;
 	}
+#undef VM_NEXT
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef VM_SWITCH
 
-	if (should_print_result and code.result_opnd.has_value()) {
-		auto result = code.result_opnd.value();
-		if (result.type == Operand::Type::IMMEDIATE) {
-			auto t1 = fetch(result);
-			assert(t1.is_integer());
-			std::cout << "==> " << t1.as_integer() << '\n';
-		} else if (result.type == Operand::Type::REGISTER) {
-			std::cout << '%' << result.as_register().index << ' ';
-			auto reg = cells[result.as_register().index];
+halt:
+	if (should_profile) profile.finish();
+	output.flush();
+	if (should_print_result and chunk.result.has_value()) {
+		auto [kind, value] = chunk.result.value();
+		if (kind == Kind::IMMEDIATE) {
+			std::cout << "==> " << value << '\n';
+		} else if (kind == Kind::REGISTER) {
+			std::cout << '%' << value << ' ';
+			auto reg = cells[(size_t)value];
 			if (reg.is_integer()) {
 				std::cout << "==> " << reg.as_integer() << '\n';
 			} else if (reg.is_pointer()) {
@@ -322,27 +508,85 @@ void VM::run(const lir::Chunk& code) {
 			} else if (reg.is_undefined()) {
 				throw std::runtime_error("undefined result");
 			}
+		} else if (kind == Kind::STRING) {
+			auto str = literals[(size_t)value];
+			std::cout << "==> 0d" << str.as_pointer().address() << '\n';
 		} else {
 			std::cout << "VM ERROR: Couldn't print value" << '\n';
 		}
 	}
 }
+#if VM_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+void Value::Pointer::out_of_bounds(size_t size, size_t offset) {
+	throw std::runtime_error(
+		std::format(
+			"out of bounds pointer access (size={}, offset={})", size, offset
+		)
+	);
+}
+
+void Value::mismatch(Tag expected) const {
+	auto name = [](Tag tag) {
+		switch (tag) {
+			case Tag::UNDEFINED: return "undefined";
+			case Tag::INTEGER: return "integer";
+			case Tag::POINTER: return "pointer";
+		}
+		assert(false);
+	};
+	throw std::runtime_error(
+		std::format("expected {}, but was {}", name(expected), name(m_tag))
+	);
+}
+
+bool VM::escapes(Arena::Mark mark, size_t global_count) const {
+	// nothing was allocated
+	auto now = heap.mark();
+	if (now.chunk == mark.chunk and now.used == mark.used) return false;
+
+	auto refers = [&](const Value& value) {
+		if (not value.is_pointer()) return false;
+		auto address = (const Value*)value.as_pointer().address();
+		return heap.allocated_since(mark, address);
+	};
+	for (size_t i = 0; i < global_count; i++)
+		if (refers(cells[i])) return true;
+	for (const auto& value : stack.values())
+		if (refers(value)) return true;
+	return false;
+}
+
+void VM::collect_garbage(size_t top) {
+	std::vector<Value*> roots {};
+	roots.reserve(top + stack.size());
+	for (size_t i = 0; i < top; i++) roots.push_back(&cells[i]);
+	for (auto& value : stack.values()) roots.push_back(&value);
+
+	heap.collect(roots);
+
+	// the survivors were moved below every frame's region
+	for (auto& frame : frames) frame.region = heap.mark();
+}
 
-static Value clone(Value val) {
+static Value clone(Arena& heap, Value val) {
 	if (val.is_undefined()) {
 		return Value();
 	} else if (val.is_integer()) {
-		return Value::Integer(val.as_integer());
+		return Value(val.as_integer());
 	} else if (val.is_pointer()) {
-		return clone_pointer(val.as_pointer());
+		return clone_pointer(heap, val.as_pointer());
 	} else {
 		assert(false);
 	}
 }
 
-Value::Pointer clone_pointer(Value::Pointer ptr) {
-	auto a = new Value[ptr.m_size];
-	for (auto i = 0ul; i < ptr.m_size; i++) a[i] = clone(ptr.m_pointer[i]);
+Value::Pointer clone_pointer(Arena& heap, Value::Pointer ptr) {
+	auto a = heap.allocate(ptr.m_size);
+	for (auto i = 0ul; i < ptr.m_size; i++)
+		a[i] = clone(heap, ptr.m_pointer[i]);
 	Value::Pointer ptr2(a, ptr.m_size);
 	return ptr2;
 }
@@ -3,126 +3,181 @@
 #ifndef VM_HPP
 #define VM_HPP
 
-#include <array>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <istream>
 #include <stack>
-#include <stdexcept>
-#include <utility>
-#include <variant>
+#include <vector>
 
+#include "arena.hpp"
+#include "bytecode.hpp"
+#include "input.hpp"
 #include "lir.hpp"
+#include "output.hpp"
+#include "profile.hpp"
 
 namespace lir {
 
+// a tagged value. integers and pointers share the payload, so a value takes
+// 16 bytes instead of the 32 of a variant holding a fat pointer
 class Value {
  public:
-	class Integer {
-	 public:
-		Integer(int64_t integer) : m_data(integer) {}
-
-		operator int64_t const&() const { return m_data; }
-		operator int64_t&() { return m_data; }
+	using Integer = int64_t;
 
-	 private:
-		int64_t m_data;
-	};
+	enum class Tag : std::uint8_t { UNDEFINED, INTEGER, POINTER };
 
+	// view of an array of values, checked on access. read-only views point to
+	// constants, and so does every view derived from them
 	class Pointer {
 	 public:
-		Pointer(Value* pointer, std::size_t size)
-		: m_pointer(pointer), m_size(size) {}
-
-		Pointer operator+(std::size_t offset) {
-			if (offset >= m_size)
-				throw std::runtime_error(
-					std::format(
-						"out of bounds pointer access (size={}, offset={})", m_size, offset
-					)
-				);
-			return Pointer(&m_pointer[offset], m_size - offset);
+		Pointer(Value* pointer, std::size_t size, bool read_only = false)
+		: m_pointer(pointer), m_size(size), m_read_only(read_only) {}
+
+		Pointer operator+(std::size_t offset) const {
+			if (offset >= m_size) [[unlikely]]
+				out_of_bounds(m_size, offset);
+			return Pointer(&m_pointer[offset], m_size - offset, m_read_only);
+		}
+		Pointer operator[](std::size_t offset) const { return *this + offset; }
+		// for offsets known to be within the view
+		Pointer unchecked_add(std::size_t offset) const {
+			assert(offset < m_size);
+			return Pointer(&m_pointer[offset], m_size - offset, m_read_only);
 		}
-		Pointer operator[](std::size_t offset) { return *this + offset; }
-		Pointer operator&() { return *this; }
-		Value& operator*() { return *m_pointer; }
+		Pointer operator&() const { return *this; }
+		Value& operator*() const { return *m_pointer; }
 		std::size_t size() const { return m_size; }
 		void* address() const { return m_pointer; }
+		bool read_only() const { return m_read_only; }
 
-		friend Pointer clone_pointer(Pointer);
+		friend Pointer clone_pointer(Arena&, Pointer);
 
 	 private:
+		[[noreturn]] static void out_of_bounds(size_t size, size_t offset);
+
 		Value* m_pointer;
 		std::size_t m_size;
+		bool m_read_only;
 	};
 
- public:
-	Value(int64_t integer) : data(Integer(integer)) {}
-	Value(Value* pointer, std::size_t size) : data(Pointer(pointer, size)) {}
-	Value(const Pointer& pointer) : data(pointer) {}
-	Value(const Integer& integer) : data(integer) {}
-	Value() : data(std::monostate {}) {}
+	// largest amount of values a pointer can span
+	static constexpr std::size_t max_size = UINT32_MAX;
 
  public:
-	bool is_integer() const { return std::holds_alternative<Integer>(data); }
-	bool is_pointer() const { return std::holds_alternative<Pointer>(data); }
-	bool is_undefined() const {
-		return std::holds_alternative<std::monostate>(data);
+	Value(int64_t integer) : m_integer(integer), m_tag(Tag::INTEGER) {}
+	Value(Value* pointer, std::size_t size, bool read_only = false)
+	: m_pointer(pointer),
+	  m_size((uint32_t)size),
+	  m_tag(Tag::POINTER),
+	  m_read_only(read_only) {
+		assert(size <= max_size);
 	}
+	Value(const Pointer& pointer)
+	: Value((Value*)pointer.address(), pointer.size(), pointer.read_only()) {}
+	Value() : m_integer(0) {}
 
-	Integer const& as_integer() const {
-		if (is_pointer())
-			throw std::runtime_error("expected integer, but was pointer");
-		if (is_undefined())
-			throw std::runtime_error("expected integer, but was monostate");
-		return std::get<Integer>(data);
+ public:
+	Tag tag() const { return m_tag; }
+	bool is_integer() const { return m_tag == Tag::INTEGER; }
+	bool is_pointer() const { return m_tag == Tag::POINTER; }
+	bool is_undefined() const { return m_tag == Tag::UNDEFINED; }
+
+	Integer as_integer() const {
+		if (m_tag != Tag::INTEGER) [[unlikely]]
+			mismatch(Tag::INTEGER);
+		return m_integer;
 	}
 
-	Integer& as_integer() {
-		return const_cast<Integer&>(std::as_const(*this).as_integer());
+	Pointer as_pointer() const {
+		if (m_tag != Tag::POINTER) [[unlikely]]
+			mismatch(Tag::POINTER);
+		return Pointer(m_pointer, m_size, m_read_only);
 	}
 
-	Pointer const& as_pointer() const {
-		if (is_integer())
-			throw std::runtime_error("expected pointer, but was integer");
-		if (is_undefined())
-			throw std::runtime_error("expected pointer, but was monostate");
-		return std::get<Pointer>(data);
+	// for values whose tag is known from the code
+	Integer unchecked_integer() const {
+		assert(is_integer());
+		return m_integer;
 	}
-
-	Pointer& as_pointer() {
-		return const_cast<Pointer&>(std::as_const(*this).as_pointer());
+	Pointer unchecked_pointer() const {
+		assert(is_pointer());
+		return Pointer(m_pointer, m_size, m_read_only);
 	}
 
  private:
-	std::variant<Integer, Pointer, std::monostate> data;
-};
-
-inline bool operator==(const Value::Integer& x, int y) {
-	return (int64_t)x == y;
-}
+	[[noreturn]] void mismatch(Tag expected) const;
 
-inline bool operator!=(const Value::Integer& x, const Value::Integer& y) {
-	return (int64_t)x != (int64_t)y;
-}
+	union {
+		Integer m_integer;
+		Value* m_pointer;
+	};
+	uint32_t m_size {0};
+	Tag m_tag {Tag::UNDEFINED};
+	bool m_read_only {false};
+};
 
-inline bool operator==(const Value::Integer& x, const Value::Integer& y) {
-	return (int64_t)x == (int64_t)y;
-}
+static_assert(sizeof(Value) == 16);
 
 struct VM {
-	VM(std::istream& input, std::ostream& output)
-	: input {input}, output {output} {}
+	// input is shared when the program is read from it too
+	VM(std::istream& input, std::ostream& output, bool shared_input = false)
+	: input {input, shared_input}, output {output} {}
 
-	std::istream& input;
-	std::ostream& output;
+	Input input;
+	Output output;
 
 	bool should_print_result {true};
 
-	std::array<Value, 2048> cells {};
-	std::stack<Value> stack {};
+	// counts and times every code run into profile, at the cost of slowing
+	// every one of them down
+	bool should_profile {false};
+	Profile profile {};
+
+	// saved state of the caller
+	struct Frame {
+		size_t return_address;
+		size_t base;
+		size_t top;
+		// allocations made during the call, released when it returns unless
+		// one of them may still be referenced
+		Arena::Mark region;
+		bool stored_pointer;
+	};
+
+	class ValueStack : public std::stack<Value, std::vector<Value>> {
+	 public:
+		const std::vector<Value>& values() const { return c; }
+		std::vector<Value>& values() { return c; }
+	};
+
+	// the value stack. global registers come first, followed by the register
+	// window of each active call
+	std::vector<Value> cells {};
+	std::vector<Frame> frames {};
 
+	// arguments and return values are passed through here
+	ValueStack stack {};
+
+	// every array lives here. it's reset when the VM starts running, and
+	// collected when an allocation finds it over its threshold
+	Arena heap {};
+
+	// the characters of every string constant, back to back. it's laid out
+	// when the VM starts running and is never written to, so it's left alone
+	// by the collector and by the regions of calls
+	std::vector<Value> strings {};
+
+	// lowers the chunk to bytecode before running it
 	void run(const Chunk&);
+	void run(const bytecode::Chunk&);
+
+ private:
+	// whether a value allocated since mark can be reached after a call returns
+	bool escapes(Arena::Mark mark, size_t global_count) const;
+
+	// the registers up to top and the argument stack are the roots
+	void collect_garbage(size_t top);
 };
 
 } // namespace lir
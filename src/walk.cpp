@@ -70,22 +70,77 @@ auto Interpreter::eval_application(
 		return val;
 	} else if (std::holds_alternative<CustomFunction>(*func_ptr)) {
 		auto custom = std::get<CustomFunction>(*func_ptr);
-		enter_new_scope();
-		for (size_t i = 0; i < args.size(); i++) {
-			const auto& param_node = ast.at(custom.param_idxs[i]);
-			assert(param_node.type == NodeType::ID);
-			auto cell = ctx.env.insert(ctx.scope_id, param_node.str_id, args[i]);
-			assert(cell != nullptr);
+		// calls to itself in tail position evaluate the body again in a fresh
+		// scope, instead of nesting the scope and the C++ frame of a new call
+		for (;;) {
+			enter_new_scope();
+			for (size_t i = 0; i < args.size(); i++) {
+				const auto& param_node = ast.at(custom.param_idxs[i]);
+				assert(param_node.type == NodeType::ID);
+				auto cell = ctx.env.insert(ctx.scope_id, param_node.str_id, args[i]);
+				assert(cell != nullptr);
+			}
+
+			auto val = eval_tail(custom.body_idx, custom.body_idx, args);
+			close_current_scope();
+			if (val != nullptr) return val;
 		}
-
-		auto val = eval_node(custom.body_idx);
-		close_current_scope();
-		return val;
 	} else {
 		assert(false);
 	}
 }
 
+// evaluates an expression in tail position of the function with the given
+// body. a call to that same function isn't made: its arguments are stored in
+// args and nullptr is returned instead, once the scopes opened are closed
+auto Interpreter::eval_tail(
+	NodeIndex node_idx, NodeIndex body_idx, std::vector<ValueCell>& args
+) -> ValueCell {
+	const auto& node = ast.at(node_idx);
+	switch (node.type) {
+		case NodeType::APP: {
+			const auto& func_node = ast.at(node[0]);
+			if (func_node.type != NodeType::ID) break;
+			auto func_ptr = find_variable(func_node.str_id);
+			if (not func_ptr.has_value()
+			    or not std::holds_alternative<CustomFunction>(*func_ptr->get())
+			    or std::get<CustomFunction>(*func_ptr->get()).body_idx.index
+			         != body_idx.index)
+				break;
+			std::vector<ValueCell> tail_args {};
+			for (auto arg_idx : ast.at(node[1]))
+				tail_args.push_back(eval_node(arg_idx));
+			args = std::move(tail_args);
+			return nullptr;
+		}
+		case NodeType::IF:
+		case NodeType::WHEN: {
+			const auto cond = eval_node(node[0]);
+			if (std::get<bool>(*cond)) return eval_tail(node[1], body_idx, args);
+			if (node.type == NodeType::IF) return eval_tail(node[2], body_idx, args);
+			return std::make_shared<Value>(Nil {});
+		}
+		case NodeType::BLK: {
+			auto res = std::make_shared<Value>(Nil {});
+			enter_new_scope();
+			for (size_t i = 0; i < node.size(); i++)
+				res = i + 1 == node.size() ? eval_tail(node[i], body_idx, args)
+				                           : eval_node(node[i]);
+			close_current_scope();
+			return res;
+		}
+		case NodeType::LET: {
+			enter_new_scope();
+			for (auto decl_idx : ast.at(node[0])) eval_node(decl_idx);
+			const auto res = eval_tail(node[1], body_idx, args);
+			close_current_scope();
+			return res;
+		}
+		default: break;
+	}
+	return eval_node(node_idx);
+}
+
 auto Interpreter::eval_block(std::span<NodeIndex> exp_idxs) -> ValueCell {
 	auto res = std::make_shared<Value>(Nil {});
 	enter_new_scope();
@@ -318,8 +373,10 @@ auto Interpreter::eval_arithmetic(
 	} else if (operation == '*') {
 		result_int = left_int * right_int;
 	} else if (operation == '/') {
+		if (right_int == 0) err("Division by zero");
 		result_int = left_int / right_int;
 	} else if (operation == '%') {
+		if (right_int == 0) err("Division by zero");
 		result_int = left_int % right_int;
 	} else {
 		err("Unknown arithmetic operator");
@@ -518,18 +575,26 @@ std::ostream& operator<<(std::ostream& st, const ValueCell& val) {
 }
 
 ValueCell Interpreter::builtin_read(std::vector<ValueCell>) {
-	std::string line {};
-	if (not std::getline(input, line)) err("Could not read input line");
-	try { // try parsing as a number
-		int num = std::stoi(line);
-		return std::make_shared<Value>(num);
-	} catch (...) { // otherwise return as string
-		return std::make_shared<Value>(line);
-	}
+	output.flush_for_input();
+	auto line = input.line();
+	if (not line.has_value()) err("Could not read input line");
+	// a number if it parses as one, the line otherwise
+	if (auto num = Input::parse_integer(line.value()); num.has_value())
+		return std::make_shared<Value>(num.value());
+	return std::make_shared<Value>(std::string(line.value()));
 }
 
 ValueCell Interpreter::builtin_write(std::vector<ValueCell> args) {
-	for (const auto& arg : args) output << arg;
+	for (const auto& arg : args) {
+		if (std::holds_alternative<int>(*arg))
+			output.write(std::get<int>(*arg));
+		else if (std::holds_alternative<std::string>(*arg))
+			output.write(std::get<std::string>(*arg));
+		else if (std::holds_alternative<bool>(*arg))
+			output.put(std::get<bool>(*arg) ? '1' : '0');
+		else
+			err("Can't print value");
+	}
 	return std::make_shared<Value>(Nil {});
 }
 
@@ -557,9 +622,13 @@ ValueCell Interpreter::builtin_exit(std::vector<ValueCell> args) {
 }
 
 Interpreter::Interpreter(
-	StringPool& pool, const AST& ast, std::istream& input, std::ostream& output
+	StringPool& pool,
+	const AST& ast,
+	std::istream& input,
+	std::ostream& output,
+	bool shared_input
 )
-: pool {pool}, ast {ast}, input {input}, output {output} {}
+: pool {pool}, ast {ast}, input {input, shared_input}, output {output} {}
 
 #define PUSH_BUILTIN(STR, FUNC, COUNT)                      \
 	*ctx.env.insert(ctx.scope_id, pool.intern(strdup(STR))) = \
@@ -573,6 +642,7 @@ ValueCell Interpreter::eval() {
 	PUSH_BUILTIN("make_array", &Interpreter::builtin_array, 1);
 	PUSH_BUILTIN("exit", &Interpreter::builtin_exit, 1);
 	const auto val = eval_node(ast.root_index);
+	output.flush();
 	return val;
 }
 
@@ -11,6 +11,8 @@
 #include "ast.hpp"
 #include "env.hpp"
 #include "evaluator.hpp"
+#include "input.hpp"
+#include "output.hpp"
 #include "str_pool.h"
 
 namespace walk {
@@ -55,14 +57,19 @@ struct Context {
 };
 
 struct Interpreter {
+	// input is shared when the program is read from it too
 	Interpreter(
-		StringPool& pool, const AST& ast, std::istream& input, std::ostream& output
+		StringPool& pool,
+		const AST& ast,
+		std::istream& input,
+		std::ostream& output,
+		bool shared_input = false
 	);
 
 	StringPool& pool;
 	const AST& ast;
-	std::istream& input;
-	std::ostream& output;
+	Input input;
+	Output output;
 
 	Context ctx;
 
@@ -96,6 +103,9 @@ struct Interpreter {
 	// clang-format on
 
 	auto eval_node(NodeIndex node_idx) -> ValueCell;
+	auto eval_tail(
+		NodeIndex node_idx, NodeIndex body_idx, std::vector<ValueCell>& args
+	) -> ValueCell;
 
 	auto find_variable(StrID string_id)
 		-> std::optional<std::reference_wrapper<ValueCell>>;
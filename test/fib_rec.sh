@@ -0,0 +1 @@
+echo 20